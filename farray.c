@@ -10,12 +10,13 @@
 
 void farray_print(fenv_t *f, fobj_t *p)
 {
-    ASSERT(p->type == FOBJ_TABLE);
+    ASSERT(p->type == FOBJ_ARRAY);
     farray_t *a = &p->u.array;
 
     for (int i = 0; i < a->num; i++) {
-        printf("array[%d] = ", i);
+        fout_printf(f, "array[%d] = ", i);
         fobj_print(f, a->elems[i]);
+        fout_printf(f, " ");
     }
 
 }
@@ -24,6 +25,7 @@ fobj_t *farray_new(fenv_t *f)
 {
     fobj_t *a = fobj_new(f, FOBJ_ARRAY);
     a->u.array.num = 0;
+    a->u.array.cap = 0;
     a->u.array.elems = NULL;
     return a;
 }
@@ -39,20 +41,74 @@ void farray_visit(fenv_t *f, fobj_t *p)
 
 void farray_free(fenv_t *f, fobj_t *a)
 {
-    if (a->u.array.num > 0) {
-        free(a->u.array.elems);
-    }
+    free(a->u.array.elems);
 }
 
+static void farray_set_cap(fenv_t *f, farray_t *a, int cap)
+{
+    ASSERT(cap >= a->num);
+    a->elems = realloc(a->elems, (cap ? cap : 1) * sizeof(fobj_t *));
+    FASSERT(a->elems, "out of memory for an array of %d", cap);
+    a->cap = cap;
+}
 
+/*
+ * farray_grow()
+ *
+ * Make the array n long.  Its capacity at least doubles each time it has
+ * to grow, so filling an array one element at a time copies each
+ * element a constant number of times on average.
+ */
 static void farray_grow(fenv_t *f, farray_t *a, int n)
 {
     ASSERT(n > a->num);
-    a->elems = realloc(a->elems, n * sizeof(fobj_t **));
-    bzero(&a->elems[a->num], (n - a->num) * sizeof(fobj_t **));
+    if (n > a->cap) {
+        int cap = 2 * a->cap;
+        if (cap < 8) cap = 8;
+        if (cap < n) cap = n;
+        farray_set_cap(f, a, cap);
+    }
+    bzero(&a->elems[a->num], (n - a->num) * sizeof(fobj_t *));
     a->num = n;
 }
 
+/*
+ * farray_reserve() and farray_shrink()
+ *
+ * Capacity hints: make room for n elements in all, or give back what
+ * isn't in use.
+ */
+void farray_reserve(fenv_t *f, fobj_t *p, int n)
+{
+    farray_t *a = &p->u.array;
+
+    FASSERT(n >= 0, "can't reserve a negative number of elements");
+    if (n > a->cap) {
+        farray_set_cap(f, a, n);
+    }
+}
+
+/*
+ * farray_resize()
+ *
+ * Make the array at least n long, the new elements NULL.
+ */
+void farray_resize(fenv_t *f, fobj_t *p, int n)
+{
+    if (n > p->u.array.num) {
+        farray_grow(f, &p->u.array, n);
+    }
+}
+
+void farray_shrink(fenv_t *f, fobj_t *p)
+{
+    farray_t *a = &p->u.array;
+
+    if (a->cap > a->num) {
+        farray_set_cap(f, a, a->num);
+    }
+}
+
 static fobj_t **farray_num_index(fenv_t *f, farray_t *a, fnumber_t n)
 {
     if (n < 0) return NULL;
@@ -96,3 +152,23 @@ fobj_t *farray_fetch(fenv_t *f, fobj_t *addr, fobj_t *index)
     }
 }
 
+/*
+ * farray_next()
+ *
+ * Walk the elements of an array, skipping empty ones.  *cursor starts
+ * at 0; each call sets *val to the next element and returns 1, or
+ * returns 0 at the end.  The element's index is then *cursor - 1.
+ */
+int farray_next(fenv_t *f, fobj_t *p, int *cursor, fobj_t **val)
+{
+    farray_t *a = &p->u.array;
+
+    while (*cursor < a->num) {
+        fobj_t *v = a->elems[(*cursor)++];
+        if (v) {
+            *val = v;
+            return 1;
+        }
+    }
+    return 0;
+}
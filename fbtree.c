@@ -0,0 +1,505 @@
+/*
+ * This file is part of arm-sim: http://madscientistroom.org/arm-sim
+ *
+ * Copyright (c) 2010 Randy Thelen. All rights reserved, and all wrongs
+ * reversed. (See the file COPYRIGHT for details.)
+ */
+
+#include "forth.h"
+#include "fobj.h"
+
+/*
+ * An ordered map implemented as a B-tree.  Keys are NUMs or STRINGs; all
+ * NUMs sort before all STRINGs.  The nodes are plain malloc'd blocks (not
+ * fobjs) so a big map doesn't eat into the object memory; only the keys
+ * and values are objects and those are marked by fbtree_visit().
+ *
+ * BTREE_T is the minimum degree: every node other than the root holds
+ * between BTREE_T - 1 and 2 * BTREE_T - 1 keys.  The keys of a node are
+ * kept together so a search touches a couple of cache lines per level.
+ */
+
+#define BTREE_T			16
+#define BTREE_MAX		(2 * BTREE_T - 1)
+
+struct fbtree_node_s {
+    int				 n;
+    int				 leaf;
+    fobj_t			*keys[BTREE_MAX];
+    fobj_t			*vals[BTREE_MAX];
+    fbtree_node_t	*child[BTREE_MAX + 1];
+};
+
+static fbtree_node_t *fbtree_node_new(int leaf)
+{
+    fbtree_node_t *x = calloc(1, sizeof(*x));
+    x->leaf = leaf;
+    return x;
+}
+
+int fbtree_key_cmp(fenv_t *f, fobj_t *a, fobj_t *b)
+{
+    if (a->type != b->type) {
+        return a->type < b->type ? -1 : 1;
+    }
+
+    return fobj_cmp(f, a, b);
+}
+
+/*
+ * Return the index of the first key in x which is >= key.  *found is set
+ * if that key is equal to key.
+ */
+static int fbtree_node_search(fenv_t *f, fbtree_node_t *x, fobj_t *key, int *found)
+{
+    int lo = 0, hi = x->n;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (fbtree_key_cmp(f, x->keys[mid], key) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    *found = lo < x->n && fbtree_key_cmp(f, x->keys[lo], key) == 0;
+    return lo;
+}
+
+fobj_t *fbtree_new(fenv_t *f)
+{
+    fobj_t *p = fobj_new(f, FOBJ_BTREE);
+    fbtree_t *t = &p->u.btree;
+
+    t->num = 0;
+    t->root = NULL;
+
+    return p;
+}
+
+static void fbtree_node_visit(fenv_t *f, fbtree_node_t *x)
+{
+    for (int i = 0; i < x->n; i++) {
+        fobj_visit(f, x->keys[i]);
+        fobj_visit(f, x->vals[i]);
+    }
+
+    if (!x->leaf) {
+        for (int i = 0; i <= x->n; i++) {
+            fbtree_node_visit(f, x->child[i]);
+        }
+    }
+}
+
+void fbtree_visit(fenv_t *f, fobj_t *p)
+{
+    fbtree_t *t = &p->u.btree;
+
+    if (t->root) {
+        fbtree_node_visit(f, t->root);
+    }
+}
+
+static void fbtree_node_free(fbtree_node_t *x)
+{
+    if (!x->leaf) {
+        for (int i = 0; i <= x->n; i++) {
+            fbtree_node_free(x->child[i]);
+        }
+    }
+    free(x);
+}
+
+void fbtree_free(fenv_t *f, fobj_t *p)
+{
+    fbtree_t *t = &p->u.btree;
+
+    if (t->root) {
+        fbtree_node_free(t->root);
+        t->root = NULL;
+    }
+    t->num = 0;
+}
+
+static void fbtree_node_print(fenv_t *f, fbtree_node_t *x)
+{
+    for (int i = 0; i < x->n; i++) {
+        if (!x->leaf) fbtree_node_print(f, x->child[i]);
+        fobj_print(f, x->keys[i]);
+        fout_printf(f, " = ");
+        fobj_print(f, x->vals[i]);
+        fout_printf(f, "\n");
+    }
+
+    if (!x->leaf) fbtree_node_print(f, x->child[x->n]);
+}
+
+void fbtree_print(fenv_t *f, fobj_t *p)
+{
+    ASSERT(p->type == FOBJ_BTREE);
+    fbtree_t *t = &p->u.btree;
+
+    if (t->root) {
+        fbtree_node_print(f, t->root);
+    }
+}
+
+/***********************************
+ *
+ * Lookup
+ *
+ ***********************************/
+
+static fobj_t **fbtree_lookup(fenv_t *f, fbtree_t *t, fobj_t *key)
+{
+    fbtree_node_t *x = t->root;
+
+    while (x) {
+        int found;
+        int i = fbtree_node_search(f, x, key, &found);
+        if (found)   return &x->vals[i];
+        if (x->leaf) return NULL;
+        x = x->child[i];
+    }
+
+    return NULL;
+}
+
+/*
+ * fbtree_seek()
+ *
+ * Find the nearest entry to key.  mode is one of:
+ *    FBTREE_FLOOR:    the largest key <= key
+ *    FBTREE_CEILING:  the smallest key >= key
+ *    FBTREE_HIGHER:   the smallest key > key
+ *
+ * Returns 1 and fills in *kp, *vp if there is such an entry.
+ */
+int fbtree_seek(fenv_t *f, fobj_t *p, fobj_t *key, int mode, fobj_t **kp, fobj_t **vp)
+{
+    fbtree_node_t *x = p->u.btree.root;
+    int have = 0;
+
+    while (x) {
+        int found;
+        int i = fbtree_node_search(f, x, key, &found);
+
+        if (found && mode != FBTREE_HIGHER) {
+            *kp = x->keys[i];
+            *vp = x->vals[i];
+            return 1;
+        }
+
+        switch (mode) {
+        case FBTREE_FLOOR:
+            if (i > 0) {
+                *kp = x->keys[i - 1];
+                *vp = x->vals[i - 1];
+                have = 1;
+            }
+            break;
+
+        case FBTREE_HIGHER:
+            /*
+             * keys[i] == key; everything bigger is to its right.
+             */
+            if (found) i++;
+            /* Fall through */
+
+        case FBTREE_CEILING:
+            if (i < x->n) {
+                *kp = x->keys[i];
+                *vp = x->vals[i];
+                have = 1;
+            }
+            break;
+        }
+
+        if (x->leaf) break;
+        x = x->child[i];
+    }
+
+    return have;
+}
+
+/***********************************
+ *
+ * Insertion
+ *
+ ***********************************/
+
+/*
+ * Split the full child y = x->child[i] into two nodes, moving the median
+ * key up into x.
+ */
+static void fbtree_split_child(fbtree_node_t *x, int i)
+{
+    fbtree_node_t *y = x->child[i];
+    fbtree_node_t *z = fbtree_node_new(y->leaf);
+
+    z->n = BTREE_T - 1;
+    memcpy(z->keys, &y->keys[BTREE_T], (BTREE_T - 1) * sizeof(fobj_t *));
+    memcpy(z->vals, &y->vals[BTREE_T], (BTREE_T - 1) * sizeof(fobj_t *));
+    if (!y->leaf) {
+        memcpy(z->child, &y->child[BTREE_T], BTREE_T * sizeof(fbtree_node_t *));
+    }
+    y->n = BTREE_T - 1;
+
+    memmove(&x->child[i + 2], &x->child[i + 1], (x->n - i) * sizeof(fbtree_node_t *));
+    memmove(&x->keys[i + 1], &x->keys[i], (x->n - i) * sizeof(fobj_t *));
+    memmove(&x->vals[i + 1], &x->vals[i], (x->n - i) * sizeof(fobj_t *));
+    x->child[i + 1] = z;
+    x->keys[i] = y->keys[BTREE_T - 1];
+    x->vals[i] = y->vals[BTREE_T - 1];
+    x->n++;
+}
+
+static void fbtree_insert_nonfull(fenv_t *f, fbtree_node_t *x, fobj_t *key, fobj_t *val)
+{
+    do {
+        int found;
+        int i = fbtree_node_search(f, x, key, &found);
+        ASSERT(!found);
+
+        if (x->leaf) {
+            memmove(&x->keys[i + 1], &x->keys[i], (x->n - i) * sizeof(fobj_t *));
+            memmove(&x->vals[i + 1], &x->vals[i], (x->n - i) * sizeof(fobj_t *));
+            x->keys[i] = key;
+            x->vals[i] = val;
+            x->n++;
+            return;
+        }
+
+        if (x->child[i]->n == BTREE_MAX) {
+            fbtree_split_child(x, i);
+            if (fbtree_key_cmp(f, key, x->keys[i]) > 0) {
+                i++;
+            }
+        }
+        x = x->child[i];
+    } while (1);
+}
+
+static void fbtree_insert(fenv_t *f, fbtree_t *t, fobj_t *key, fobj_t *val)
+{
+    fobj_t **valp = fbtree_lookup(f, t, key);
+
+    if (valp) {
+        *valp = val;
+        return;
+    }
+
+    if (!t->root) {
+        t->root = fbtree_node_new(1);
+    }
+
+    if (t->root->n == BTREE_MAX) {
+        fbtree_node_t *s = fbtree_node_new(0);
+        s->child[0] = t->root;
+        t->root = s;
+        fbtree_split_child(s, 0);
+    }
+
+    fbtree_insert_nonfull(f, t->root, key, val);
+    t->num++;
+}
+
+/***********************************
+ *
+ * Deletion
+ *
+ * The usual single pass algorithm: before descending into a child make
+ * sure it has at least BTREE_T keys so that a key can be removed from it
+ * without any fix ups on the way back up.
+ *
+ ***********************************/
+
+static void fbtree_remove_at(fbtree_node_t *x, int i)
+{
+    memmove(&x->keys[i], &x->keys[i + 1], (x->n - i - 1) * sizeof(fobj_t *));
+    memmove(&x->vals[i], &x->vals[i + 1], (x->n - i - 1) * sizeof(fobj_t *));
+    x->n--;
+}
+
+/*
+ * Merge x->child[i + 1] and the separating key x->keys[i] into
+ * x->child[i].
+ */
+static void fbtree_merge(fbtree_node_t *x, int i)
+{
+    fbtree_node_t *y = x->child[i];
+    fbtree_node_t *z = x->child[i + 1];
+
+    y->keys[y->n] = x->keys[i];
+    y->vals[y->n] = x->vals[i];
+    memcpy(&y->keys[y->n + 1], z->keys, z->n * sizeof(fobj_t *));
+    memcpy(&y->vals[y->n + 1], z->vals, z->n * sizeof(fobj_t *));
+    if (!y->leaf) {
+        memcpy(&y->child[y->n + 1], z->child, (z->n + 1) * sizeof(fbtree_node_t *));
+    }
+    y->n += z->n + 1;
+
+    fbtree_remove_at(x, i);
+    memmove(&x->child[i + 1], &x->child[i + 2], (x->n - i) * sizeof(fbtree_node_t *));
+    free(z);
+}
+
+/*
+ * Make sure x->child[i] has at least BTREE_T keys by borrowing from a
+ * sibling or merging with one.  Returns the index of the child which now
+ * covers the range of the original child[i].
+ */
+static int fbtree_fill_child(fbtree_node_t *x, int i)
+{
+    fbtree_node_t *c = x->child[i];
+
+    if (i > 0 && x->child[i - 1]->n >= BTREE_T) {
+        fbtree_node_t *l = x->child[i - 1];
+
+        memmove(&c->keys[1], c->keys, c->n * sizeof(fobj_t *));
+        memmove(&c->vals[1], c->vals, c->n * sizeof(fobj_t *));
+        if (!c->leaf) {
+            memmove(&c->child[1], c->child, (c->n + 1) * sizeof(fbtree_node_t *));
+            c->child[0] = l->child[l->n];
+        }
+        c->keys[0] = x->keys[i - 1];
+        c->vals[0] = x->vals[i - 1];
+        c->n++;
+
+        x->keys[i - 1] = l->keys[l->n - 1];
+        x->vals[i - 1] = l->vals[l->n - 1];
+        l->n--;
+        return i;
+    }
+
+    if (i < x->n && x->child[i + 1]->n >= BTREE_T) {
+        fbtree_node_t *r = x->child[i + 1];
+
+        c->keys[c->n] = x->keys[i];
+        c->vals[c->n] = x->vals[i];
+        if (!c->leaf) {
+            c->child[c->n + 1] = r->child[0];
+            memmove(r->child, &r->child[1], r->n * sizeof(fbtree_node_t *));
+        }
+        c->n++;
+
+        x->keys[i] = r->keys[0];
+        x->vals[i] = r->vals[0];
+        fbtree_remove_at(r, 0);
+        return i;
+    }
+
+    if (i < x->n) {
+        fbtree_merge(x, i);
+        return i;
+    } else {
+        fbtree_merge(x, i - 1);
+        return i - 1;
+    }
+}
+
+static void fbtree_node_delete(fenv_t *f, fbtree_node_t *x, fobj_t *key)
+{
+    do {
+        int found;
+        int i = fbtree_node_search(f, x, key, &found);
+
+        if (found && x->leaf) {
+            fbtree_remove_at(x, i);
+            return;
+        }
+
+        if (found) {
+            fbtree_node_t *y = x->child[i];
+            fbtree_node_t *z = x->child[i + 1];
+
+            if (y->n >= BTREE_T) {
+                /*
+                 * Replace the key with its predecessor and then delete the
+                 * predecessor from the left subtree.
+                 */
+                fbtree_node_t *pred = y;
+                while (!pred->leaf) pred = pred->child[pred->n];
+                x->keys[i] = pred->keys[pred->n - 1];
+                x->vals[i] = pred->vals[pred->n - 1];
+                key = x->keys[i];
+                x = y;
+            } else if (z->n >= BTREE_T) {
+                fbtree_node_t *succ = z;
+                while (!succ->leaf) succ = succ->child[0];
+                x->keys[i] = succ->keys[0];
+                x->vals[i] = succ->vals[0];
+                key = x->keys[i];
+                x = z;
+            } else {
+                fbtree_merge(x, i);
+                x = y;
+            }
+            continue;
+        }
+
+        if (x->leaf) {
+            return;  // Not in the tree
+        }
+
+        if (x->child[i]->n < BTREE_T) {
+            i = fbtree_fill_child(x, i);
+        }
+        x = x->child[i];
+    } while (1);
+}
+
+static void fbtree_delete(fenv_t *f, fbtree_t *t, fobj_t *key)
+{
+    if (!fbtree_lookup(f, t, key)) {
+        return;
+    }
+
+    fbtree_node_delete(f, t->root, key);
+    t->num--;
+
+    if (t->root->n == 0) {
+        fbtree_node_t *old = t->root;
+        t->root = old->leaf ? NULL : old->child[0];
+        free(old);
+    }
+}
+
+/***********************************
+ *
+ * Object interface
+ *
+ ***********************************/
+
+static void fbtree_check_key(fenv_t *f, fobj_t *key)
+{
+    FASSERT(key, "btree must be indexed");
+    FASSERT(key->type == FOBJ_NUM || key->type == FOBJ_STR,
+            "btree must be indexed by NUM or STRING");
+}
+
+fobj_t *fbtree_fetch(fenv_t *f, fobj_t *addr, fobj_t *index)
+{
+    fbtree_t *t = &addr->u.btree;
+
+    if (!index) {
+        return fnum_new(f, t->num);
+    }
+
+    fbtree_check_key(f, index);
+    fobj_t **valp = fbtree_lookup(f, t, index);
+    return valp ? *valp : NULL;
+}
+
+void fbtree_store(fenv_t *f, fobj_t *addr, fobj_t *index, fobj_t *data)
+{
+    fbtree_check_key(f, index);
+    fbtree_insert(f, &addr->u.btree, index, data);
+}
+
+void fbtree_remove(fenv_t *f, fobj_t *addr, fobj_t *key)
+{
+    fbtree_check_key(f, key);
+    fbtree_delete(f, &addr->u.btree, key);
+}
@@ -0,0 +1,209 @@
+/*
+ * This file is part of arm-sim: http://madscientistroom.org/arm-sim
+ *
+ * Copyright (c) 2010 Randy Thelen. All rights reserved, and all wrongs
+ * reversed. (See the file COPYRIGHT for details.)
+ */
+
+#include "forth.h"
+#include "fobj.h"
+
+/*
+ * Byte buffers
+ *
+ * A bytes object is a window onto raw memory: either a buffer the Forth
+ * allocated (and frees), memory the host owns (the simulator's RAM, say)
+ * or a view into another bytes object.  Nothing is ever copied; c@ and
+ * friends read and write the memory in place.
+ *
+ * Multi-byte accesses use the buffer's byte order, which is little endian
+ * unless changed with big-endian.
+ */
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define FBYTES_HOST_BIG_ENDIAN	1
+#else
+#define FBYTES_HOST_BIG_ENDIAN	0
+#endif
+
+fobj_t *fbytes_new(fenv_t *f, void *base, size_t len, int owned)
+{
+    fobj_t *p = fobj_new(f, FOBJ_BYTES);
+    fbytes_t *b = &p->u.bytes;
+
+    b->base = base;
+    b->len = len;
+    b->owned = owned;
+    b->big_endian = 0;
+    b->parent = NULL;
+
+    return p;
+}
+
+fobj_t *fbytes_alloc(fenv_t *f, size_t len)
+{
+    void *base = calloc(len ? len : 1, 1);
+    FASSERT(base, "out of memory allocating %zu bytes", len);
+    return fbytes_new(f, base, len, 1);
+}
+
+/*
+ * fbytes_view()
+ *
+ * Return a bytes object for len bytes at offset in p.  The view keeps p
+ * alive and inherits its byte order.
+ */
+fobj_t *fbytes_view(fenv_t *f, fobj_t *p, size_t offset, size_t len)
+{
+    fbytes_t *b = &p->u.bytes;
+
+    FASSERT(offset <= b->len && len <= b->len - offset,
+            "view of %zu bytes at %zu is outside a %zu byte buffer",
+            len, offset, b->len);
+
+    fobj_t *v = fbytes_new(f, b->base + offset, len, 0);
+    v->u.bytes.big_endian = b->big_endian;
+    v->u.bytes.parent = p;
+    return v;
+}
+
+/*
+ * fbytes_register()
+ *
+ * For the host: make a region of its memory available to Forth code as
+ * the constant name.  The host keeps ownership of the memory, which must
+ * stay valid for the life of f.
+ */
+void fbytes_register(fenv_t *f, const char *name, void *base, size_t len)
+{
+    fcode_new_constant(f, fstr_intern(f, name), fbytes_new(f, base, len, 0));
+    fobj_hold_clear(f);
+}
+
+void fbytes_visit(fenv_t *f, fobj_t *p)
+{
+    fobj_visit(f, p->u.bytes.parent);
+}
+
+void fbytes_free(fenv_t *f, fobj_t *p)
+{
+    fbytes_t *b = &p->u.bytes;
+
+    if (b->owned && b->base) {
+        free(b->base);
+    }
+    b->base = NULL;
+}
+
+void fbytes_print(fenv_t *f, fobj_t *p)
+{
+    fbytes_t *b = &p->u.bytes;
+
+    fout_printf(f, "bytes[%zu]", b->len);
+    for (size_t i = 0; i < b->len && i < 16; i++) {
+        fout_printf(f, " %02x", b->base[i]);
+    }
+    if (b->len > 16) {
+        fout_printf(f, " ...");
+    }
+}
+
+static size_t fbytes_offset(fenv_t *f, fbytes_t *b, fnumber_t offset, int size)
+{
+    FASSERT(offset >= 0 && offset + size <= b->len,
+            "access of %d bytes at %Lg is outside a %zu byte buffer",
+            size, offset, b->len);
+    return (size_t) offset;
+}
+
+/*
+ * fbytes_get() and fbytes_put()
+ *
+ * Read or write a size byte (1, 2, 4 or 8) unsigned integer at offset.
+ */
+uint64_t fbytes_get(fenv_t *f, fobj_t *p, fnumber_t offset, int size)
+{
+    fbytes_t *b = &p->u.bytes;
+    unsigned char *a = b->base + fbytes_offset(f, b, offset, size);
+    int swap = b->big_endian != FBYTES_HOST_BIG_ENDIAN;
+
+    switch (size) {
+    case 1:
+        return *a;
+
+    case 2: {
+        uint16_t v;
+        memcpy(&v, a, sizeof(v));
+        return swap ? __builtin_bswap16(v) : v;
+    }
+
+    case 4: {
+        uint32_t v;
+        memcpy(&v, a, sizeof(v));
+        return swap ? __builtin_bswap32(v) : v;
+    }
+
+    case 8: {
+        uint64_t v;
+        memcpy(&v, a, sizeof(v));
+        return swap ? __builtin_bswap64(v) : v;
+    }
+    }
+
+    ASSERT(0);
+    return 0;
+}
+
+void fbytes_put(fenv_t *f, fobj_t *p, fnumber_t offset, int size, uint64_t value)
+{
+    fbytes_t *b = &p->u.bytes;
+    unsigned char *a = b->base + fbytes_offset(f, b, offset, size);
+    int swap = b->big_endian != FBYTES_HOST_BIG_ENDIAN;
+
+    switch (size) {
+    case 1:
+        *a = value;
+        return;
+
+    case 2: {
+        uint16_t v = swap ? __builtin_bswap16(value) : value;
+        memcpy(a, &v, sizeof(v));
+        return;
+    }
+
+    case 4: {
+        uint32_t v = swap ? __builtin_bswap32(value) : value;
+        memcpy(a, &v, sizeof(v));
+        return;
+    }
+
+    case 8: {
+        uint64_t v = swap ? __builtin_bswap64(value) : value;
+        memcpy(a, &v, sizeof(v));
+        return;
+    }
+    }
+
+    ASSERT(0);
+}
+
+/*
+ * ] @ and ] ! on a bytes object access single bytes.  An unindexed fetch
+ * returns the length.
+ */
+fobj_t *fbytes_fetch(fenv_t *f, fobj_t *addr, fobj_t *index)
+{
+    if (!index) {
+        return fnum_new(f, addr->u.bytes.len);
+    }
+
+    FASSERT(index->type == FOBJ_NUM, "bytes must be indexed by NUM");
+    return fnum_new(f, fbytes_get(f, addr, index->u.num.n, 1));
+}
+
+void fbytes_store(fenv_t *f, fobj_t *addr, fobj_t *index, fobj_t *data)
+{
+    FASSERT(index && index->type == FOBJ_NUM, "bytes must be indexed by NUM");
+    FASSERT(data && data->type == FOBJ_NUM, "only a NUM can be stored in bytes");
+    fbytes_put(f, addr, index->u.num.n, 1, fnum_to_u64(f, data->u.num.n));
+}
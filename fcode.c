@@ -70,6 +70,7 @@ fint_t  MKFNAME(pop_int)(fenv_t *f);
 struct fbody_s {
     fobj_t			*word;
     int				 n;
+    int				 op;			// How the inner interpreter runs word
 };
 
 struct fheader_s {
@@ -166,7 +167,22 @@ static void fcode_install(fenv_t *f, fobj_t *word)
 
 static fobj_t *fcode_lookup_word(fenv_t *f, char *name)
 {
-    return ftable_fetch(f, f->words, fstr_new(f, name));
+    return ftable_fetch(f, f->words, fstr_intern(f, name));
+}
+
+static fobj_t *forth_find_word(fenv_t *f, fobj_t *token)
+{
+    /*
+     * Word names are all interned, so a token which isn't (a slice of
+     * the input, see fparse.c) can't be one.
+     */
+    if (!token->u.str.interned) {
+        return NULL;
+    }
+
+    fobj_t *w = ftable_fetch(f, f->words, token);
+    if (!w) w = ftable_fetch(f, f->new_words, token);
+    return w;
 }
 
 void fcode_init(fenv_t *f)
@@ -177,7 +193,7 @@ void fcode_init(fenv_t *f)
     fheader_t *p;
 
     for (int i = 0; (p = fcode_primitives_ptrs[i]); i++) {
-        fobj_t *name = fstr_new(f, p->name);
+        fobj_t *name = fstr_intern(f, p->name);
         fcode_install(f, fcode_new(f, name, p->code, p->immediate, NULL, NULL));
         fobj_hold_clear(f);
     }
@@ -341,6 +357,119 @@ FWORD2(mktable, "{}")
     PUSH(ftable_new(f));
 }
 
+            /* hash:  -> hash    (keyed by any object, numbers included) */
+FWORD(hash)
+{
+    PUSH(fhash_new(f));
+}
+
+/*
+ * Capacity hints.  Containers grow geometrically on their own; these let
+ * a script which knows how big one will get skip the growing.
+ */
+
+            /* {}n:  n -> table    (with room for n elements) */
+FWORD2(mktable_n, "{}n")
+{
+    int n = POPI;
+    fobj_t *t = ftable_new(f);
+
+    PUSH(t);
+    farray_reserve(f, t->u.table.array, n);
+}
+
+            /* reserve:  table|array|hash n ->    (room for n elements, or keys) */
+FWORD(reserve)
+{
+    int n = POPI;
+    A = POP;
+
+    FASSERT(a, "reserve requires a table, array or hash");
+    switch (a->type) {
+    case FOBJ_TABLE: farray_reserve(f, a->u.table.array, n); break;
+    case FOBJ_ARRAY: farray_reserve(f, a, n);                break;
+    case FOBJ_HASH:  fhash_reserve(f, a, n);                 break;
+    default:
+        FASSERT(0, "reserve requires a table, array or hash, not a %s",
+                op_table[a->type].type_name);
+    }
+}
+
+            /* reserve-keys:  table|hash n ->    (room for n keys) */
+FWORD2(reserve_keys, "reserve-keys")
+{
+    int n = POPI;
+    A = POP;
+
+    FASSERT(a && (a->type == FOBJ_TABLE || a->type == FOBJ_HASH),
+            "reserve-keys requires a table or hash");
+    fhash_reserve(f, a->type == FOBJ_TABLE ? a->u.table.hash : a, n);
+}
+
+            /* shrink-to-fit:  table|array|hash -> */
+FWORD2(shrink_to_fit, "shrink-to-fit")
+{
+    A = POP;
+
+    FASSERT(a, "shrink-to-fit requires a table, array or hash");
+    switch (a->type) {
+    case FOBJ_TABLE:
+        farray_shrink(f, a->u.table.array);
+        fhash_shrink(f, a->u.table.hash);
+        break;
+    case FOBJ_ARRAY: farray_shrink(f, a); break;
+    case FOBJ_HASH:  fhash_shrink(f, a);  break;
+    default:
+        FASSERT(0, "shrink-to-fit requires a table, array or hash, not a %s",
+                op_table[a->type].type_name);
+    }
+}
+
+/*
+ * Weak tables.  A weak table doesn't keep its keys, values or both
+ * alive: once the rest of the program lets go of one, the collector
+ * takes its entry out, so a cache of them doesn't grow for ever.
+ * Numbers and strings are always held (see fobj.c).
+ */
+
+static void forth_set_weak(fenv_t *f, int weak, const char *name)
+{
+    A = POP;
+
+    FASSERT(a && (a->type == FOBJ_TABLE || a->type == FOBJ_HASH),
+            "%s requires a table or hash", name);
+    if (a->type == FOBJ_TABLE) {
+        ftable_set_weak(f, a, weak);
+    } else {
+        fhash_set_weak(f, a, weak);
+    }
+    PUSH(a);
+}
+
+            /* weak-keys:  table|hash -> table|hash */
+FWORD2(weak_keys, "weak-keys")
+{
+    forth_set_weak(f, FHASH_WEAK_KEYS, "weak-keys");
+}
+
+            /* weak-values:  table|hash -> table|hash */
+FWORD2(weak_values, "weak-values")
+{
+    forth_set_weak(f, FHASH_WEAK_VALUES, "weak-values");
+}
+
+            /* weak:  table|hash -> table|hash    (weak keys and values) */
+FWORD(weak)
+{
+    forth_set_weak(f, FHASH_WEAK_KEYS | FHASH_WEAK_VALUES, "weak");
+}
+
+            /* gc:  -> */
+FWORD(gc)
+{
+    fobj_garbage_collection(f);
+}
+
 FWORD2(index, "]")
 {
     B = POP;
@@ -360,7 +489,7 @@ FWORD2(index, "]")
 FWORD(emit)
 {
     char c = POPN;
-    printf("%c", c);
+    fout_write(f, &c, 1);
 }
 
 /*
@@ -381,10 +510,67 @@ static void forth_compile_alloc(fenv_t *f)
         return;
     }
 
-    w->body_allocated += 64;  // Arbitrary
+    w->body_allocated = w->body_allocated ? 2 * w->body_allocated : 64;
     w->u.body = realloc(w->u.body, sizeof (*w->u.body) * w->body_allocated);
 }
 
+/*
+ * The words the inner interpreter runs itself rather than calling (see
+ * DO(colon)).  Each body cell records which, if any, its word is.
+ */
+enum {
+    FOP_CALL,		// Anything else: call the word's code
+    FOP_COLON,
+    FOP_EXIT,
+    FOP_CONSTANT,
+    FOP_BRANCH,
+    FOP_ZBRANCH,
+    FOP_LOOP,
+    FOP_I,
+    FOP_DUP,
+    FOP_DROP,
+    FOP_SWAP,
+    FOP_OVER,
+    FOP_PLUS,
+    FOP_MINUS,
+    FOP_LESS,
+    FOP_INDEX,
+    FOP_FETCH,
+    FOP_STORE,
+};
+
+static fheader_t *const forth_ops[] = {
+    [FOP_COLON]     = &fcode_do_colon_header,
+    [FOP_EXIT]      = &fcode_do_exit_header,
+    [FOP_CONSTANT]  = &fcode_do_constant_header,
+    [FOP_BRANCH]    = &fcode_do_branch_header,
+    [FOP_ZBRANCH]   = &fcode_do_zbranch_header,
+    [FOP_LOOP]      = &fcode_do_loop_header,
+    [FOP_I]         = &fcode_i_header,
+    [FOP_DUP]       = &fcode_dup_header,
+    [FOP_DROP]      = &fcode_drop_header,
+    [FOP_SWAP]      = &fcode_swap_header,
+    [FOP_OVER]      = &fcode_over_header,
+    [FOP_PLUS]      = &fcode_plus_header,
+    [FOP_MINUS]     = &fcode_minus_header,
+    [FOP_LESS]      = &fcode_less_header,
+    [FOP_INDEX]     = &fcode_index_header,
+    [FOP_FETCH]     = &fcode_fetch_header,
+    [FOP_STORE]     = &fcode_store_header,
+};
+
+#define FOP_COUNT	(sizeof(forth_ops) / sizeof(forth_ops[0]))
+
+static int forth_op(fobj_t *c)
+{
+    for (int op = FOP_CALL + 1; c && op < FOP_COUNT; op++) {
+        if (c->u.word.code == forth_ops[op]->code) {
+            return op;
+        }
+    }
+    return FOP_CALL;
+}
+
 static void forth_compile_word(fenv_t *f, fobj_t *c, int offset)
 {
     fword_t *w = CURRENT;
@@ -392,17 +578,22 @@ static void forth_compile_word(fenv_t *f, fobj_t *c, int offset)
     forth_compile_alloc(f);
     w->u.body[w->body_offset].word = c;
     w->u.body[w->body_offset].n = offset;
+    w->u.body[w->body_offset].op = forth_op(c);
     w->body_offset ++;
 }
 
-static void forth_compile_cons(fenv_t *f, fnumber_t n)
+static void forth_compile_literal(fenv_t *f, fobj_t *value)
 {
-    fobj_t *cons = fnum_new(f, n);
-    fobj_t *name = fstr_new(f, "constant");
-    fobj_t *t = fcode_new(f, name, fcode_do_constant_header.code, 0, NULL, cons);
+    fobj_t *name = fstr_intern(f, "constant");
+    fobj_t *t = fcode_new(f, name, fcode_do_constant_header.code, 0, NULL, value);
     forth_compile_word(f, t, 0);
 }
 
+static void forth_compile_cons(fenv_t *f, fnumber_t n)
+{
+    forth_compile_literal(f, fnum_new(f, n));
+}
+
 FWORD_DO(var)
 {
     PUSH(w);  // Use @ and ! to read or modify w's u.value field.
@@ -424,23 +615,242 @@ FWORD_DO(exit)
     f->ip = wp->u.call.ip;
 }
 
+/*
+ * DO(colon)
+ *
+ * The inner interpreter: run w's body until an exit brings the return
+ * stack back to its depth on entry.
+ *
+ * Most cells call their word's code, but the words in forth_ops[] are
+ * run here: the cell's op picks the case, with a computed goto where
+ * the compiler has them (GCC and clang; build with -DFCODE_SWITCH to
+ * use the switch instead).  Colon words called from here are run by
+ * this same loop, without going through C.
+ *
+ * ip, the top of the data stack (tos) and its depth (sp) live in
+ * locals.  sp points just past the top element's slot in ds->elems,
+ * whose contents are stale: the value is in tos.  Before anything which
+ * can allocate or look at the stack, FSTACK_OUT() puts them back into
+ * ds; after calling out, FSTACK_IN() loads them again, as the stack may
+ * have been reallocated.  (Allocating doesn't move it.)
+ *
+ * ] followed by @ or ! is done as one step, fetching or storing
+ * without making the index.
+ *
+ * A case which finds something unusual (too few elements, not numbers,
+ * no room, a word whose code has since changed, as memoize does) goes
+ * to call the word's code, which does it or reports the error as ever.
+ */
+
+#if defined(__GNUC__) && !defined(FCODE_SWITCH)
+#define FCODE_COMPUTED_GOTO	1
+#else
+#define FCODE_COMPUTED_GOTO	0
+#endif
+
+#if FCODE_COMPUTED_GOTO
+#define OP(_op)			op_ ## _op: case FOP_ ## _op
+#define NEXT			do { cell = ip++; goto *ops[cell->op]; } while (0)
+#else
+#define OP(_op)			case FOP_ ## _op
+#define NEXT			continue
+#endif
+
+#define FSTACK_IN()		(base = ds->elems, sp = base + ds->sp,         \
+                         limit = base + ds->max_sp,                  \
+                         tos = sp > base ? sp[-1] : NULL)
+#define FSTACK_OUT()	do { if (sp > base) sp[-1] = tos;            \
+                             ds->sp = sp - base; } while (0)
+#define FPUSH(x)		do { if (sp > base) sp[-1] = tos;            \
+                             sp++; tos = (x); } while (0)
+#define FDROP()			(sp--, tos = sp > base ? sp[-1] : NULL)
+#define FSTALE(c)		((c)->word->u.word.code != forth_ops[(c)->op]->code)
+
 FWORD_DO(colon)
 {
-    int depth_saved = RDEPTH;
-    fobj_t *wp = fobj_new(f, FOBJ_CALL);
+#if FCODE_COMPUTED_GOTO
+    static const void *ops[] = {
+        [FOP_CALL] = &&op_CALL,         [FOP_COLON] = &&op_COLON,
+        [FOP_EXIT] = &&op_EXIT,         [FOP_CONSTANT] = &&op_CONSTANT,
+        [FOP_BRANCH] = &&op_BRANCH,     [FOP_ZBRANCH] = &&op_ZBRANCH,
+        [FOP_LOOP] = &&op_LOOP,         [FOP_I] = &&op_I,
+        [FOP_DUP] = &&op_DUP,           [FOP_DROP] = &&op_DROP,
+        [FOP_SWAP] = &&op_SWAP,         [FOP_OVER] = &&op_OVER,
+        [FOP_PLUS] = &&op_PLUS,         [FOP_MINUS] = &&op_MINUS,
+        [FOP_LESS] = &&op_LESS,         [FOP_INDEX] = &&op_INDEX,
+        [FOP_FETCH] = &&op_FETCH,       [FOP_STORE] = &&op_STORE,
+    };
+#endif
+    fstack_t *ds = &f->dstack->u.stack;
+    fstack_t *rs = &f->rstack->u.stack;
+    int depth_saved = rs->sp;
+    int hold_saved = fobj_hold_mark(f);
+    fbody_t *ip, *cell;
+    fobj_t **base, **sp, **limit, *tos, *a, *r;
 
+    fobj_t *wp = fobj_new(f, FOBJ_CALL);
     wp->u.call.w = f->running;
     wp->u.call.ip = IP;
     RPUSH(wp);
+    fobj_hold_release(f, hold_saved);
 
-    IP = w->u.word.u.body;
+    ip = w->u.word.u.body;
     f->running = w;
-
-    do {
-        fobj_t *nw = IP++ -> word;
-        CALL(nw);
-        fobj_hold_clear(f);
-    } while (RDEPTH > depth_saved);
+    FSTACK_IN();
+
+    for (;;) {
+        cell = ip++;
+        switch (cell->op) {
+        OP(CALL):
+        call:
+            FSTACK_OUT();
+            IP = ip;
+            CALL(cell->word);
+            ip = IP;
+            fobj_hold_release(f, hold_saved);
+            if (rs->sp <= depth_saved) {
+                return;
+            }
+            FSTACK_IN();
+            NEXT;
+
+        OP(COLON):
+            if (FSTALE(cell)) goto call;
+            w = cell->word;
+            FSTACK_OUT();
+            wp = fobj_new(f, FOBJ_CALL);
+            wp->u.call.w = f->running;
+            wp->u.call.ip = ip;
+            RPUSH(wp);
+            fobj_hold_release(f, hold_saved);
+            ip = w->u.word.u.body;
+            f->running = w;
+            NEXT;
+
+        OP(EXIT):
+            wp = rs->elems[rs->sp - 1];
+            if (FSTALE(cell) || wp->type != FOBJ_CALL) goto call;
+            rs->sp--;
+            f->running = wp->u.call.w;
+            ip = wp->u.call.ip;
+            if (rs->sp <= depth_saved) {
+                FSTACK_OUT();
+                IP = ip;
+                return;
+            }
+            NEXT;
+
+        OP(CONSTANT):
+            if (FSTALE(cell) || sp == limit) goto call;
+            FPUSH(cell->word->u.word.u.value);
+            NEXT;
+
+        OP(BRANCH):
+            if (FSTALE(cell)) goto call;
+            ip += cell->n - 1;
+            NEXT;
+
+        OP(ZBRANCH):
+            if (FSTALE(cell) || sp == base || !tos || tos->type != FOBJ_NUM) goto call;
+            a = tos;
+            FDROP();
+            if (a->u.num.n == 0) {
+                ip += cell->n - 1;
+            }
+            NEXT;
+
+        OP(LOOP):
+            a = rs->elems[rs->sp - 1];
+            if (FSTALE(cell) || a->type != FOBJ_LOOP) goto call;
+            if (++a->u.loop.index >= a->u.loop.limit) {
+                rs->sp--;
+            } else {
+                ip += cell->n;
+            }
+            NEXT;
+
+        OP(I):
+            a = rs->elems[rs->sp - 1];
+            if (FSTALE(cell) || a->type != FOBJ_LOOP || sp == limit) goto call;
+            FSTACK_OUT();
+            r = fnum_new(f, a->u.loop.index);
+            FPUSH(r);
+            fobj_hold_release(f, hold_saved);
+            NEXT;
+
+        OP(DUP):
+            if (FSTALE(cell) || sp == base || sp == limit) goto call;
+            sp[-1] = tos;
+            sp++;
+            NEXT;
+
+        OP(DROP):
+            if (FSTALE(cell) || sp == base) goto call;
+            FDROP();
+            NEXT;
+
+        OP(SWAP):
+            if (FSTALE(cell) || sp - base < 2) goto call;
+            a = sp[-2];
+            sp[-2] = tos;
+            tos = a;
+            NEXT;
+
+        OP(OVER):
+            if (FSTALE(cell) || sp - base < 2 || sp == limit) goto call;
+            sp[-1] = tos;
+            sp++;
+            tos = sp[-3];
+            NEXT;
+
+        OP(PLUS):
+        OP(MINUS):
+        OP(LESS):
+            if (FSTALE(cell) || sp - base < 2 || !sp[-2] || !tos ||
+                sp[-2]->type != FOBJ_NUM || tos->type != FOBJ_NUM) goto call;
+            FSTACK_OUT();  // Both stay on the stack while the result is made
+            if (cell->op == FOP_PLUS) {
+                r = fnum_new(f, sp[-2]->u.num.n + tos->u.num.n);
+            } else if (cell->op == FOP_MINUS) {
+                r = fnum_new(f, sp[-2]->u.num.n - tos->u.num.n);
+            } else {
+                r = fnum_new(f, (fint_t) sp[-2]->u.num.n < (fint_t) tos->u.num.n ? -1 : 0);
+            }
+            sp--;
+            tos = r;
+            fobj_hold_release(f, hold_saved);
+            NEXT;
+
+        OP(INDEX):
+            if (FSTALE(cell) || (ip->op != FOP_FETCH && ip->op != FOP_STORE) || FSTALE(ip)) {
+                goto call;
+            }
+            if (ip->op == FOP_FETCH && sp - base >= 2) {
+                FSTACK_OUT();  // addr index
+                r = fobj_fetch(f, sp[-2], tos);
+                ds->sp -= 2;
+                FSTACK_IN();
+                FPUSH(r);
+                fobj_hold_release(f, hold_saved);
+                ip++;
+                NEXT;
+            }
+            if (ip->op == FOP_STORE && sp - base >= 3) {
+                FSTACK_OUT();  // data addr index
+                fobj_store(f, sp[-2], tos, sp[-3]);
+                ds->sp -= 3;
+                FSTACK_IN();
+                fobj_hold_release(f, hold_saved);
+                ip++;
+                NEXT;
+            }
+            goto call;
+
+        OP(FETCH):
+        OP(STORE):
+            goto call;
+        }
+    }
 }
 
 FWORD_DO(constant)
@@ -452,7 +862,7 @@ FWORD2(mkvar, "var")
 {
     fobj_t *var_name;
 
-    (void) fparse_token(f, &var_name);
+    (void) fparse_name(f, &var_name);
     FASSERT(var_name, "var must be followed by a variable name");
 
     ftable_store(f, f->new_words, var_name, NULL);
@@ -490,7 +900,7 @@ FWORD_DO(const)
 FWORD_IMM(constant)
 {
     fobj_t *cons_name;
-    (void) fparse_token(f, &cons_name);
+    (void) fparse_name(f, &cons_name);
     FASSERT(cons_name, "const must be followed by a name");
     fobj_t *cons = fcode_new(f, cons_name, fcode_do_const_header.code, 0, NULL, NULL);
 
@@ -527,6 +937,7 @@ FWORD_DO(zbranch)
 #define FSTATE_IF          3
 #define FSTATE_BEGIN	   4
 #define FSTATE_WHILE       5
+#define FSTATE_EACH        6
 
 static int forth_state(fenv_t *f)
 {
@@ -612,6 +1023,7 @@ FWORD_DO(do)
     fobj_t *loop = fobj_new(f, FOBJ_LOOP);
     loop->u.loop.limit = limit;
     loop->u.loop.index = start;
+    loop->u.loop.iter = NULL;
     RPUSH(loop);
 }
 
@@ -708,7 +1120,7 @@ FWORD_IMM2(colon, ":")
 
     // Fetch the next token, i.e., the name of the new word
     fobj_t *name_token;
-    int r = fparse_token(f, &name_token);
+    int r = fparse_name(f, &name_token);
     FASSERT(r, "Need more input");
 
     CURRENT->name = name_token;
@@ -732,58 +1144,1227 @@ FWORD_IMM2(semicolon, ";")
 }
 
 
-void fcode_handle_token(fenv_t *f, fobj_t *token)
+/**********************************************************
+ *
+ * Literals and Execution Tokens
+ *
+ **********************************************************/
+
+/*
+ * ' (tick)
+ *
+ * Parse the next token and compile a literal which pushes that word
+ * object.  The word can later be run with execute.
+ */
+FWORD_IMM2(tick, "'")
 {
-    ASSERT(token->type == FOBJ_STR);
-    fobj_t *w = ftable_fetch(f, f->words, token);
-    if (!w) w = ftable_fetch(f, f->new_words, token);
-    if (w) {
-        ASSERT(w->type == FOBJ_WORD);
-        if (w->u.word.immediate) {
-            w->u.word.code(f, w);
-        } else {
-            forth_compile_word(f, w, 0);
-        }
+    fobj_t *name;
+    (void) fparse_token(f, &name);
+    FASSERT(name, "' must be followed by a word name");
+
+    fobj_t *xt = forth_find_word(f, name);
+    FASSERT(xt, "' could not find the word <%s>", fstr_cstr(f, name));
+    forth_compile_literal(f, xt);
+}
+
+FWORD(execute)
+{
+    A = POP;
+    FASSERT(a && a->type == FOBJ_WORD, "execute requires a word");
+    CALL(a);
+}
+
+/*
+ * str" (string quote)
+ *
+ * Compile the rest of the input, up to the next double quote, as a
+ * string literal.  E.g., str" hello world" .
+ */
+FWORD_IMM2(str_quote, "str\"")
+{
+    fobj_t *str;
+    (void) fparse_delimited(f, '"', &str);
+    forth_compile_literal(f, str);
+}
+
+/**********************************************************
+ *
+ * Ordered Maps (B-trees)
+ *
+ * Use ] @ and ! to fetch and store: map key ] @
+ *
+ **********************************************************/
+
+FWORD(btree)
+{
+    PUSH(fbtree_new(f));
+}
+
+static fobj_t *forth_pop_btree(fenv_t *f)
+{
+    fobj_t *p = POP;
+    FASSERT(p && p->type == FOBJ_BTREE, "A btree was expected here");
+    return p;
+}
+
+            /* remove:  map key -> */
+FWORD(remove)
+{
+    B = POP;
+    A = POP;
+    FASSERT(a, "remove requires a btree or ptable");
+
+    switch (a->type) {
+    case FOBJ_BTREE:
+        fbtree_remove(f, a, b);
+        break;
+
+    case FOBJ_PTABLE:
+        fptable_remove(f, a, b);
+        break;
+
+    default:
+        FASSERT(0, "%s remove not supported", op_table[a->type].type_name);
+    }
+}
+
+static void forth_btree_seek(fenv_t *f, int mode)
+{
+    fobj_t *k = NULL, *v = NULL;
+
+    B = POP;
+    A = forth_pop_btree(f);
+    FASSERT(b, "btree keys may not be null");
+    fbtree_seek(f, a, b, mode, &k, &v);
+    PUSH(k);
+    PUSH(v);
+}
+
+            /* floor:  map key -> key' value   (largest key' <= key) */
+FWORD(floor)        { forth_btree_seek(f, FBTREE_FLOOR); }
+
+            /* ceiling:  map key -> key' value   (smallest key' >= key) */
+FWORD(ceiling)      { forth_btree_seek(f, FBTREE_CEILING); }
+
+/*
+ * range-each:  map lo hi xt ->
+ *
+ * Call xt with ( key value ) for every entry with lo <= key <= hi, in
+ * order.  Each step looks up the next key after the previous one so xt
+ * may add or remove entries as it goes.
+ */
+FWORD2(range_each, "range-each")
+{
+    fobj_t *xt = POP;
+    fobj_t *hi = POP;
+    fobj_t *lo = POP;
+    fobj_t *map = forth_pop_btree(f);
+    fobj_t *k, *v;
+
+    FASSERT(xt && xt->type == FOBJ_WORD, "range-each requires a word");
+    FASSERT(lo && hi, "range-each requires a lower and upper key");
+
+    int mark = fobj_hold_mark(f);
+    int more = fbtree_seek(f, map, lo, FBTREE_CEILING, &k, &v);
+
+    while (more && fbtree_key_cmp(f, k, hi) <= 0) {
+        fobj_hold_release(f, mark);
+        HOLD(k);
+        PUSH(k);
+        PUSH(v);
+        CALL(xt);
+        more = fbtree_seek(f, map, k, FBTREE_HIGHER, &k, &v);
+    }
+}
+
+/**********************************************************
+ *
+ * Persistent Tables
+ *
+ * A ptable is used like a table: pt key ] @ and val pt key ] !.
+ * snapshot gives a second handle on the current version in O(1); the
+ * two then change independently.
+ *
+ **********************************************************/
+
+FWORD(ptable)
+{
+    PUSH(fptable_new(f));
+}
+
+            /* snapshot:  pt -> pt' */
+FWORD(snapshot)
+{
+    A = POP;
+    FASSERT(a && a->type == FOBJ_PTABLE, "snapshot requires a ptable");
+    PUSH(fptable_snapshot(f, a));
+}
+
+/**********************************************************
+ *
+ * Byte Buffers
+ *
+ * The memory words take a buffer and a byte offset rather than an
+ * address:
+ *    c@ w@ l@ x@    buf offset -> n
+ *    c! w! l! x!    n buf offset ->
+ * for 8, 16, 32 and 64 bit accesses in the buffer's byte order.
+ *
+ **********************************************************/
+
+static fobj_t *forth_pop_bytes(fenv_t *f)
+{
+    fobj_t *p = POP;
+    FASSERT(p && p->type == FOBJ_BYTES, "A bytes buffer was expected here");
+    return p;
+}
+
+static void forth_bytes_fetch(fenv_t *f, int size)
+{
+    fnumber_t offset = POPN;
+    A = forth_pop_bytes(f);
+    PUSHN(fbytes_get(f, a, offset, size));
+}
+
+static void forth_bytes_store(fenv_t *f, int size)
+{
+    fnumber_t offset = POPN;
+    A = forth_pop_bytes(f);
+    fnumber_t n = POPN;
+    fbytes_put(f, a, offset, size, fnum_to_u64(f, n));
+}
+
+            /* bytes:  n -> buf    (n zeroed bytes) */
+FWORD(bytes)
+{
+    fnumber_t n = POPN;
+    FASSERT(n >= 0, "bytes needs a size >= 0");
+    PUSH(fbytes_alloc(f, (size_t) n));
+}
+
+            /* view:  buf offset len -> buf' */
+FWORD(view)
+{
+    fnumber_t len = POPN;
+    fnumber_t offset = POPN;
+    A = forth_pop_bytes(f);
+    FASSERT(offset >= 0 && len >= 0, "view needs an offset and length >= 0");
+    PUSH(fbytes_view(f, a, (size_t) offset, (size_t) len));
+}
+
+            /* big-endian, little-endian:  buf -> buf */
+FWORD2(big_endian, "big-endian")
+{
+    A = forth_pop_bytes(f);
+    a->u.bytes.big_endian = 1;
+    PUSH(a);
+}
+
+FWORD2(little_endian, "little-endian")
+{
+    A = forth_pop_bytes(f);
+    a->u.bytes.big_endian = 0;
+    PUSH(a);
+}
+
+FWORD2(cfetch, "c@")    { forth_bytes_fetch(f, 1); }
+FWORD2(wfetch, "w@")    { forth_bytes_fetch(f, 2); }
+FWORD2(lfetch, "l@")    { forth_bytes_fetch(f, 4); }
+FWORD2(xfetch, "x@")    { forth_bytes_fetch(f, 8); }
+
+FWORD2(cstore, "c!")    { forth_bytes_store(f, 1); }
+FWORD2(wstore, "w!")    { forth_bytes_store(f, 2); }
+FWORD2(lstore, "l!")    { forth_bytes_store(f, 4); }
+FWORD2(xstore, "x!")    { forth_bytes_store(f, 8); }
+
+/**********************************************************
+ *
+ * Searching and Comparing Memory
+ *
+ * These take either bytes buffers or strings.  Offsets not found are
+ * returned as -1.
+ *
+ **********************************************************/
+
+static fobj_t *forth_pop_buf(fenv_t *f, unsigned char **base, size_t *len)
+{
+    fobj_t *p = POP;
+    FASSERT(p && (p->type == FOBJ_BYTES || p->type == FOBJ_STR),
+            "A bytes buffer or string was expected here");
+
+    if (p->type == FOBJ_BYTES) {
+        *base = p->u.bytes.base;
+        *len = p->u.bytes.len;
     } else {
-        fnumber_t n = 0;
-        int r = fparse_token_to_number(f, token, &n);
-        FASSERT(r, "Input token not found in dictionary and isn't a number: <%s>",
-                token->u.str.buf);
-        forth_compile_cons(f, n);
+        *base = (unsigned char *) p->u.str.buf;
+        *len = p->u.str.len;
     }
+
+    return p;
 }
 
-void fcode_compile_string(fenv_t *f, const char *string)
+static void forth_push_offset(fenv_t *f, size_t offset)
 {
-    fobj_t *token;
+    PUSHN(offset == FSCAN_NONE ? -1 : (fnumber_t) offset);
+}
 
-    f->input_str = fstr_new(f, string);
-    f->new_words = ftable_new(f);
+            /* search:  buf pattern -> offset */
+FWORD(search)
+{
+    unsigned char *h, *n;
+    size_t hlen, nlen;
 
-    f->current_compiling = fcode_new(f, fstr_new(f, "input string"),
-                                     fcode_do_colon_header.code,
-                                     /* immediate */ 0,
-                                     NULL, NULL);
+    forth_pop_buf(f, &n, &nlen);
+    forth_pop_buf(f, &h, &hlen);
+    forth_push_offset(f, fscan_search(h, hlen, n, nlen));
+}
 
-    do {
-        int r = fparse_token(f, &token);
-        if (!r) break;
-        fcode_handle_token(f, token);
+            /* search-masked:  buf pattern mask -> offset */
+FWORD2(search_masked, "search-masked")
+{
+    unsigned char *h, *pat, *mask;
+    size_t hlen, plen, mlen;
+
+    forth_pop_buf(f, &mask, &mlen);
+    forth_pop_buf(f, &pat, &plen);
+    forth_pop_buf(f, &h, &hlen);
+    FASSERT(plen == mlen, "search-masked needs a pattern and mask of the same length");
+    forth_push_offset(f, fscan_search_masked(h, hlen, pat, mask, plen));
+}
+
+            /* compare:  a b -> -1|0|1 */
+FWORD(compare)
+{
+    unsigned char *a, *b;
+    size_t alen, blen;
+
+    forth_pop_buf(f, &b, &blen);
+    forth_pop_buf(f, &a, &alen);
+    PUSHN(fscan_compare(a, alen, b, blen));
+}
+
+            /* mismatch:  a b -> offset    (first difference, -1 if equal) */
+FWORD(mismatch)
+{
+    unsigned char *a, *b;
+    size_t alen, blen;
+
+    forth_pop_buf(f, &b, &blen);
+    forth_pop_buf(f, &a, &alen);
+
+    size_t n = alen < blen ? alen : blen;
+    size_t i = fscan_mismatch(a, b, n);
+    forth_push_offset(f, (i == n && alen == blen) ? FSCAN_NONE : i);
+}
+
+            /* count-byte:  buf c -> n */
+FWORD2(count_byte, "count-byte")
+{
+    unsigned char *p;
+    size_t len;
+
+    int c = POPI;
+    forth_pop_buf(f, &p, &len);
+    PUSHN(fscan_count_byte(p, len, c));
+}
+
+            /* fill:  buf c ->    (use view to fill part of a buffer) */
+FWORD(fill)
+{
+    int c = POPI;
+    A = forth_pop_bytes(f);
+    fscan_fill(a->u.bytes.base, a->u.bytes.len, c);
+}
+
+/**********************************************************
+ *
+ * Strings
+ *
+ * str n ] @ is the character code at n and str @ the length.  Substrings
+ * share the original's bytes.
+ *
+ **********************************************************/
+
+static fobj_t *forth_pop_str(fenv_t *f)
+{
+    fobj_t *p = POP;
+    FASSERT(p && p->type == FOBJ_STR, "A string was expected here");
+    return p;
+}
+
+            /* substr:  str start len -> str' */
+FWORD(substr)
+{
+    int len = POPI;
+    int start = POPI;
+    A = forth_pop_str(f);
+    PUSH(fstr_substr(f, a, start, len));
+}
+
+            /* find:  str needle -> offset    (-1 if not found) */
+FWORD(find)
+{
+    B = forth_pop_str(f);
+    A = forth_pop_str(f);
+    PUSHN(fstr_find(f, a, b));
+}
+
+            /* rfind:  str needle -> offset   (the last one, -1 if not found) */
+FWORD(rfind)
+{
+    B = forth_pop_str(f);
+    A = forth_pop_str(f);
+    PUSHN(fstr_rfind(f, a, b));
+}
+
+            /* starts-with?:  str prefix -> flag */
+FWORD2(starts_with, "starts-with?")
+{
+    B = forth_pop_str(f);
+    A = forth_pop_str(f);
+    PUSHN(fstr_starts_with(f, a, b) ? -1 : 0);
+}
+
+            /* split:  str sep -> table */
+FWORD(split)
+{
+    B = forth_pop_str(f);
+    A = forth_pop_str(f);
+    PUSH(fstr_split(f, a, b));
+}
+
+            /* trim:  str -> str' */
+FWORD(trim)
+{
+    A = forth_pop_str(f);
+    PUSH(fstr_trim(f, a));
+}
+
+            /* replace:  str old new -> str' */
+FWORD(replace)
+{
+    C = forth_pop_str(f);
+    B = forth_pop_str(f);
+    A = forth_pop_str(f);
+    PUSH(fstr_replace(f, a, b, c));
+}
+
+/**********************************************************
+ *
+ * Formatted Output
+ *
+ * format takes a printf style format string and as many arguments as it
+ * has directives, deepest first (see fout_format()), and renders them
+ * in one go in the environment's output buffer.
+ *
+ **********************************************************/
+
+/*
+ * Render the format string on top of the stack with its arguments into
+ * the output buffer, dropping them all.  Returns the text, valid until
+ * the buffer is next used.
+ */
+static const char *forth_format(fenv_t *f, size_t *len)
+{
+    fstack_t *ds = &f->dstack->u.stack;
+    A = forth_pop_str(f);
+    int n = fout_format_count(f, a);
+
+    FASSERT(ds->sp >= n, "format needs %d arguments", n);
+
+    size_t start = fout_begin(f);
+    fout_format(f, a, &ds->elems[ds->sp - n], n);
+    ds->sp -= n;
+    return fout_end(f, start, len);
+}
+
+            /* format:  args... fmt -> str */
+FWORD(format)
+{
+    size_t len;
+    const char *text = forth_format(f, &len);
+    PUSH(fstr_new_buf(f, text, len));
+}
+
+            /* format.:  args... fmt ->     (prints it) */
+FWORD2(format_dot, "format.")
+{
+    size_t len;
+    const char *text = forth_format(f, &len);
+    fout_write(f, text, len);
+}
+
+/**********************************************************
+ *
+ * Regular Expressions
+ *
+ * Patterns are compiled by regex and matched against strings or bytes
+ * buffers in time linear in the buffer (see fregex.c).
+ *
+ **********************************************************/
+
+static fobj_t *forth_pop_regex(fenv_t *f)
+{
+    fobj_t *p = POP;
+    FASSERT(p && p->type == FOBJ_REGEX, "A regex was expected here");
+    return p;
+}
+
+/*
+ * The part of buf a match covers: a slice of a string or a view of a
+ * bytes buffer.
+ */
+static fobj_t *forth_match_part(fenv_t *f, fobj_t *buf, long start, long end)
+{
+    if (buf->type == FOBJ_STR) {
+        return fstr_slice(f, buf, (int) start, (int) (end - start));
+    }
+    return fbytes_view(f, buf, (size_t) start, (size_t) (end - start));
+}
+
+            /* regex:  str -> regex */
+FWORD(regex)
+{
+    A = forth_pop_str(f);
+    PUSH(fregex_new(f, a));
+}
+
+            /* re-match?:  buf regex -> flag    (all of buf matches) */
+FWORD2(re_match, "re-match?")
+{
+    unsigned char *base;
+    size_t len;
+
+    B = forth_pop_regex(f);
+    forth_pop_buf(f, &base, &len);
+    PUSHN(fregex_match(f, b, base, len) ? -1 : 0);
+}
+
+            /* re-search:  buf regex -> offset len    (-1 0 if no match) */
+FWORD2(re_search, "re-search")
+{
+    unsigned char *base;
+    size_t len;
+    long start, end;
+
+    B = forth_pop_regex(f);
+    forth_pop_buf(f, &base, &len);
+    if (fregex_search(f, b, base, len, 0, &start, &end)) {
+        PUSHN(start);
+        PUSHN(end - start);
+    } else {
+        PUSHN(-1);
+        PUSHN(0);
+    }
+}
+
+            /* re-all:  buf regex -> table    (every match, left to right) */
+FWORD2(re_all, "re-all")
+{
+    unsigned char *base;
+    size_t len;
+    long start, end, from = 0, n = 0;
+
+    B = forth_pop_regex(f);
+    A = forth_pop_buf(f, &base, &len);
+
+    fobj_t *table = ftable_new(f);
+    PUSH(table);
+    int mark = fobj_hold_mark(f);
+
+    while (from <= (long) len && fregex_search(f, b, base, len, from, &start, &end)) {
+        ftable_store(f, table, fnum_new(f, n++), forth_match_part(f, a, start, end));
+        fobj_hold_release(f, mark);
+        from = end > start ? end : end + 1;  // Step over empty matches
+    }
+}
+
+            /* re-count:  buf regex -> n */
+FWORD2(re_count, "re-count")
+{
+    unsigned char *base;
+    size_t len;
+    long start, end, from = 0, n = 0;
+
+    B = forth_pop_regex(f);
+    forth_pop_buf(f, &base, &len);
+
+    while (from <= (long) len && fregex_search(f, b, base, len, from, &start, &end)) {
+        n++;
+        from = end > start ? end : end + 1;
+    }
+    PUSHN(n);
+}
+
+/**********************************************************
+ *
+ * Lazy Sequences
+ *
+ * A seq makes its values one at a time as they're asked for, so
+ * 0 1000000 range ' sq map sum  never builds a table.  Walk one with
+ *
+ *     seq each  ( value ) ...  next
+ *
+ * i gives the number of values seen so far.  each also walks a table,
+ * array or hash in place, the loop keeping its place in the container
+ * rather than making anything per element:
+ *
+ *     t each     ( value )      ...  next
+ *     t each-kv  ( key value )  ...  next
+ *     t keys     ( key )        ...  next
+ *     t values   ( value )      ...  next
+ *
+ * A table's array part comes first, keyed by index, then its hash part.
+ *
+ **********************************************************/
+
+static fobj_t *forth_pop_seq(fenv_t *f)
+{
+    fobj_t *p = POP;
+    FASSERT(p && p->type == FOBJ_SEQ, "A sequence was expected here");
+    return p;
+}
+
+static fobj_t *forth_pop_xt(fenv_t *f)
+{
+    fobj_t *p = POP;
+    FASSERT(p && p->type == FOBJ_WORD, "A word was expected here");
+    return p;
+}
+
+            /* range:  start limit -> seq */
+FWORD(range)
+{
+    fnumber_t limit = POPN;
+    fnumber_t start = POPN;
+    PUSH(fseq_range(f, start, limit, 1));
+}
+
+            /* range-by:  start limit step -> seq */
+FWORD2(range_by, "range-by")
+{
+    fnumber_t step = POPN;
+    fnumber_t limit = POPN;
+    fnumber_t start = POPN;
+    PUSH(fseq_range(f, start, limit, step));
+}
+
+/*
+ * forth_table_map()
+ *
+ * map and filter over a table: call xt on each element of the array
+ * part in turn, making a new table (there's nothing lazy about it).
+ */
+static void forth_table_map(fenv_t *f, fobj_t *w, fobj_t *table, fobj_t *xt, int kind)
+{
+    fobj_t *src = table->u.table.array;
+    fobj_t *dst = ftable_new(f);
+    fobj_t *out = dst->u.table.array;
+    int n = 0;
+
+    farray_reserve(f, out, src->u.array.num);
+
+    int mark = fobj_hold_mark(f);
+    for (int i = 0; i < src->u.array.num; i++) {
+        fobj_t *v = src->u.array.elems[i];
+        if (!v) continue;
+
+        PUSH(v);
+        CALL(xt);
+        if (kind == FSEQ_MAP) {
+            v = POP;
+        } else if (POPN == 0) {
+            fobj_hold_release(f, mark);  // Let go of what the filter made
+            continue;
+        }
+        farray_resize(f, out, n + 1);
+        out->u.array.elems[n++] = v;
+        fobj_hold_release(f, mark);
+    }
+
+    PUSH(dst);
+}
+
+            /* map:  seq|table xt -> seq'|table'     (xt:  value -> value') */
+FWORD(map)
+{
+    fobj_t *xt = forth_pop_xt(f);
+    fobj_t *src = POP;
+
+    if (src && src->type == FOBJ_TABLE) {
+        forth_table_map(f, w, src, xt, FSEQ_MAP);
+        return;
+    }
+    PUSH(src);
+    PUSH(fseq_new(f, FSEQ_MAP, forth_pop_seq(f), xt));
+}
+
+            /* filter:  seq|table xt -> seq'|table'  (xt:  value -> flag) */
+FWORD(filter)
+{
+    fobj_t *xt = forth_pop_xt(f);
+    fobj_t *src = POP;
+
+    if (src && src->type == FOBJ_TABLE) {
+        forth_table_map(f, w, src, xt, FSEQ_FILTER);
+        return;
+    }
+    PUSH(src);
+    PUSH(fseq_new(f, FSEQ_FILTER, forth_pop_seq(f), xt));
+}
+
+/*
+ * reduce:  seq|table init xt -> acc
+ *
+ * xt is called with the value so far and each value in turn (the array
+ * part of a table) and leaves the next value so far.
+ */
+FWORD(reduce)
+{
+    fobj_t *xt = forth_pop_xt(f);
+    fobj_t *acc = POP;
+    fobj_t *src = POP;
+    fobj_t *v;
+
+    FASSERT(src && (src->type == FOBJ_SEQ || src->type == FOBJ_TABLE),
+            "reduce requires a sequence or a table");
+
+    int mark = fobj_hold_mark(f);
+    if (src->type == FOBJ_TABLE) {
+        fobj_t *a = src->u.table.array;
+        for (int i = 0; i < a->u.array.num; i++) {
+            if (!(v = a->u.array.elems[i])) continue;
+            PUSH(acc);
+            PUSH(v);
+            CALL(xt);
+            acc = POP;
+            fobj_hold_release(f, mark);
+            HOLD(acc);
+        }
+    } else {
+        fobj_t *iter = fiter_new(f, src);
+        while (fiter_next(f, iter, &v)) {
+            PUSH(acc);
+            PUSH(v);
+            CALL(xt);
+            acc = POP;
+            fobj_hold_release(f, mark);
+            HOLD2(iter, acc);
+        }
+    }
+
+    PUSH(acc);
+}
+
+/*
+ * generator:  state xt -> seq
+ *
+ * xt is called with the current state and returns ( state' value true )
+ * for each value or ( false ) when there are no more.
+ */
+FWORD(generator)
+{
+    fobj_t *xt = forth_pop_xt(f);
+    fobj_t *state = POP;
+    PUSH(fseq_new(f, FSEQ_GEN, state, xt));
+}
+
+#define FEACH_VALUES       0
+#define FEACH_KEYS         1
+#define FEACH_KV           2
+
+/*
+ * forth_each_step()
+ *
+ * Push what the loop wants for its next element and return 1, or return
+ * 0 when there are no more.  Only a key in a table's (or an array's)
+ * array part needs a number made for it.
+ */
+static int forth_each_step(fenv_t *f, floop_t *loop)
+{
+    fobj_t *p = loop->iter;
+    fobj_t *key = NULL, *v;
+    int r;
+
+    switch (p->type) {
+    case FOBJ_ITER:
+        r = fiter_next(f, p, &v);
+        break;
+    case FOBJ_ARRAY:
+        r = farray_next(f, p, &loop->cursor, &v);
+        break;
+    case FOBJ_HASH:
+        r = fhash_next(f, p, &loop->cursor, &key, &v);
+        break;
+    default:
+        r = ftable_next(f, p, &loop->cursor, &key, &v);
+        break;
+    }
+    if (!r) {
+        return 0;
+    }
+
+    if (loop->what != FEACH_VALUES) {
+        PUSH(key ? key : fnum_new(f, loop->cursor - 1));
+    }
+    if (loop->what != FEACH_KEYS) {
+        PUSH(v);
+    }
+    return 1;
+}
+
+/*
+ * forth_each_start()
+ *
+ * Start an each loop over the seq or container on the stack.
+ */
+static void forth_each_start(fenv_t *f, fobj_t *w, int what)
+{
+    fobj_t *p = POP;
+    fobj_t *loop = fobj_new(f, FOBJ_LOOP);
+
+    FASSERT(p && (p->type == FOBJ_TABLE || p->type == FOBJ_ARRAY ||
+                  p->type == FOBJ_HASH ||
+                  (p->type == FOBJ_SEQ && what == FEACH_VALUES)),
+            "A table, array or hash (or a sequence for each) was expected here");
+
+    loop->u.loop.limit = 0;
+    loop->u.loop.index = 0;
+    loop->u.loop.iter = p->type == FOBJ_SEQ ? fiter_new(f, p) : p;
+    loop->u.loop.cursor = 0;
+    loop->u.loop.what = what;
+    RPUSH(loop);
+
+    if (!forth_each_step(f, &loop->u.loop)) {
+        RPOP;
+        fcode_do_branch(f, w);
+    }
+}
+
+            /* (each):  seq|container -> value */
+FWORD_DO(each)
+{
+    forth_each_start(f, w, FEACH_VALUES);
+}
+
+            /* (each-kv):  container -> key value */
+FWORD2(do_each_kv, "(each-kv)")
+{
+    forth_each_start(f, w, FEACH_KV);
+}
+
+            /* (keys):  container -> key */
+FWORD_DO(keys)
+{
+    forth_each_start(f, w, FEACH_KEYS);
+}
+
+            /* (next):  -> value */
+FWORD_DO(next)
+{
+    /*
+     * The loop stays on the return stack while the next value is made
+     * so the iterator is reachable from there.
+     */
+    fobj_t *p = RPOP;
+    RPUSH(p);
+    FASSERT(p->type == FOBJ_LOOP && p->u.loop.iter,
+            "next without an each loop on the return stack");
+
+    if (forth_each_step(f, &p->u.loop)) {
+        p->u.loop.index ++;
+        IP += (int) ((IP -1) ->n);
+    } else {
+        RPOP;
+    }
+}
+
+FWORD_IMM(each)
+{
+    forth_mark(f, fcode_lookup_word(f, "(each)"), FSTATE_EACH);
+}
+
+FWORD_IMM2(each_kv, "each-kv")
+{
+    forth_mark(f, fcode_lookup_word(f, "(each-kv)"), FSTATE_EACH);
+}
+
+FWORD_IMM(keys)
+{
+    forth_mark(f, fcode_lookup_word(f, "(keys)"), FSTATE_EACH);
+}
+
+FWORD_IMM(values)
+{
+    forth_mark(f, fcode_lookup_word(f, "(each)"), FSTATE_EACH);
+}
+
+FWORD_IMM(next)
+{
+    FASSERT(forth_state(f) == FSTATE_EACH,
+                 "next must follow an each");
+
+    fobj_t *each_mark = POP;
+    forth_back_branch(f, fcode_lookup_word(f, "(next)"), each_mark->u.state.offset);
+    PUSH(each_mark);
+    forth_resolve(f, FSTATE_EACH);
+}
+
+            /* sum:  seq -> n */
+FWORD(sum)
+{
+    fobj_t *iter = fiter_new(f, forth_pop_seq(f));
+    fnumber_t total = 0;
+    fobj_t *v;
+
+    int mark = fobj_hold_mark(f);
+    while (fiter_next(f, iter, &v)) {
+        FASSERT(v && v->type == FOBJ_NUM, "sum requires a sequence of numbers");
+        total += v->u.num.n;
+        fobj_hold_release(f, mark);
+    }
+
+    PUSHN(total);
+}
+
+            /* collect:  seq -> table */
+FWORD(collect)
+{
+    fobj_t *iter = fiter_new(f, forth_pop_seq(f));
+    fobj_t *table = ftable_new(f);
+    fobj_t *v;
+    int n = 0;
+
+    int mark = fobj_hold_mark(f);
+    while (fiter_next(f, iter, &v)) {
+        ftable_store(f, table, fnum_new(f, n++), v);
+        fobj_hold_release(f, mark);
+    }
+
+    PUSH(table);
+}
+
+/**********************************************************
+ *
+ * Sorting
+ *
+ * sort puts a table's array part in order in place: numbers by value,
+ * strings by their bytes, anything else as fobj_cmp() has it.  sort-by
+ * takes a comparator word ( a b -> n ), a going first when n is
+ * negative, so both ' compare and ' < will do.  Both are stable.  Big
+ * tables of all numbers or all strings are sorted on several threads.
+ *
+ **********************************************************/
+
+static fobj_t *forth_sort_array(fenv_t *f, fobj_t *p)
+{
+    FASSERT(p && (p->type == FOBJ_TABLE || p->type == FOBJ_ARRAY),
+            "sort requires a table or an array");
+    return p->type == FOBJ_TABLE ? p->u.table.array : p;
+}
+
+            /* sort:  table -> table */
+FWORD(sort)
+{
+    A = POP;
+    PUSH(a);
+    fsort_array(f, forth_sort_array(f, a), NULL);
+}
+
+            /* sort-by:  table xt -> table */
+FWORD2(sort_by, "sort-by")
+{
+    fobj_t *xt = forth_pop_xt(f);
+    A = POP;
+    PUSH(a);
+    fsort_array(f, forth_sort_array(f, a), xt);
+}
+
+/**********************************************************
+ *
+ * Serialization
+ *
+ * save and load write a table (and everything it holds) to a file and
+ * read it back, in a compact binary form that keeps shared tables shared;
+ * save-json and load-json do the same with JSON for other tools.  >binary
+ * binary> >json and json> do it in memory.  See fser.c.
+ *
+ **********************************************************/
+
+            /* save:  obj path -> */
+FWORD(save)
+{
+    fobj_t *path = forth_pop_str(f);
+    A = POP;
+    fser_save(f, a, fstr_cstr(f, path), 0);
+}
+
+            /* load:  path -> obj */
+FWORD(load)
+{
+    fobj_t *path = forth_pop_str(f);
+    PUSH(fser_load(f, fstr_cstr(f, path), 0));
+}
+
+            /* save-json:  obj path -> */
+FWORD2(save_json, "save-json")
+{
+    fobj_t *path = forth_pop_str(f);
+    A = POP;
+    fser_save(f, a, fstr_cstr(f, path), 1);
+}
+
+            /* load-json:  path -> obj */
+FWORD2(load_json, "load-json")
+{
+    fobj_t *path = forth_pop_str(f);
+    PUSH(fser_load(f, fstr_cstr(f, path), 1));
+}
+
+            /* >binary:  obj -> bytes */
+FWORD2(to_binary, ">binary")
+{
+    A = POP;
+    PUSH(fser_encode(f, a, 0));
+}
+
+            /* binary>:  bytes -> obj */
+FWORD2(from_binary, "binary>")
+{
+    unsigned char *buf;
+    size_t len;
+
+    forth_pop_buf(f, &buf, &len);
+    PUSH(fser_decode(f, buf, len, 0));
+}
+
+            /* >json:  obj -> str */
+FWORD2(to_json, ">json")
+{
+    A = POP;
+    PUSH(fser_encode(f, a, 1));
+}
+
+            /* json>:  str -> obj */
+FWORD2(from_json, "json>")
+{
+    unsigned char *buf;
+    size_t len;
+
+    forth_pop_buf(f, &buf, &len);
+    PUSH(fser_decode(f, buf, len, 1));
+}
+
+/**********************************************************
+ *
+ * Delimited Files
+ *
+ * A csv reads records from a file a batch at a time, so a file of any
+ * size can be worked through in the same memory:
+ *
+ *     str" trace.csv" csv-open constant trace
+ *     trace csv-row drop constant header
+ *     begin trace csv-rows while  ( rows ) ...  repeat
+ *
+ * csv-columns gives a batch as a table of columns instead.  Fields that
+ * are numbers come back as numbers.  See fcsv.c.
+ *
+ **********************************************************/
+
+static fobj_t *forth_pop_csv(fenv_t *f)
+{
+    fobj_t *p = POP;
+    FASSERT(p && p->type == FOBJ_CSV, "A csv reader was expected here");
+    return p;
+}
+
+/*
+ * forth_push_batch()
+ *
+ * Push what a csv word read and true, or just false at the end.
+ */
+static void forth_push_batch(fenv_t *f, fobj_t *p)
+{
+    if (p) {
+        PUSH(p);
+        PUSHN(-1);
+    } else {
+        PUSHN(0);
+    }
+}
+
+            /* csv-open:  path -> csv */
+FWORD2(csv_open, "csv-open")
+{
+    PUSH(fcsv_open(f, forth_pop_str(f)));
+}
+
+            /* csv-string:  str|bytes -> csv */
+FWORD2(csv_string, "csv-string")
+{
+    unsigned char *buf;
+    size_t len;
+
+    PUSH(fcsv_string(f, forth_pop_buf(f, &buf, &len)));
+}
+
+            /* csv-delim:  csv char|str -> csv */
+FWORD2(csv_delim, "csv-delim")
+{
+    A = POP;
+    fobj_t *csv = forth_pop_csv(f);
+    int c;
+
+    if (a && a->type == FOBJ_STR) {
+        FASSERT(a->u.str.len == 1, "csv-delim requires a single character");
+        c = (unsigned char) a->u.str.buf[0];
+    } else {
+        FASSERT(a && a->type == FOBJ_NUM, "csv-delim requires a character");
+        c = (int) a->u.num.n;
+    }
+    fcsv_set_delim(f, csv, c);
+    PUSH(csv);
+}
+
+            /* csv-batch:  csv n -> csv     (records per batch; 0 for all) */
+FWORD2(csv_batch, "csv-batch")
+{
+    int n = POPI;
+    fobj_t *csv = forth_pop_csv(f);
+    fcsv_set_batch(f, csv, n);
+    PUSH(csv);
+}
+
+            /* csv-row:  csv -> row true | false */
+FWORD2(csv_row, "csv-row")
+{
+    forth_push_batch(f, fcsv_row(f, forth_pop_csv(f)));
+}
+
+            /* csv-rows:  csv -> rows true | false */
+FWORD2(csv_rows, "csv-rows")
+{
+    forth_push_batch(f, fcsv_rows(f, forth_pop_csv(f)));
+}
+
+            /* csv-columns:  csv -> columns true | false */
+FWORD2(csv_columns, "csv-columns")
+{
+    forth_push_batch(f, fcsv_columns(f, forth_pop_csv(f)));
+}
+
+            /* csv-close:  csv -> */
+FWORD2(csv_close, "csv-close")
+{
+    fcsv_close(f, forth_pop_csv(f));
+}
+
+/**********************************************************
+ *
+ * Memoized Words
+ *
+ *     ' decode 1 256 memoize
+ *
+ * makes decode remember the results of its last 256 distinct arguments.
+ * See fmemo.c.
+ *
+ **********************************************************/
+
+FWORD_DO(memo)
+{
+    fmemo_call(f, w->u.word.u.value);
+}
+
+            /* memoize:  xt nargs size -> */
+FWORD(memoize)
+{
+    int size = POPI;
+    int nargs = POPI;
+    fobj_t *xt = forth_pop_xt(f);
+    fword_t *word = &xt->u.word;
+
+    FASSERT(word->code != fcode_do_memo, "%s is already memoized", word->name->u.str.buf);
+
+    /*
+     * The original code and body move to a new word which the memo
+     * calls; xt becomes the memoized word.
+     */
+    fobj_t *inner = fobj_new(f, FOBJ_WORD);
+    inner->u.word = *word;
+
+    fobj_t *memo = fmemo_new(f, inner, nargs, size);
+    word->code = fcode_do_memo;
+    word->body_len = 0;
+    word->body_allocated = 0;
+    word->body_offset = 0;
+    word->u.value = memo;
+}
+
+            /* memo-stats:  xt -> hits misses */
+FWORD2(memo_stats, "memo-stats")
+{
+    fobj_t *xt = forth_pop_xt(f);
+    FASSERT(xt->u.word.code == fcode_do_memo, "memo-stats requires a memoized word");
+
+    long hits, misses;
+    fmemo_stats(f, xt->u.word.u.value, &hits, &misses);
+    PUSHN(hits);
+    PUSHN(misses);
+}
+
+void fcode_handle_token(fenv_t *f, fobj_t *token)
+{
+    ASSERT(token->type == FOBJ_STR);
+    fobj_t *w = forth_find_word(f, token);
+    if (w) {
+        ASSERT(w->type == FOBJ_WORD);
+        if (w->u.word.immediate) {
+            w->u.word.code(f, w);
+        } else {
+            forth_compile_word(f, w, 0);
+        }
+    } else {
+        fnumber_t n = 0;
+        int r = fparse_token_to_number(f, token, &n);
+        FASSERT(r, "Input token not found in dictionary and isn't a number: <%s>",
+                fstr_cstr(f, token));
+        forth_compile_cons(f, n);
+    }
+}
+
+void fcode_compile_string(fenv_t *f, const char *string)
+{
+    fobj_t *token;
+
+    f->input_str = fstr_new(f, string);
+    f->input_offset = 0;
+    f->new_words = ftable_new(f);
+
+    f->current_compiling = fcode_new(f, fstr_new(f, "input string"),
+                                     fcode_do_colon_header.code,
+                                     /* immediate */ 0,
+                                     NULL, NULL);
+
+    do {
+        int r = fparse_token(f, &token);
+        if (!r) break;
+        fcode_handle_token(f, token);
+        fobj_hold_clear(f);
     } while (1);
     forth_compile_word(f, fcode_lookup_word(f, "(exit)"), 0);
 
     /*
-     * Merge f->new_words into f->words.  This algorithm should probably be
-     * in fhash.c.
+     * Merge f->new_words into f->words.
      */
 
-    fhash_t *new_words = &f->new_words->u.table.hash->u.hash;
-    for (int i = 0; i < new_words->num_kv; i++) {
-        ftable_store(f, f->words, 
-                     new_words->keys_values[i * 2],
-                     new_words->keys_values[i * 2 + 1]);
+    fobj_t *new_words = f->new_words->u.table.hash;
+    for (int i = 0; i < fhash_count(f, new_words); i++) {
+        ftable_store(f, f->words,
+                     fhash_key_at(f, new_words, i),
+                     fhash_val_at(f, new_words, i));
     }
 
+    fobj_hold_clear(f);
     CURRENT->code(f, f->current_compiling);
     f->current_compiling = NULL;
 }
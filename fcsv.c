@@ -0,0 +1,518 @@
+/*
+ * This file is part of arm-sim: http://madscientistroom.org/arm-sim
+ *
+ * Copyright (c) 2010 Randy Thelen. All rights reserved, and all wrongs
+ * reversed. (See the file COPYRIGHT for details.)
+ */
+
+#include <errno.h>
+
+#include "forth.h"
+#include "fobj.h"
+
+/*
+ * Delimited files
+ *
+ * A csv object reads records from a file (or a string) a batch at a
+ * time, into a table of rows or a table of columns.  The file is read in
+ * chunks into a buffer that only grows for a record longer than it, so
+ * reading a file of any size takes the same memory.
+ *
+ * A record is scanned first, finding where each of its fields is with
+ * fscan_find3(); only once the whole record is in the buffer are the
+ * fields made into objects:
+ *
+ *	- a quoted field is a string ("" in it is a ")
+ *	- an empty field is an empty slot
+ *	- a decimal, hex (0x...) or floating point number is a number
+ *	- anything else is a string, interned if it's short since the same
+ *	  few strings (mnemonics, say) tend to fill a column
+ *
+ * Blank lines are skipped, and lines may end in \n, \r\n or \r.
+ */
+
+#define FCSV_CHUNK			(256 * 1024)
+#define FCSV_BATCH			4096		// Records per batch unless set
+#define FCSV_INTERN_MAX		32
+
+typedef struct fcsv_field_s {
+    size_t		 off;
+    size_t		 len;
+    int			 quoted;
+    int			 escapes;		// Has "" in it
+} fcsv_field_t;
+
+struct fcsv_state_s {
+    FILE		*fp;			// NULL when reading a string
+    char		*buf;
+    fobj_t		*buf_owner;		// What buf is in, when reading a string
+    size_t		 len;			// Bytes in buf
+    size_t		 pos;			// Where the next record starts
+    size_t		 next;			// Where the one after it starts, once scanned
+    size_t		 cap;
+    int			 eof;			// Nothing more to read into buf
+    int			 delim;
+    int			 batch;			// 0 for all of them
+    long		 records;		// Read so far, for errors
+
+    fcsv_field_t	*fields;		// The record last scanned
+    int			 num_fields;
+    int			 cap_fields;
+
+    char		*scratch;		// Quoted fields with "" in them
+    size_t		 scratch_cap;
+};
+
+static fobj_t *fcsv_new(fenv_t *f, fobj_t *src)
+{
+    fobj_t *p = fobj_new(f, FOBJ_CSV);
+    fcsv_state_t *st = calloc(1, sizeof(*st));
+
+    FASSERT(st, "out of memory for a csv reader");
+    st->delim = ',';
+    st->batch = FCSV_BATCH;
+    p->u.csv.src = src;
+    p->u.csv.st = st;
+    return p;
+}
+
+/*
+ * fcsv_open()
+ *
+ * A reader for the file at path.
+ */
+fobj_t *fcsv_open(fenv_t *f, fobj_t *path)
+{
+    FILE *fp = fopen(fstr_cstr(f, path), "rb");
+    FASSERT(fp, "can't read %s: %s", fstr_cstr(f, path), strerror(errno));
+
+    fobj_t *p = fcsv_new(f, path);
+    fcsv_state_t *st = p->u.csv.st;
+
+    st->fp = fp;
+    st->cap = FCSV_CHUNK;
+    st->buf = malloc(st->cap);
+    FASSERT(st->buf, "out of memory for a csv reader");
+    return p;
+}
+
+/*
+ * fcsv_string()
+ *
+ * A reader for the records in a string (or bytes), read in place.
+ */
+fobj_t *fcsv_string(fenv_t *f, fobj_t *str)
+{
+    fobj_t *p = fcsv_new(f, str);
+    fcsv_state_t *st = p->u.csv.st;
+
+    if (str->type == FOBJ_BYTES) {
+        st->buf = (char *) str->u.bytes.base;
+        st->len = str->u.bytes.len;
+        st->buf_owner = str;
+    } else {
+        st->buf = str->u.str.buf;
+        st->len = str->u.str.len;
+        st->buf_owner = fstr_buf_owner(f, str);  // A slice's bytes are its parent's
+    }
+    st->eof = 1;
+    return p;
+}
+
+void fcsv_visit(fenv_t *f, fobj_t *p)
+{
+    fobj_visit(f, p->u.csv.src);
+    if (p->u.csv.st) {
+        fobj_visit(f, p->u.csv.st->buf_owner);
+    }
+}
+
+void fcsv_close(fenv_t *f, fobj_t *p)
+{
+    fcsv_state_t *st = p->u.csv.st;
+
+    if (st->fp) {
+        fclose(st->fp);
+        free(st->buf);
+        st->fp = NULL;
+    }
+    st->buf = NULL;
+    st->len = st->pos = 0;
+    st->eof = 1;
+}
+
+void fcsv_free(fenv_t *f, fobj_t *p)
+{
+    fcsv_state_t *st = p->u.csv.st;
+
+    if (!st) return;
+
+    fcsv_close(f, p);
+    free(st->fields);
+    free(st->scratch);
+    free(st);
+    p->u.csv.st = NULL;
+}
+
+void fcsv_print(fenv_t *f, fobj_t *p)
+{
+    fout_printf(f, "csv(");
+    if (p->u.csv.st->fp) {
+        fstr_print(f, p->u.csv.src);
+        fout_printf(f, " ");
+    }
+    fout_printf(f, "%ld records)", p->u.csv.st->records);
+}
+
+void fcsv_set_delim(fenv_t *f, fobj_t *p, int delim)
+{
+    FASSERT(delim != '"' && delim != '\n' && delim != '\r',
+            "a csv delimiter can't be a quote or a line end");
+    p->u.csv.st->delim = (unsigned char) delim;
+}
+
+void fcsv_set_batch(fenv_t *f, fobj_t *p, int batch)
+{
+    FASSERT(batch >= 0, "a csv batch can't be negative");
+    p->u.csv.st->batch = batch;
+}
+
+/*
+ * fcsv_fill()
+ *
+ * Read more of the file, first dropping the records already made into
+ * objects.  The buffer only grows when it holds part of a single record.
+ */
+static void fcsv_fill(fenv_t *f, fcsv_state_t *st)
+{
+    memmove(st->buf, st->buf + st->pos, st->len - st->pos);
+    st->len -= st->pos;
+    st->pos = 0;
+
+    if (st->len == st->cap) {
+        st->cap *= 2;
+        st->buf = realloc(st->buf, st->cap);
+        FASSERT(st->buf, "out of memory for a csv record of %zu bytes", st->len);
+    }
+
+    size_t n = fread(st->buf + st->len, 1, st->cap - st->len, st->fp);
+    if (n == 0) {
+        FASSERT(!ferror(st->fp), "error reading a csv file: %s", strerror(errno));
+        st->eof = 1;
+    }
+    st->len += n;
+}
+
+static fcsv_field_t *fcsv_add_field(fcsv_state_t *st, size_t off)
+{
+    if (st->num_fields == st->cap_fields) {
+        st->cap_fields = st->cap_fields ? 2 * st->cap_fields : 16;
+        st->fields = realloc(st->fields, st->cap_fields * sizeof(fcsv_field_t));
+    }
+
+    fcsv_field_t *fl = &st->fields[st->num_fields++];
+    fl->off = off;
+    fl->len = 0;
+    fl->quoted = 0;
+    fl->escapes = 0;
+    return fl;
+}
+
+/*
+ * fcsv_scan()
+ *
+ * Find the fields of the record at pos.  Returns 1 with st->next set
+ * past it, 0 if the buffer ends before the record does, or -1 if there
+ * are no more records.
+ */
+static int fcsv_scan(fenv_t *f, fcsv_state_t *st)
+{
+    const char *b = st->buf;
+    size_t p = st->pos, end = st->len;
+
+    while (p < end && (b[p] == '\n' || b[p] == '\r')) {
+        p++;
+    }
+    st->pos = p;
+    st->num_fields = 0;
+    if (p == end) {
+        return st->eof ? -1 : 0;
+    }
+
+    while (1) {
+        fcsv_field_t *fl;
+
+        if (p < end && b[p] == '"') {
+            fl = fcsv_add_field(st, ++p);
+            fl->quoted = 1;
+            while (1) {
+                const char *q = memchr(b + p, '"', end - p);
+                if (!q) {
+                    FASSERT(!st->eof, "csv record %ld has an unclosed quote", st->records + 1);
+                    return 0;
+                }
+                p = q - b;
+                if (p + 1 == end && !st->eof) {
+                    return 0;  // It could yet be a ""
+                }
+                if (p + 1 < end && b[p + 1] == '"') {
+                    fl->escapes = 1;
+                    p += 2;
+                    continue;
+                }
+                break;
+            }
+            fl->len = p++ - fl->off;
+        } else {
+            fl = fcsv_add_field(st, p);
+            size_t n = fscan_find3(b + p, end - p, st->delim, '\n', '\r');
+            p = n == FSCAN_NONE ? end : p + n;
+            fl->len = p - fl->off;
+        }
+
+        if (p == end) {
+            if (!st->eof) return 0;
+            st->next = p;
+            return 1;
+        }
+        if ((unsigned char) b[p] == st->delim) {
+            p++;
+            continue;
+        }
+
+        FASSERT(b[p] == '\n' || b[p] == '\r',
+                "csv record %ld has something after a closing quote", st->records + 1);
+        if (b[p] == '\r' && p + 1 < end && b[p + 1] == '\n') {
+            p++;
+        }
+        st->next = p + 1;
+        return 1;
+    }
+}
+
+/*
+ * fcsv_record()
+ *
+ * Scan the next record, reading more of the file as needed.  Returns 0
+ * when there are no more.
+ */
+static int fcsv_record(fenv_t *f, fcsv_state_t *st)
+{
+    while (1) {
+        int r = fcsv_scan(f, st);
+        if (r) {
+            return r > 0;
+        }
+        fcsv_fill(f, st);
+    }
+}
+
+static const fnumber_t fcsv_pow10[] = {
+    1e0L, 1e1L, 1e2L, 1e3L, 1e4L, 1e5L, 1e6L, 1e7L, 1e8L, 1e9L,
+    1e10L, 1e11L, 1e12L, 1e13L, 1e14L, 1e15L, 1e16L, 1e17L, 1e18L, 1e19L,
+};
+
+/*
+ * fcsv_number()
+ *
+ * Is s a number, and if so which?  Decimals of up to 19 digits are
+ * worked out here (exactly, or with the one rounding of a division);
+ * longer ones and exponents are left to strtold().
+ */
+static int fcsv_number(const char *s, size_t len, fnumber_t *n)
+{
+    const char *p = s, *end = s + len;
+    int neg = 0;
+
+    if (*p == '-' || *p == '+') {
+        neg = *p++ == '-';
+    }
+    if (p == end) {
+        return 0;
+    }
+
+    if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        uint64_t v = 0;
+        for (p += 2; p < end; p++) {
+            if (!isxdigit((unsigned char) *p) || v >> 60) return 0;
+            v = v * 16 + (isdigit((unsigned char) *p) ? *p - '0' : (tolower(*p) - 'a' + 10));
+        }
+        *n = neg ? -(fnumber_t) v : (fnumber_t) v;
+        return 1;
+    }
+
+    uint64_t mant = 0;
+    int digits = 0, frac = 0;
+
+    for (; p < end && isdigit((unsigned char) *p); p++, digits++) {
+        mant = mant * 10 + (*p - '0');
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && isdigit((unsigned char) *p); p++, digits++, frac++) {
+            mant = mant * 10 + (*p - '0');
+        }
+    }
+    if (!digits) {
+        return 0;
+    }
+
+    if (p == end && digits <= 19) {
+        *n = frac ? (fnumber_t) mant / fcsv_pow10[frac] : (fnumber_t) mant;
+        if (neg) *n = -*n;
+        return 1;
+    }
+
+    if (p < end && *p != 'e' && *p != 'E') {
+        return 0;
+    }
+
+    char buf[64], *q;
+    if (len >= sizeof(buf)) {
+        return 0;
+    }
+    memcpy(buf, s, len);
+    buf[len] = 0;
+    *n = strtold(buf, &q);
+    return q == buf + len;
+}
+
+static fobj_t *fcsv_str(fenv_t *f, const char *s, size_t len)
+{
+    FASSERT(len <= 0x7fffffff, "a csv field is too long");
+    if (len <= FCSV_INTERN_MAX) {
+        return fstr_intern_buf(f, s, len);
+    }
+    return fstr_new_buf(f, s, len);
+}
+
+static fobj_t *fcsv_field(fenv_t *f, fcsv_state_t *st, fcsv_field_t *fl)
+{
+    const char *s = st->buf + fl->off;
+    fnumber_t n;
+
+    if (fl->quoted) {
+        if (!fl->escapes) {
+            return fcsv_str(f, s, fl->len);
+        }
+
+        if (fl->len > st->scratch_cap) {
+            st->scratch_cap = 2 * fl->len;
+            st->scratch = realloc(st->scratch, st->scratch_cap);
+        }
+        size_t len = 0;
+        for (size_t i = 0; i < fl->len; i++) {
+            st->scratch[len++] = s[i];
+            if (s[i] == '"') i++;  // The second of ""
+        }
+        return fcsv_str(f, st->scratch, len);
+    }
+
+    if (fl->len == 0) {
+        return NULL;
+    }
+    if (fcsv_number(s, fl->len, &n)) {
+        return fnum_new(f, n);
+    }
+    return fcsv_str(f, s, fl->len);
+}
+
+/*
+ * fcsv_fill_row()
+ *
+ * Make the fields of the record just scanned into row's array part and
+ * move past it.
+ */
+static void fcsv_fill_row(fenv_t *f, fcsv_state_t *st, fobj_t *row)
+{
+    fobj_t *a = row->u.table.array;
+
+    farray_resize(f, a, st->num_fields);
+    for (int i = 0; i < st->num_fields; i++) {
+        a->u.array.elems[i] = fcsv_field(f, st, &st->fields[i]);
+    }
+    st->pos = st->next;
+    st->records++;
+}
+
+/*
+ * fcsv_row()
+ *
+ * The next record as a table of its fields, or NULL at the end.
+ */
+fobj_t *fcsv_row(fenv_t *f, fobj_t *p)
+{
+    fcsv_state_t *st = p->u.csv.st;
+
+    if (!fcsv_record(f, st)) {
+        return NULL;
+    }
+
+    fobj_t *row = ftable_new(f);
+    fcsv_fill_row(f, st, row);
+    return row;
+}
+
+/*
+ * fcsv_rows()
+ *
+ * The next batch of records as a table of rows, or NULL at the end.
+ */
+fobj_t *fcsv_rows(fenv_t *f, fobj_t *p)
+{
+    fcsv_state_t *st = p->u.csv.st;
+    fobj_t *rows = ftable_new(f);
+    fobj_t *a = rows->u.table.array;
+    int n = 0;
+
+    farray_reserve(f, a, st->batch);
+
+    int mark = fobj_hold_mark(f);
+    while ((!st->batch || n < st->batch) && fcsv_record(f, st)) {
+        fobj_t *row = ftable_new(f);
+        farray_resize(f, a, n + 1);
+        a->u.array.elems[n++] = row;
+        fcsv_fill_row(f, st, row);
+        fobj_hold_release(f, mark);
+    }
+
+    return n ? rows : NULL;
+}
+
+/*
+ * fcsv_columns()
+ *
+ * The next batch of records as a table of columns, each a table with a
+ * field from every record (a record without that field leaves an empty
+ * slot), or NULL at the end.
+ */
+fobj_t *fcsv_columns(fenv_t *f, fobj_t *p)
+{
+    fcsv_state_t *st = p->u.csv.st;
+    fobj_t *cols = ftable_new(f);
+    fobj_t *a = cols->u.table.array;
+    int n = 0;
+
+    int mark = fobj_hold_mark(f);
+    while ((!st->batch || n < st->batch) && fcsv_record(f, st)) {
+        while (a->u.array.num < st->num_fields) {
+            fobj_t *col = ftable_new(f);
+            farray_reserve(f, col->u.table.array, st->batch);
+            farray_resize(f, a, a->u.array.num + 1);
+            a->u.array.elems[a->u.array.num - 1] = col;
+        }
+        for (int i = 0; i < st->num_fields; i++) {
+            fobj_t *col = a->u.array.elems[i]->u.table.array;
+            farray_resize(f, col, n + 1);
+            col->u.array.elems[n] = fcsv_field(f, st, &st->fields[i]);
+        }
+        st->pos = st->next;
+        st->records++;
+        n++;
+        fobj_hold_release(f, mark);
+    }
+
+    for (int i = 0; i < a->u.array.num; i++) {
+        farray_resize(f, a->u.array.elems[i]->u.table.array, n);
+    }
+    return n ? cols : NULL;
+}
@@ -8,18 +8,85 @@
 #include "forth.h"
 #include "fobj.h"
 
+/*
+ * A hash is in one of two modes.  While it has only a few keys, all
+ * strings, it is in shape mode: h->shape lists the keys (see fshape.c)
+ * and h->slots holds the values in the same order.  Once it outgrows
+ * FHASH_MAX_SHAPE_KEYS or is given a key of another type it switches to
+ * dictionary mode for good: h->shape is NULL and h->keys_values holds
+ * the key/value pairs.  Keys are hashed and compared with fobj_hash()
+ * and fobj_equal().
+ *
+ * In dictionary mode the pairs stay in insertion order, and an open
+ * addressing index finds them, laid out as in a SwissTable: each slot
+ * has a control byte, either FHASH_EMPTY or the low 7 bits of its key's
+ * hash, next to the number of its pair (the control bytes are kept in
+ * one block with the pair numbers, after them).  A lookup goes to a group of
+ * FHASH_GROUP slots picked by the rest of the hash and compares all of
+ * its control bytes at once (with SSE2 where there is one), only
+ * looking at keys whose 7 bits agree.  A group with an empty slot ends
+ * the search; otherwise the next group is probed, quadratically.  Keys
+ * are never removed, so there are no tombstones.  The index is kept at
+ * most 7/8 full.
+ *
+ * A weak hash (fhash_set_weak()) is always in dictionary mode.  The
+ * collector drops its pairs whose weak key or value has died (see
+ * fobj.c), so a weak hash can be a cache which never grows beyond what
+ * the rest of the program holds on to.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define FHASH_SSE2	1
+#include <emmintrin.h>
+#else
+#define FHASH_SSE2	0
+#endif
+
+#define FHASH_MAX_SHAPE_KEYS	16
+#define FHASH_GROUP				16
+#define FHASH_EMPTY				0x80
+
 #define KEY(_h, _i)		(_h)->keys_values[2 * (_i) + 0]
 #define VAL(_h, _i)		(_h)->keys_values[2 * (_i) + 1]
+#define CTRL(_h)		((uint8_t *) ((_h)->index + (_h)->nslots))
+
+int fhash_count(fenv_t *f, fobj_t *p)
+{
+    return p->u.hash.num_kv;
+}
+
+fobj_t *fhash_key_at(fenv_t *f, fobj_t *p, int i)
+{
+    fhash_t *h = &p->u.hash;
+
+    ASSERT(i >= 0 && i < h->num_kv);
+    if (h->shape) {
+        return h->shape->u.shape.keys[i];
+    } else {
+        return KEY(h, i);
+    }
+}
+
+fobj_t *fhash_val_at(fenv_t *f, fobj_t *p, int i)
+{
+    fhash_t *h = &p->u.hash;
+
+    ASSERT(i >= 0 && i < h->num_kv);
+    if (h->shape) {
+        return h->slots[i];
+    } else {
+        return VAL(h, i);
+    }
+}
 
 void fhash_print(fenv_t *f, fobj_t *p)
 {
     ASSERT(p->type == FOBJ_HASH);
-    fhash_t *h = &p->u.hash;
 
-    for (int i = 0; i < h->num_kv; i++) {
-        fobj_print(f, KEY(h, i));
-        printf(" = ");
-        fobj_print(f, VAL(h, i));
+    for (int i = 0; i < fhash_count(f, p); i++) {
+        fobj_print(f, fhash_key_at(f, p, i));
+        fout_printf(f, " = ");
+        fobj_print(f, fhash_val_at(f, p, i));
     }
 }
 
@@ -29,7 +96,13 @@ fobj_t *fhash_new(fenv_t *f)
     fhash_t *h = &p->u.hash;
 
     h->num_kv = 0;
+    h->cap_kv = 0;
     h->keys_values = NULL;
+    h->shape = f->empty_shape;
+    h->slots = NULL;
+    h->nslots = 0;
+    h->index = NULL;
+    h->weak = 0;
 
     return p;
 }
@@ -37,9 +110,36 @@ fobj_t *fhash_new(fenv_t *f)
 void fhash_visit(fenv_t *f, fobj_t *p)
 {
     fhash_t *h = &p->u.hash;
-    for (int i = 0; i < h->num_kv; i++) {
-        fobj_visit(f, KEY(h, i));
-        fobj_visit(f, VAL(h, i));
+
+    if (h->weak) {
+        /*
+         * Only the strong parts now: fhash_weak_trace() does the values
+         * of weak keys once it's known which keys live.
+         */
+        fobj_weak_note(f, p);
+        for (int i = 0; i < h->num_kv; i++) {
+            fobj_t *key = KEY(h, i), *val = VAL(h, i);
+            int weak_key = (h->weak & FHASH_WEAK_KEYS) && fobj_held_weakly(key);
+            int weak_val = (h->weak & FHASH_WEAK_VALUES) && fobj_held_weakly(val);
+
+            if (!weak_key) {
+                fobj_visit(f, key);
+            }
+            if (weak_val || (weak_key && !(h->weak & FHASH_WEAK_VALUES))) {
+                continue;
+            }
+            fobj_visit(f, val);
+        }
+    } else if (h->shape) {
+        fobj_visit(f, h->shape);
+        for (int i = 0; i < h->num_kv; i++) {
+            fobj_visit(f, h->slots[i]);
+        }
+    } else {
+        for (int i = 0; i < h->num_kv; i++) {
+            fobj_visit(f, KEY(h, i));
+            fobj_visit(f, VAL(h, i));
+        }
     }
 }
 
@@ -50,27 +150,326 @@ void fhash_free(fenv_t *f, fobj_t *p)
     if (h->keys_values) {
         free(h->keys_values);
     }
+
+    if (h->slots) {
+        free(h->slots);
+    }
+
+    free(h->index);
+}
+
+/***********************************
+ *
+ * The dictionary mode index
+ *
+ ***********************************/
+
+/*
+ * Bit i of the result is set if control byte i of the group is c.
+ */
+static uint32_t fhash_group_match(const uint8_t *g, uint8_t c)
+{
+#if FHASH_SSE2
+    __m128i v = _mm_loadu_si128((const __m128i *) g);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+#else
+    uint32_t m = 0;
+    for (int i = 0; i < FHASH_GROUP; i++) {
+        if (g[i] == c) m |= 1u << i;
+    }
+    return m;
+#endif
+}
+
+/*
+ * fhash_slot_for()
+ *
+ * Walk the probe sequence for hash to the slot holding key, or if it's
+ * not there to the first empty slot.
+ */
+static int fhash_slot_for(fenv_t *f, fhash_t *h, fobj_t *key, uint64_t hash)
+{
+    int ngroups = h->nslots / FHASH_GROUP;
+    int g = (hash >> 7) & (ngroups - 1);
+    uint8_t h2 = hash & 0x7f;
+
+    for (int step = 1; ; step++) {
+        const uint8_t *ctrl = &CTRL(h)[g * FHASH_GROUP];
+
+        if (key) {
+            for (uint32_t m = fhash_group_match(ctrl, h2); m; m &= m - 1) {
+                int slot = g * FHASH_GROUP + __builtin_ctz(m);
+                if (fobj_equal(f, key, KEY(h, h->index[slot]))) {
+                    return slot;
+                }
+            }
+        }
+
+        uint32_t empty = fhash_group_match(ctrl, FHASH_EMPTY);
+        if (empty) {
+            return g * FHASH_GROUP + __builtin_ctz(empty);
+        }
+
+        ASSERT(step <= ngroups);
+        g = (g + step) & (ngroups - 1);
+    }
+}
+
+/*
+ * fhash_reindex()
+ *
+ * Build an index of nslots for the pairs.
+ */
+static void fhash_reindex(fenv_t *f, fhash_t *h, int nslots)
+{
+    free(h->index);
+
+    h->nslots = nslots;
+    h->index = malloc(nslots * (sizeof(int) + 1));
+    memset(CTRL(h), FHASH_EMPTY, nslots);
+
+    for (int i = 0; i < h->num_kv; i++) {
+        uint64_t hash = fobj_hash(f, KEY(h, i));
+        int slot = fhash_slot_for(f, h, NULL, hash);
+        CTRL(h)[slot] = hash & 0x7f;
+        h->index[slot] = i;
+    }
+}
+
+static void fhash_set_cap(fenv_t *f, fhash_t *h, int cap)
+{
+    h->cap_kv = cap ? cap : 1;
+    h->keys_values = realloc(h->keys_values, 2 * h->cap_kv * sizeof(fobj_t *));
+    FASSERT(h->keys_values, "out of memory for a hash of %d keys", cap);
+}
+
+/*
+ * Leave shape mode: copy the keys out of the shape and into
+ * keys_values.
+ */
+static void fhash_to_dictionary(fenv_t *f, fhash_t *h)
+{
+    fobj_t **keys = h->shape->u.shape.keys;
+
+    fhash_set_cap(f, h, h->num_kv ? 2 * h->num_kv : 8);
+    for (int i = 0; i < h->num_kv; i++) {
+        KEY(h, i) = keys[i];
+        VAL(h, i) = h->slots[i];
+    }
+
+    free(h->slots);
+    h->slots = NULL;
+    h->shape = NULL;
+
+    fhash_reindex(f, h, 4 * FHASH_GROUP);
+}
+
+/*
+ * The size of index which holds n keys without going over 7/8 full.
+ */
+static int fhash_nslots_for(int n)
+{
+    int nslots = 4 * FHASH_GROUP;
+
+    while (8 * n > 7 * nslots) nslots *= 2;
+    return nslots;
+}
+
+/*
+ * fhash_reserve() and fhash_shrink()
+ *
+ * Capacity hints: make room for n keys in all, so they go in without
+ * the index being rebuilt, or give back what isn't in use.
+ */
+void fhash_reserve(fenv_t *f, fobj_t *p, int n)
+{
+    fhash_t *h = &p->u.hash;
+
+    FASSERT(n >= 0, "can't reserve a negative number of keys");
+    if (h->shape) {
+        if (n <= FHASH_MAX_SHAPE_KEYS) return;
+        fhash_to_dictionary(f, h);
+    }
+
+    if (n > h->cap_kv) {
+        fhash_set_cap(f, h, n);
+    }
+    if (fhash_nslots_for(n) > h->nslots) {
+        fhash_reindex(f, h, fhash_nslots_for(n));
+    }
+}
+
+void fhash_shrink(fenv_t *f, fobj_t *p)
+{
+    fhash_t *h = &p->u.hash;
+
+    if (h->shape) {
+        return;  // Shape mode is never more than it needs
+    }
+
+    if (h->cap_kv > h->num_kv) {
+        fhash_set_cap(f, h, h->num_kv);
+    }
+    if (fhash_nslots_for(h->num_kv) < h->nslots) {
+        fhash_reindex(f, h, fhash_nslots_for(h->num_kv));
+    }
 }
 
 static void fhash_add_key_val(fenv_t *f, fhash_t *h, fobj_t *key, fobj_t *val)
 {
-    int n = 2 * h->num_kv + 2;
-    h->keys_values = realloc(h->keys_values, n * sizeof(fobj_t **));
-    KEY(h, h->num_kv) = key;
-    VAL(h, h->num_kv) = val;
-    h->num_kv ++;
+    if (h->shape && (h->num_kv == FHASH_MAX_SHAPE_KEYS || key->type != FOBJ_STR)) {
+        fhash_to_dictionary(f, h);
+    }
+
+    if (h->shape) {
+        fobj_t *shape = fshape_add_key(f, h->shape, key);
+        if (shape) {
+            h->shape = shape;
+            h->slots = realloc(h->slots, (h->num_kv + 1) * sizeof(fobj_t **));
+            h->slots[h->num_kv] = val;
+            h->num_kv ++;
+            return;
+        }
+        fhash_to_dictionary(f, h);  // The shape has too many children
+    }
+
+    if (h->num_kv == h->cap_kv) {
+        fhash_set_cap(f, h, 2 * h->cap_kv);
+    }
+    if (8 * (h->num_kv + 1) > 7 * h->nslots) {
+        fhash_reindex(f, h, 2 * h->nslots);
+    }
+
+    int i = h->num_kv++;
+    KEY(h, i) = key;
+    VAL(h, i) = val;
+
+    uint64_t hash = fobj_hash(f, key);
+    int slot = fhash_slot_for(f, h, NULL, hash);
+    CTRL(h)[slot] = hash & 0x7f;
+    h->index[slot] = i;
 }
 
 static fobj_t **fhash_key_index(fenv_t *f, fhash_t *h, fobj_t *key)
 {
+    if (h->shape) {
+        if (key->type != FOBJ_STR) {
+            return NULL;  // Shapes only have strings
+        }
+        int i = fshape_slot(f, h->shape, key);
+        return i < 0 ? NULL : &h->slots[i];
+    }
+
+    int slot = fhash_slot_for(f, h, key, fobj_hash(f, key));
+    if (CTRL(h)[slot] == FHASH_EMPTY) {
+        return NULL;
+    }
+    return &VAL(h, h->index[slot]);
+}
+
+/*
+ * fhash_remove_if()
+ *
+ * Remove the pairs for which drop() says so, keeping the rest in order.
+ * Only a hash in dictionary mode can have keys other than strings, and
+ * this is for taking those out, so a hash in shape mode is left alone.
+ * Returns how many were removed.
+ */
+int fhash_remove_if(fenv_t *f, fobj_t *p,
+                    int (*drop)(fenv_t *f, fobj_t *key, fobj_t *val, void *arg), void *arg)
+{
+    fhash_t *h = &p->u.hash;
+    int n = 0;
+
+    if (h->shape) {
+        return 0;
+    }
+
     for (int i = 0; i < h->num_kv; i++) {
-        ASSERT(KEY(h, i)->type == FOBJ_STR);
-        if (strcmp(key->u.str.buf, KEY(h, i)->u.str.buf) == 0) {
-            return &VAL(h, i);
+        if (!drop(f, KEY(h, i), VAL(h, i), arg)) {
+            KEY(h, n) = KEY(h, i);
+            VAL(h, n) = VAL(h, i);
+            n++;
         }
     }
 
-    return NULL;
+    int removed = h->num_kv - n;
+    if (removed) {
+        h->num_kv = n;
+        fhash_reindex(f, h, h->nslots);
+    }
+    return removed;
+}
+
+/*
+ * fhash_set_weak()
+ *
+ * Hold keys, values or both (FHASH_WEAK_KEYS | FHASH_WEAK_VALUES)
+ * weakly from now on.
+ */
+void fhash_set_weak(fenv_t *f, fobj_t *p, int weak)
+{
+    fhash_t *h = &p->u.hash;
+
+    if (h->shape) {
+        fhash_to_dictionary(f, h);
+    }
+    h->weak |= weak;
+}
+
+/*
+ * fhash_weak_trace()
+ *
+ * While collecting: mark the values whose weak keys have been marked.
+ * Returns whether it marked any, so more keys might now be marked.
+ */
+int fhash_weak_trace(fenv_t *f, fobj_t *p)
+{
+    fhash_t *h = &p->u.hash;
+    int traced = 0;
+
+    if (!(h->weak & FHASH_WEAK_KEYS) || (h->weak & FHASH_WEAK_VALUES)) {
+        return 0;  // fhash_visit() has marked all it's going to
+    }
+
+    for (int i = 0; i < h->num_kv; i++) {
+        fobj_t *key = KEY(h, i), *val = VAL(h, i);
+
+        if (val && fobj_held_weakly(key) && fobj_marked(f, key) && !fobj_marked(f, val)) {
+            fobj_visit(f, val);
+            traced = 1;
+        }
+    }
+    return traced;
+}
+
+/*
+ * fhash_weak_clear()
+ *
+ * While collecting: remove the pairs whose weak key or value wasn't
+ * marked.
+ */
+static int fhash_weak_dead(fenv_t *f, fobj_t *key, fobj_t *val, void *arg)
+{
+    int weak = *(int *) arg;
+
+    if ((weak & FHASH_WEAK_KEYS) && fobj_held_weakly(key) && !fobj_marked(f, key)) {
+        return 1;
+    }
+    if ((weak & FHASH_WEAK_VALUES) && fobj_held_weakly(val) && !fobj_marked(f, val)) {
+        return 1;
+    }
+    return 0;
+}
+
+void fhash_weak_clear(fenv_t *f, fobj_t *p)
+{
+    fhash_remove_if(f, p, fhash_weak_dead, &p->u.hash.weak);
+}
+
+int fhash_has(fenv_t *f, fobj_t *p, fobj_t *key)
+{
+    return fhash_key_index(f, &p->u.hash, key) != NULL;
 }
 
 static fobj_t *fhash_key_fetch(fenv_t *f, fhash_t *h, fobj_t *key)
@@ -109,10 +508,27 @@ fobj_t *fhash_fetch(fenv_t *f, fobj_t *addr, fobj_t *index)
 void fhash_store(fenv_t *f, fobj_t *addr, fobj_t *index, fobj_t *data)
 {
     FASSERT(index, "hash store must be indexed");
-    FASSERT(index->type == FOBJ_STR, "hash store must be indexed by STRING");
 
     fhash_t *h = &addr->u.hash;
 
     fhash_key_store(f, h, index, data);
 }
 
+/*
+ * fhash_next()
+ *
+ * Walk the pairs of a hash in the order they were added.  *cursor
+ * starts at 0; each call sets *key and *val and returns 1, or returns 0
+ * at the end.
+ */
+int fhash_next(fenv_t *f, fobj_t *p, int *cursor, fobj_t **key, fobj_t **val)
+{
+    if (*cursor >= fhash_count(f, p)) {
+        return 0;
+    }
+
+    *key = fhash_key_at(f, p, *cursor);
+    *val = fhash_val_at(f, p, *cursor);
+    (*cursor)++;
+    return 1;
+}
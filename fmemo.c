@@ -0,0 +1,266 @@
+/*
+ * This file is part of arm-sim: http://madscientistroom.org/arm-sim
+ *
+ * Copyright (c) 2010 Randy Thelen. All rights reserved, and all wrongs
+ * reversed. (See the file COPYRIGHT for details.)
+ */
+
+#include "forth.h"
+#include "fobj.h"
+
+/*
+ * Memoized words
+ *
+ * memoize turns a word into one which looks its arguments up in a cache
+ * before running.  The word's original code moves into a new word (the
+ * memo's xt) and the word itself is pointed at fcode_do_memo with the
+ * memo as its value, so code already compiled against it is memoized
+ * too.
+ *
+ * A memo remembers up to size calls.  Each entry holds the nargs
+ * arguments the word was called with followed by whatever it left on the
+ * stack in their place.  Entries are found through a chained hash on
+ * fobj_hash() of the arguments and kept on a most recently used list;
+ * when the memo is full the least recently used entry is reused.
+ */
+
+#define FMEMO_MAX_SIZE	(1 << 20)
+
+struct fmemo_entry_s {
+    uint32_t		 hash;
+    int				 chain;			// Next entry in this bucket, or -1
+    int				 prev;			// The LRU list, most recent first
+    int				 next;
+    int				 nvals;
+    fobj_t			**vals;			// Arguments then results
+};
+
+struct fmemo_state_s {
+    int				 nargs;
+    int				 size;			// Most entries remembered
+    int				 num;
+    fmemo_entry_t	*entries;
+    int				 nbuckets;
+    int				*buckets;
+    int				 lru_head;
+    int				 lru_tail;
+    long			 hits;
+    long			 misses;
+};
+
+static uint32_t fmemo_hash_args(fenv_t *f, fobj_t **args, int nargs)
+{
+    uint32_t h = 0;
+
+    for (int i = 0; i < nargs; i++) {
+        h = (h ^ fobj_hash(f, args[i])) * 16777619u;
+    }
+    return h;
+}
+
+fobj_t *fmemo_new(fenv_t *f, fobj_t *xt, int nargs, int size)
+{
+    FASSERT(nargs >= 0, "memoize requires a count of arguments");
+    FASSERT(size > 0 && size <= FMEMO_MAX_SIZE,
+            "memoize requires a cache size from 1 to %d", FMEMO_MAX_SIZE);
+
+    fobj_t *p = fobj_new(f, FOBJ_MEMO);
+    fmemo_state_t *m = malloc(sizeof(*m));
+
+    FASSERT(m, "out of memory for a memo");
+    p->u.memo.xt = xt;
+    p->u.memo.st = m;
+    m->nargs = nargs;
+    m->size = size;
+    m->num = 0;
+    m->entries = calloc(size, sizeof(fmemo_entry_t));
+
+    for (m->nbuckets = 1; m->nbuckets < 2 * size; m->nbuckets <<= 1) {
+        ;
+    }
+    m->buckets = malloc(m->nbuckets * sizeof(int));
+    for (int i = 0; i < m->nbuckets; i++) {
+        m->buckets[i] = -1;
+    }
+
+    m->lru_head = m->lru_tail = -1;
+    m->hits = m->misses = 0;
+
+    return p;
+}
+
+void fmemo_visit(fenv_t *f, fobj_t *p)
+{
+    fmemo_state_t *m = p->u.memo.st;
+
+    fobj_visit(f, p->u.memo.xt);
+    for (int i = 0; i < m->num; i++) {
+        fmemo_entry_t *e = &m->entries[i];
+        for (int j = 0; j < e->nvals; j++) {
+            fobj_visit(f, e->vals[j]);
+        }
+    }
+}
+
+void fmemo_free(fenv_t *f, fobj_t *p)
+{
+    fmemo_state_t *m = p->u.memo.st;
+
+    for (int i = 0; i < m->num; i++) {
+        free(m->entries[i].vals);
+    }
+    free(m->entries);
+    free(m->buckets);
+    free(m);
+    p->u.memo.st = NULL;
+}
+
+void fmemo_print(fenv_t *f, fobj_t *p)
+{
+    fmemo_state_t *m = p->u.memo.st;
+
+    fout_printf(f, "memo[%d/%d] hits %ld misses %ld", m->num, m->size, m->hits, m->misses);
+}
+
+void fmemo_stats(fenv_t *f, fobj_t *p, long *hits, long *misses)
+{
+    *hits = p->u.memo.st->hits;
+    *misses = p->u.memo.st->misses;
+}
+
+/***********************************
+ *
+ * The LRU list and buckets
+ *
+ ***********************************/
+
+static void fmemo_unlink(fmemo_state_t *m, int i)
+{
+    fmemo_entry_t *e = &m->entries[i];
+
+    if (e->prev >= 0) m->entries[e->prev].next = e->next;
+    else              m->lru_head = e->next;
+    if (e->next >= 0) m->entries[e->next].prev = e->prev;
+    else              m->lru_tail = e->prev;
+}
+
+static void fmemo_link_head(fmemo_state_t *m, int i)
+{
+    fmemo_entry_t *e = &m->entries[i];
+
+    e->prev = -1;
+    e->next = m->lru_head;
+    if (m->lru_head >= 0) m->entries[m->lru_head].prev = i;
+    m->lru_head = i;
+    if (m->lru_tail < 0) m->lru_tail = i;
+}
+
+static void fmemo_unchain(fmemo_state_t *m, int i)
+{
+    int *pp = &m->buckets[m->entries[i].hash & (m->nbuckets - 1)];
+
+    while (*pp != i) {
+        ASSERT(*pp >= 0);
+        pp = &m->entries[*pp].chain;
+    }
+    *pp = m->entries[i].chain;
+}
+
+static int fmemo_lookup(fenv_t *f, fmemo_state_t *m, uint32_t hash, fobj_t **args)
+{
+    for (int i = m->buckets[hash & (m->nbuckets - 1)]; i >= 0; i = m->entries[i].chain) {
+        fmemo_entry_t *e = &m->entries[i];
+        int j;
+
+        if (e->hash != hash) continue;
+        for (j = 0; j < m->nargs; j++) {
+            if (!fobj_equal(f, e->vals[j], args[j])) break;
+        }
+        if (j == m->nargs) return i;
+    }
+
+    return -1;
+}
+
+/*
+ * fmemo_insert()
+ *
+ * Remember that args gave the nres results in res.
+ */
+static void fmemo_insert(fenv_t *f, fmemo_state_t *m, uint32_t hash,
+                         fobj_t **args, fobj_t **res, int nres)
+{
+    int i;
+
+    if (m->num < m->size) {
+        i = m->num++;
+    } else {
+        i = m->lru_tail;
+        fmemo_unlink(m, i);
+        fmemo_unchain(m, i);
+    }
+
+    fmemo_entry_t *e = &m->entries[i];
+    e->hash = hash;
+    e->nvals = m->nargs + nres;
+    e->vals = realloc(e->vals, (e->nvals ? e->nvals : 1) * sizeof(fobj_t *));
+    memcpy(e->vals, args, m->nargs * sizeof(fobj_t *));
+    memcpy(e->vals + m->nargs, res, nres * sizeof(fobj_t *));
+
+    int *bucket = &m->buckets[hash & (m->nbuckets - 1)];
+    e->chain = *bucket;
+    *bucket = i;
+    fmemo_link_head(m, i);
+}
+
+/*
+ * fmemo_call()
+ *
+ * Run a memoized word: answer from the cache if the arguments on the
+ * stack have been seen, otherwise run the word and remember what it
+ * left.
+ */
+void fmemo_call(fenv_t *f, fobj_t *memo)
+{
+    fmemo_state_t *m = memo->u.memo.st;
+    fobj_t *xt = memo->u.memo.xt;
+    fstack_t *ds = &f->dstack->u.stack;
+
+    FASSERT(ds->sp >= m->nargs, "stack underflow calling a memoized word");
+
+    fobj_t **args = &ds->elems[ds->sp - m->nargs];
+    uint32_t hash = fmemo_hash_args(f, args, m->nargs);
+    int i = fmemo_lookup(f, m, hash, args);
+
+    if (i >= 0) {
+        fmemo_entry_t *e = &m->entries[i];
+
+        m->hits ++;
+        fmemo_unlink(m, i);
+        fmemo_link_head(m, i);
+
+        ds->sp -= m->nargs;
+        for (int j = m->nargs; j < e->nvals; j++) {
+            fstack_store(f, f->dstack, NULL, e->vals[j]);
+        }
+        return;
+    }
+
+    m->misses ++;
+
+    /*
+     * Copy the arguments aside and hold them: the word consumes them and
+     * a recursive call may change the memo under us.
+     */
+    fobj_t *saved[m->nargs + 1];
+    for (int j = 0; j < m->nargs; j++) {
+        saved[j] = HOLD(args[j]);
+    }
+
+    int base = ds->sp - m->nargs;
+    xt->u.word.code(f, xt);
+
+    int nres = ds->sp - base;
+    FASSERT(nres >= 0, "a memoized word used more than its %d arguments", m->nargs);
+    fmemo_insert(f, m, hash, saved, &ds->elems[base], nres);
+}
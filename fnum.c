@@ -11,9 +11,9 @@
 void fnum_print(fenv_t *f, fobj_t *p)
 {
 #ifdef DEBUG
-    printf("    Value = %Lf\n", p->u.num.n);
+    fout_printf(f, "    Value = %Lf\n", p->u.num.n);
 #else
-    printf(" %Lg", p->u.num.n);
+    fout_printf(f, " %Lg", p->u.num.n);
 #endif
 }
 
@@ -44,3 +44,47 @@ fobj_t *fnum_sub(fenv_t *f, fobj_t *op1, fobj_t *op2)
     FASSERT(op2->type == FOBJ_NUM, "Wrong type");
     return fnum_new(f, op1->u.num.n - op2->u.num.n);
 }
+
+/*
+ * fnum_to_u64()
+ *
+ * The bit pattern a number stands for when it's stored into memory:
+ * negative numbers are two's complement.
+ */
+uint64_t fnum_to_u64(fenv_t *f, fnumber_t n)
+{
+    if (n < 0) {
+        return (uint64_t) (int64_t) n;
+    } else {
+        return (uint64_t) n;
+    }
+}
+
+/*
+ * fnum_hash()
+ *
+ * Integers (addresses, mostly) hash by their exact value, all 64 bits of
+ * it; anything else by its value as a double, with -0 taken as 0.
+ * Numbers which are equal hash alike either way.
+ */
+uint64_t fnum_hash(fenv_t *f, fobj_t *p)
+{
+    fnumber_t n = p->u.num.n;
+    uint64_t bits;
+
+    if (n >= -9223372036854775808.0L && n < 18446744073709551616.0L &&
+        (fnumber_t) (n < 0 ? (fnumber_t) (int64_t) n : (fnumber_t) (uint64_t) n) == n) {
+        bits = fnum_to_u64(f, n);
+    } else {
+        double d = n;
+        if (d == 0) d = 0;
+        memcpy(&bits, &d, sizeof(bits));
+    }
+
+    return fobj_hash_mix(bits);
+}
+
+int fnum_equal(fenv_t *f, fobj_t *a, fobj_t *b)
+{
+    return a->u.num.n == b->u.num.n;
+}
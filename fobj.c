@@ -11,34 +11,92 @@
 
 const foptable_t op_table[FOBJ_NUM_TYPES] = {
     { 0 }, // The zeroth entry is INVALID
-    { "number", NULL, NULL, NULL, fnum_print, fnum_cmp, NULL, NULL, fnum_add, fnum_sub },
-    { "string", NULL, NULL, fstr_free, fstr_print, fstr_cmp, NULL, fstr_fetch, fstr_add, fstr_sub },
+    { "number", NULL, NULL, NULL, fnum_print, fnum_cmp, NULL, NULL, fnum_add, fnum_sub,
+      fnum_hash, fnum_equal },
+    { "string", NULL, fstr_visit, fstr_free, fstr_print, fstr_cmp, NULL, fstr_fetch, fstr_add, fstr_sub,
+      fstr_hash, fstr_equal },
     { "table",  NULL, ftable_visit, NULL, ftable_print, NULL, ftable_store, ftable_fetch },
     { "array",  NULL, farray_visit, farray_free, farray_print, NULL, farray_store, farray_fetch },
     { "hash",   NULL, fhash_visit,  fhash_free, fhash_print, NULL, fhash_store, fhash_fetch },
     { "stack",  NULL, fstack_visit, fstack_free, fstack_print, NULL, fstack_store, fstack_fetch },
     { "index",  NULL, findex_visit, NULL, NULL, NULL, NULL, NULL },
     { "word",   NULL, fword_visit, fword_free, fword_print, NULL, NULL, NULL, NULL, NULL },
+    { "call" },
+    { "state" },
+    { "loop",   NULL, floop_visit },
+    { "btree",  NULL, fbtree_visit, fbtree_free, fbtree_print, NULL, fbtree_store, fbtree_fetch },
+    { "ptable", NULL, fptable_visit, NULL, fptable_print, NULL, fptable_store, fptable_fetch },
+    { "pnode",  NULL, fpnode_visit, fpnode_free },
+    { "shape",  NULL, fshape_visit, fshape_free },
+    { "bytes",  NULL, fbytes_visit, fbytes_free, fbytes_print, NULL, fbytes_store, fbytes_fetch },
+    { "seq",    NULL, fseq_visit, fseq_free, fseq_print },
+    { "iter",   NULL, fiter_visit },
+    { "memo",   NULL, fmemo_visit, fmemo_free, fmemo_print },
+    { "regex",  NULL, fregex_visit, fregex_free, fregex_print },
+    { "csv",    NULL, fcsv_visit, fcsv_free, fcsv_print },
 };
 
-#define NUM_OBJ_MEM		1024
+/*
+ * Object memory
+ *
+ * Objects are allocated from chunks of FOBJ_CHUNK_OBJS.  Objects point
+ * into one another (a string's bytes may be in its own small buffer or
+ * in another string, for example), so they must never move: the memory
+ * grows by adding chunks, never by reallocating one.  Each object
+ * carries its index in the memory, which picks its chunk and its bit in
+ * the in-use bitmap.
+ *
+ * After a garbage collection which leaves less than a quarter of the
+ * objects free, the memory grows by half again.
+ */
+
+#define FOBJ_CHUNK_SHIFT	10
+#define FOBJ_CHUNK_OBJS		(1 << FOBJ_CHUNK_SHIFT)
 
 struct fobj_mem_s {
-    uint32_t	inuse_bitmap[NUM_OBJ_MEM / 32];
+    int			nchunks;
+    fobj_t		**chunks;
+    int			num_objs;
+    uint32_t	*inuse_bitmap;
     int			num_free_objs;
-    uint16_t	next_free[NUM_OBJ_MEM];
-    fobj_t		objs[NUM_OBJ_MEM];
+    int			*next_free;
+    int			num_weak;		// Weak hashes seen while marking
+    int			cap_weak;
+    fobj_t		**weak;
 };
 
-static int	fobj_obj_mem_index(fenv_t *f, fobj_t *p)
+static void fobj_obj_mem_grow(fenv_t *f, int nchunks)
 {
     fobj_mem_t *m = f->obj_memory;
-    if (p >= &m->objs[0] &&
-        p <  &m->objs[NUM_OBJ_MEM]) {
-        return p - &m->objs[0];
+    int n = m->nchunks + nchunks;
+
+    m->chunks = realloc(m->chunks, n * sizeof(fobj_t *));
+    m->inuse_bitmap = realloc(m->inuse_bitmap, n * FOBJ_CHUNK_OBJS / 8);
+    m->next_free = realloc(m->next_free, n * FOBJ_CHUNK_OBJS * sizeof(int));
+    FASSERT(m->chunks && m->inuse_bitmap && m->next_free, "out of memory for fobjs");
+
+    for (int c = m->nchunks; c < n; c++) {
+        fobj_t *objs = calloc(FOBJ_CHUNK_OBJS, sizeof(fobj_t));
+        FASSERT(objs, "out of memory for fobjs");
+        m->chunks[c] = objs;
+        bzero(&m->inuse_bitmap[c * FOBJ_CHUNK_OBJS / 32], FOBJ_CHUNK_OBJS / 8);
+
+        /*
+         * Hand out the lowest indexes first.
+         */
+        for (int i = FOBJ_CHUNK_OBJS - 1; i >= 0; i--) {
+            objs[i].id = c * FOBJ_CHUNK_OBJS + i;
+            m->next_free[m->num_free_objs++] = objs[i].id;
+        }
     }
-    FASSERT(0, "Only 1024 objects currently supported");
-    return -1;
+
+    m->nchunks = n;
+    m->num_objs = n * FOBJ_CHUNK_OBJS;
+}
+
+static fobj_t *fobj_obj_mem_at(fenv_t *f, int id)
+{
+    return &f->obj_memory->chunks[id >> FOBJ_CHUNK_SHIFT][id & (FOBJ_CHUNK_OBJS - 1)];
 }
 
 static int fobj_obj_index_used(fenv_t *f, int idx)
@@ -57,18 +115,42 @@ static int fobj_obj_index_used(fenv_t *f, int idx)
 
 static int fobj_obj_mem_used(fenv_t *f, fobj_t *p)
 {
-    int i = fobj_obj_mem_index(f, p);
-    return fobj_obj_index_used(f, i);
+    ASSERT(p->id >= 0 && p->id < f->obj_memory->num_objs);
+    return fobj_obj_index_used(f, p->id);
+}
+
+/*
+ * fobj_marked()
+ *
+ * While collecting garbage: has p been reached yet?  Unlike
+ * fobj_obj_mem_used(), this only looks.
+ */
+int fobj_marked(fenv_t *f, fobj_t *p)
+{
+    int idx = p->id;
+
+    return (f->obj_memory->inuse_bitmap[idx >> 5] >> (idx & 31)) & 1;
 }
 
 static void fobj_obj_mem_init(fenv_t *f)
 {
     f->obj_memory = calloc(1, sizeof(*f->obj_memory));
+    fobj_obj_mem_grow(f, 1);
+}
+
+static void fobj_obj_mem_free(fenv_t *f)
+{
     fobj_mem_t *m = f->obj_memory;
-    m->num_free_objs = NUM_OBJ_MEM;
-    for (int i = 0; i < NUM_OBJ_MEM; i++) {
-        m->next_free[i] = NUM_OBJ_MEM - 1 - i;
+
+    for (int c = 0; c < m->nchunks; c++) {
+        free(m->chunks[c]);
     }
+    free(m->chunks);
+    free(m->inuse_bitmap);
+    free(m->next_free);
+    free(m->weak);
+    free(m);
+    f->obj_memory = NULL;
 }
 
 fenv_t *fenv_new(void)
@@ -76,10 +158,13 @@ fenv_t *fenv_new(void)
     fenv_t *f = calloc(1, sizeof(*f));
 
     fobj_obj_mem_init(f);
+    fstr_intern_init(f);
+    fout_init(f);
 
     f->hold_stack = fstack_new(f);
     f->dstack = fstack_new(f);
     f->rstack = fstack_new(f);
+    f->empty_shape = fshape_new(f, NULL, NULL);
     f->words  = ftable_new(f);
 
     fobj_hold_clear(f);
@@ -95,16 +180,20 @@ void fenv_free(fenv_t *f)
     f->running = NULL;
     f->words = NULL;
     f->new_words = NULL;
+    f->empty_shape = NULL;
     f->imm_words = NULL;
     f->input_str = NULL;
     f->current_compiling = NULL;
 
     fobj_garbage_collection(f);
 #ifdef DEBUG
-    for (int i = 0; i < NUM_OBJ_MEM/32; i++) {
+    for (int i = 0; i < f->obj_memory->num_objs / 32; i++) {
         ASSERT(f->obj_memory->inuse_bitmap[i] == 0);
     }
 #endif
+    fstr_intern_free(f);
+    fout_free(f);
+    fobj_obj_mem_free(f);
 }
 
 #if DEBUG_MISSING_OBJECTS
@@ -117,13 +206,14 @@ void fobj_find(fenv_t *f, fobj_t *p)
     fobj_foundp = NULL;
     fobj_mem_t *m = f->obj_memory;
 
-    bzero(m->inuse_bitmap, NUM_OBJ_MEM/8);
+    bzero(m->inuse_bitmap, m->num_objs / 8);
 
     fobj_visit(f, f->dstack);
     fobj_visit(f, f->rstack);
     fobj_visit(f, f->current_compiling); // during colon definitions
     fobj_visit(f, f->new_words);
     fobj_visit(f, f->words);
+    fobj_visit(f, f->empty_shape);
     fobj_visit(f, f->input_str);
     fobj_visit(f, f->running);
     fobj_visit(f, f->hold_stack);
@@ -134,8 +224,13 @@ void fobj_find(fenv_t *f, fobj_t *p)
 
 fobj_t *fobj_new(fenv_t *f, int type)
 {
-    if (f->obj_memory->num_free_objs == 0) {
+    fobj_mem_t *m = f->obj_memory;
+
+    if (m->num_free_objs == 0) {
         fobj_garbage_collection(f);
+        if (m->num_free_objs < m->num_objs / 4) {
+            fobj_obj_mem_grow(f, (m->nchunks + 1) / 2);
+        }
     }
 
 #ifdef DEBUG
@@ -148,23 +243,11 @@ fobj_t *fobj_new(fenv_t *f, int type)
     }
 #endif /* DEBUG */
 
-    fobj_mem_t *m = f->obj_memory;
-
-#if DEBUG_MISSING_OBJECTS
-    if (m->num_free_objs == 0) {
-        for (int idx = 0; idx < NUM_OBJ_MEM; idx ++) {
-            fobj_find(f, &m->objs[idx]);
-        }
-    }
-#endif /* DEBUG_MISSING_OBJECTS */
-
     FASSERT(m->num_free_objs > 0, "out of memory allocating a new fobj");
 
     int i = --(m->num_free_objs);
-    int pi = m->next_free[i];
-    m->next_free[i] = 0;
-    fobj_t *p = &m->objs[pi];
-    
+    fobj_t *p = fobj_obj_mem_at(f, m->next_free[i]);
+
     p->type = type;
 
     int r = fobj_obj_mem_used(f, p);
@@ -193,28 +276,93 @@ void fobj_visit(fenv_t *f, fobj_t *p)
     }
 }
 
+/*
+ * Weak hashes
+ *
+ * A hash can hold its keys, its values or both weakly (see fhash.c): it
+ * doesn't keep them alive, and once one is collected its pair goes.
+ * Only objects which are equal just to themselves are held weakly;
+ * numbers and strings can always be made again, so they are held as
+ * usual, as in Lua.
+ *
+ * Marking doesn't go through what a weak hash holds weakly, but notes
+ * the hash with fobj_weak_note().  Once the roots have been marked the
+ * noted hashes are traced until nothing more is marked: a pair with a
+ * weak key keeps its value only while the key is reached some other
+ * way (an ephemeron), and marking that value can reach further keys.
+ * Then the pairs with an unmarked weak key or value are taken out, all
+ * before the sweep frees them.
+ *
+ * Shapes are noted the same way, for their children (see fshape.c);
+ * they have nothing to trace, and just lose the unmarked ones.
+ */
+int fobj_held_weakly(fobj_t *p)
+{
+    return p && !op_table[p->type].equal;
+}
+
+void fobj_weak_note(fenv_t *f, fobj_t *p)
+{
+    fobj_mem_t *m = f->obj_memory;
+
+    if (m->num_weak == m->cap_weak) {
+        m->cap_weak = m->cap_weak ? 2 * m->cap_weak : 16;
+        m->weak = realloc(m->weak, m->cap_weak * sizeof(fobj_t *));
+        FASSERT(m->weak, "out of memory for weak hashes");
+    }
+    m->weak[m->num_weak++] = p;
+}
+
+static void fobj_weak_clear(fenv_t *f)
+{
+    fobj_mem_t *m = f->obj_memory;
+    int traced;
+
+    do {
+        traced = 0;
+        for (int i = 0; i < m->num_weak; i++) {  // num_weak can grow
+            if (m->weak[i]->type == FOBJ_HASH) {
+                traced |= fhash_weak_trace(f, m->weak[i]);
+            }
+        }
+    } while (traced);
+
+    for (int i = 0; i < m->num_weak; i++) {
+        if (m->weak[i]->type == FOBJ_HASH) {
+            fhash_weak_clear(f, m->weak[i]);
+        } else {
+            fshape_weak_clear(f, m->weak[i]);
+        }
+    }
+    m->num_weak = 0;
+}
+
 void fobj_garbage_collection(fenv_t *f)
 {
     // Copy the in-use bitmap
     // visit f->dstack and f->rstack
     // Determine which objects are no longer used and call their free routine
-    uint32_t copy_inuse_bitmap[NUM_OBJ_MEM / 32];
-    int n = NUM_OBJ_MEM / 32;
     fobj_mem_t *m = f->obj_memory;
-    int nbytes = sizeof(m->inuse_bitmap);
+    int n = m->num_objs / 32;
+    int nbytes = m->num_objs / 8;
+    uint32_t *copy_inuse_bitmap = malloc(nbytes);
 
     bcopy(m->inuse_bitmap, copy_inuse_bitmap, nbytes);
     bzero(m->inuse_bitmap, nbytes);
+    m->num_weak = 0;
 
     fobj_visit(f, f->dstack);
     fobj_visit(f, f->rstack);
     fobj_visit(f, f->current_compiling); // during colon definitions
     fobj_visit(f, f->new_words);
     fobj_visit(f, f->words);
+    fobj_visit(f, f->empty_shape);
     fobj_visit(f, f->input_str);
     fobj_visit(f, f->running);
     fobj_visit(f, f->hold_stack);
 
+    fobj_weak_clear(f);
+
     for (int i = 0; i < n; i++) {
         /*
          * free will have bits set for items which the allocator had
@@ -232,7 +380,7 @@ void fobj_garbage_collection(fenv_t *f)
             continue;
         }
 
-        fobj_t *p = &m->objs[i * 32];
+        fobj_t *p = fobj_obj_mem_at(f, i * 32);
         for (uint32_t bit = 1; free && bit; bit <<= 1, p++) {
             if (!(free & bit)) {
                 continue;
@@ -242,13 +390,15 @@ void fobj_garbage_collection(fenv_t *f)
             if (op_table[p->type].free) {
                 op_table[p->type].free(f, p);
             }
+            int id = p->id;
             bzero(p, sizeof(*p));
-            
-            int j = m->num_free_objs++;
-            int pj = p - &m->objs[0];
-            m->next_free[j] = pj;
+            p->id = id;
+
+            m->next_free[m->num_free_objs++] = id;
         }
     }
+
+    free(copy_inuse_bitmap);
 }
 
 fobj_t *fobj_hold(fenv_t *f, fobj_t *p)
@@ -274,16 +424,36 @@ void fobj_hold_clear(fenv_t *f)
     f->hold_stack->u.stack.sp = 0;
 }
 
+/*
+ * fobj_hold_mark() and fobj_hold_release()
+ *
+ * Words written in C which call back into Forth (or which allocate in a
+ * loop) use these to drop the objects held since the mark without also
+ * dropping the objects their callers are holding.
+ */
+
+int fobj_hold_mark(fenv_t *f)
+{
+    return f->hold_stack->u.stack.sp;
+}
+
+void fobj_hold_release(fenv_t *f, int mark)
+{
+    if (f->hold_stack->u.stack.sp > mark) {
+        f->hold_stack->u.stack.sp = mark;
+    }
+}
+
 void fobj_print(fenv_t *f, fobj_t *p)
 {
     if (!p) {
-        printf("(null)");
+        fout_printf(f, "(null)");
     } else {
         ASSERT(p->type > 0);
         ASSERT(op_table[p->type].print);
 
 #ifdef DEBUG
-        printf("Object %p: type = %d\n", p, p->type);
+        fout_printf(f, "Object %p: type = %d\n", p, p->type);
 #endif
         op_table[p->type].print(f, p);
     }
@@ -332,17 +502,43 @@ int fobj_cmp(fenv_t *f, fobj_t *a, fobj_t *b)
     }
 }
 
-int fobj_hash(fenv_t *f, fobj_t *a)
+/*
+ * fobj_hash() and fobj_equal()
+ *
+ * Hash and compare objects used as keys, through the type's hash and
+ * equal hooks.  Types without them (words, tables and so on) are keys by
+ * identity.
+ */
+uint64_t fobj_hash_mix(uint64_t x)
 {
-    int hash = 0;
-    int entropy = a->type | a->type << 4;
-    unsigned char *p = (unsigned char *) a;
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
 
-    for (int i = 0; i < sizeof(fobj_t *); i++) {
-        hash += (hash << 3) + (p[i] ^ entropy);
+uint64_t fobj_hash(fenv_t *f, fobj_t *a)
+{
+    if (!a) {
+        return 0;
+    }
+    if (op_table[a->type].hash) {
+        return op_table[a->type].hash(f, a);
     }
+    return fobj_hash_mix((uintptr_t) a);
+}
 
-    return hash;
+int fobj_equal(fenv_t *f, fobj_t *a, fobj_t *b)
+{
+    if (a == b) {
+        return 1;
+    }
+    if (!a || !b || a->type != b->type || !op_table[a->type].equal) {
+        return 0;
+    }
+    return op_table[a->type].equal(f, a, b);
 }
 
 fobj_t *findex_new(fenv_t *f, fobj_t *addr, fobj_t *index)
@@ -380,3 +576,8 @@ fobj_t *fstate_new(fenv_t *f, int state, int offset)
     s->offset = offset;
     return p;
 }
+
+void floop_visit(fenv_t *f, fobj_t *p)
+{
+    fobj_visit(f, p->u.loop.iter);
+}
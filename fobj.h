@@ -16,18 +16,50 @@ typedef struct fhash_s fhash_t;
 typedef struct fstack_s fstack_t;
 typedef struct fcall_s fcall_t;
 typedef struct fstate_s fstate_t;
+typedef struct fbtree_s fbtree_t;
+typedef struct fbtree_node_s fbtree_node_t;
+typedef struct fptable_s fptable_t;
+typedef struct fpnode_s fpnode_t;
+typedef struct fshape_s fshape_t;
+typedef struct fbytes_s fbytes_t;
+typedef struct fseq_s fseq_t;
+typedef struct fseq_range_s fseq_range_t;
+typedef struct fiter_s fiter_t;
+typedef struct fmemo_s fmemo_t;
+typedef struct fmemo_entry_s fmemo_entry_t;
+typedef struct fmemo_state_s fmemo_state_t;
+typedef struct fregex_s fregex_t;
+typedef struct fre_s fre_t;
+typedef struct fcsv_s fcsv_t;
+typedef struct fcsv_state_s fcsv_state_t;
 
 struct fnum_s {
     fnumber_t		n;
 };
 
+#define FSTR_SMALL		16		// Strings shorter than this are stored inline
+
 struct fstr_s {
     int			len;
-    char		*buf;
+    unsigned	 interned : 1;
+    unsigned	 hashed : 1;	// hash is valid
+    unsigned	 builder : 1;	// buf is a builder buffer (see fstr.c)
+    unsigned	 ic_slot : 8;	// Slot of this key in ic_shape (see fshape.c)
+    char		*buf;			// small, malloc'ed or in owner's buffer
+    uint64_t	 hash;
+    fobj_t		*ic_shape;		// Shape this key name was last found in
+    union {
+        char	 small[FSTR_SMALL];	// When buf is small
+        struct {
+            fobj_t	*owner;		// Set if buf is another string's buffer
+            char	*cstr;		// A NUL terminated copy (see fstr_cstr())
+        } ref;
+    } u;
 };
 
 struct farray_s {
     int			 num;
+    int			 cap;			// Room in elems
     fobj_t		**elems;
 };
 
@@ -39,12 +71,87 @@ struct fstack_s {
 
 struct fhash_s {
     int			 num_kv;
+    int			 cap_kv;		// Pairs keys_values has room for
+    int			 nslots;		// The index (see fhash.c)
+    int			 weak;			// FHASH_WEAK_KEYS, FHASH_WEAK_VALUES
     fobj_t		**keys_values;
+    fobj_t		*shape;
+    fobj_t		**slots;
+    int			*index;			// Followed by the control bytes
+};
+
+#define FHASH_WEAK_KEYS		1
+#define FHASH_WEAK_VALUES	2
+
+struct fshape_s {
+    fobj_t		*parent;
+    fobj_t		*key;
+    fobj_t		**keys;
+    fobj_t		**trans;		// Children by key hash (see fshape.c)
+    int			 nkeys;
+    int			 ntrans;
+    int			 cap_trans;
+};
+
+struct fbtree_s {
+    int			 num;
+    fbtree_node_t	*root;
+};
+
+struct fptable_s {
+    fobj_t		*root;
+    int			 num;
+};
+
+struct fpnode_s {
+    uint32_t	 datamap;
+    uint32_t	 nodemap;
+    int			 collision;
+    int			 len;
+    fobj_t		**slots;
+};
+
+struct fbytes_s {
+    unsigned char	*base;
+    size_t		 len;
+    int			 owned;			// free(base) when collected
+    int			 big_endian;
+    fobj_t		*parent;		// Set for views
+};
+
+struct fseq_s {
+    int			 kind;			// FSEQ_RANGE, etc.
+    fseq_range_t	*range;			// A range's bounds (see fseq.c)
+    fobj_t		*src;			// Source seq, or a generator's initial state
+    fobj_t		*xt;
+};
+
+struct fiter_s {
+    fobj_t		*seq;
+    fnumber_t		 pos;			// Next value of a range
+    fobj_t		*src;			// Iterator on the source seq
+    fobj_t		*state;			// A generator's current state
+};
+
+struct fmemo_s {
+    fobj_t		*xt;			// The word's original code
+    fmemo_state_t	*st;			// Entries and counts (see fmemo.c)
+};
+
+struct fregex_s {
+    fobj_t		*pattern;
+    fre_t		*re;			// Parsed pattern and its DFAs (see fregex.c)
+};
+
+struct fcsv_s {
+    fobj_t		*src;			// The file's path, or the string being read
+    fcsv_state_t	*st;			// Buffer and position (see fcsv.c)
 };
 
 struct ftable_s {
     fobj_t		*array;
     fobj_t		*hash;
+    int			 hash_nums;		// Number keys in hash (see ftable.c)
 };
 
 struct findex_s {
@@ -78,10 +185,14 @@ struct fstate_s {
 struct floop_s {
     int				 limit;
     int				 index;
+    fobj_t			*iter;			// Set for each ... next loops: an iter or a container
+    int				 cursor;		// Where in the container
+    int				 what;			// What to push for each element
 };
 
 struct fobj_s {
     int				 type;
+    int				 id;			// Index in the object memory (see fobj.c)
     union {
         fnum_t		 num;
         fstr_t		 str;
@@ -94,6 +205,16 @@ struct fobj_s {
         fcall_t		 call;
         fstate_t	 state;
         floop_t		 loop;
+        fbtree_t	 btree;
+        fptable_t	 ptable;
+        fpnode_t	 pnode;
+        fshape_t	 shape;
+        fbytes_t	 bytes;
+        fseq_t		 seq;
+        fiter_t		 iter;
+        fmemo_t		 memo;
+        fregex_t	 regex;
+        fcsv_t		 csv;
     } u;
 };
 
@@ -111,6 +232,12 @@ typedef struct foptable_s {
 
     fobj_t *(*add)(fenv_t *f, fobj_t *op1, fobj_t *op2);
     fobj_t *(*sub)(fenv_t *f, fobj_t *op1, fobj_t *op2);
+
+    /*
+     * Keys: types without these are keys by identity.
+     */
+    uint64_t (*hash)(fenv_t *f, fobj_t *p);
+    int     (*equal)(fenv_t *f, fobj_t *a, fobj_t *b);
 } foptable_t;
 
 extern const foptable_t op_table[];
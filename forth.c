@@ -6,6 +6,7 @@
  */
 
 #include "forth.h"
+#include <time.h>
 
 void zzz(void)
 {
@@ -44,8 +45,115 @@ static void forth_test_string(const char *string)
     printf("\n");
 }
 
+/*
+ * forth_bench_string()
+ *
+ * Run setup and then time string in the same environment.
+ */
+static void forth_bench_string(const char *name, const char *setup, const char *string)
+{
+    fenv_t *f = fenv_new();
+    fcode_init(f);
+    fcode_compile_string(f, setup);
+
+    clock_t start = clock();
+    fcode_compile_string(f, string);
+    clock_t end = clock();
+
+    fenv_free(f);
+    printf("\n%-32s %8.3f s\n", name, (double) (end - start) / CLOCKS_PER_SEC);
+}
+
+/*
+ * forth -b runs the benchmarks instead of the tests.
+ */
+static void forth_bench(void)
+{
+    const char *mem256 = "268435456 bytes constant mem  mem 0 fill ";
+
+    forth_bench_string("256MB search", mem256,
+                       "8 bytes constant pat  pat 255 fill  mem 268435448 8 view 255 fill "
+                       "mem pat search .");
+    forth_bench_string("256MB count-byte", mem256, "mem 0 count-byte .");
+    forth_bench_string("256MB regex count", mem256,
+                       "mem str\" r[0-9]+, #0x[0-9a-f]+\" regex re-count .");
+    forth_bench_string("256MB mismatch",
+                       "268435456 bytes constant a  a 0 fill  268435456 bytes constant b  b 0 fill "
+                       "1 b 268435455 c!",
+                       "a b mismatch .");
+    forth_bench_string("1M short string +", "",
+                       ": t 1000000 0 do str\" abc\" str\" def\" + drop loop ; t");
+    forth_bench_string("100K format lines", "",
+                       ": t 100000 0 do i str\" ldr\" i 3 * "
+                       "str\" pc=%08x insn=%-5s r%d\" format drop loop ; t");
+    forth_bench_string("100K hash keys: insert, look up", "{} constant h",
+                       ": ins 100000 0 do i h i str\" k%d\" format ] ! loop ; "
+                       ": look 0 100000 0 do h i str\" k%d\" format ] @ + loop ; "
+                       "ins look .");
+    forth_bench_string("200K records with distinct keys", "",
+                       ": t 200000 0 do {} 1 over i str\" k%d\" format ] ! drop loop ; t");
+    forth_bench_string("100K address keys in a hash", "hash constant h",
+                       ": ins 100000 0 do i h i 4 * 2147483648 + ] ! loop ; "
+                       ": look 0 100000 0 do h i 4 * 2147483648 + ] @ + loop ; "
+                       "ins look .");
+    forth_bench_string("Fill a 1M element table", "",
+                       ": t {} 1000000 0 do i over i ] ! loop drop ; t");
+    forth_bench_string("Fill a presized 1M element table", "",
+                       ": t 1000000 {}n 1000000 0 do i over i ] ! loop drop ; t");
+    forth_bench_string("Sort a 1M number table", "1000000 {}n constant t "
+                       ": fl 1000000 0 do i 1021 * 12345 + 1048575 and t i ] ! loop ; fl",
+                       "t sort drop");
+    forth_bench_string("Sort a 100K table by a word", "100000 {}n constant t "
+                       ": fl 100000 0 do i 1021 * 12345 + 1048575 and t i ] ! loop ; fl",
+                       "t ' < sort-by drop");
+    forth_bench_string("1M table to binary and back", "1000000 {}n constant t "
+                       ": fl 1000000 0 do i 3 * t i ] ! loop ; fl",
+                       "t >binary binary> drop");
+    forth_bench_string("1M table to JSON and back", "1000000 {}n constant t "
+                       ": fl 1000000 0 do i 3 * t i ] ! loop ; fl",
+                       "t >json json> drop");
+    forth_bench_string("Walk a 1M element table", "1000000 {}n constant t "
+                       ": fl 1000000 0 do i t i ] ! loop ; fl",
+                       ": walk t each drop next ; walk");
+    forth_bench_string("100K sparse keys in a table", "{} constant t",
+                       ": ins 100000 0 do i t i 4096 * ] ! loop ; "
+                       ": look 0 100000 0 do t i 4096 * ] @ + loop ; "
+                       "ins look .  t @ .");
+    forth_bench_string("Read a 1M line CSV in batches",
+                       ": line dup 4 * 32768 + swap 7 and str\" 0x%x,ldr,%d,2.5\n\" format ; "
+                       ": gen str\" \" 1000000 0 do i line + loop ; gen csv-string constant c",
+                       ": rd 0 begin c csv-rows while @ + repeat ; rd drop");
+    forth_bench_string("Churn 1M entries in a weak cache", "{} weak-values constant c",
+                       ": t 1000000 0 do {} c i ] ! loop ; t");
+    forth_bench_string("5M empty do loops", "",
+                       ": t 5000000 0 do loop ; t");
+    forth_bench_string("5M loops of stack words", "",
+                       ": t 5000000 0 do 1 dup swap over drop drop drop loop ; t");
+    forth_bench_string("5M loops summing i", "",
+                       ": t 0 5000000 0 do i + loop ; t drop");
+    forth_bench_string("5M calls to a colon word", ": inc 1 + ;",
+                       ": t 0 5000000 0 do inc loop ; t drop");
+    forth_bench_string("Build a 200KB string with +", "",
+                       ": t str\" \" 200000 0 do str\" x\" + loop drop ; t");
+
+    const char *phrase = "dup swap over drop drop ";
+    int n = 50000;
+    char *script = malloc(n * strlen(phrase) + 1);
+    script[0] = 0;
+    for (int i = 0; i < n; i++) {
+        strcat(script + i * strlen(phrase), phrase);
+    }
+    forth_bench_string("Compile 250K tokens", "1 2", script);
+    free(script);
+}
+
 int main(int argc, char *argv[])
 {
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        forth_bench();
+        return 0;
+    }
+
     forth_test_string("5 begin 1 - dup while dup . repeat 13 emit");
     forth_test_string("1.25 2 1.5 + + .");
     forth_test_string("{} constant arr   10 arr 1 ] !   20 arr 2 ] !  arr 1 ] @ .  arr 2 ] @ .  arr 3 ] @ .");
@@ -78,5 +186,76 @@ int main(int argc, char *argv[])
                       "      then "
                       "   loop ; "
                       " primes .");
+    forth_test_string("btree constant syms "
+                      "str\" reset\" syms 0 ] !  str\" main\" syms 256 ] !  str\" irq\" syms 1024 ] ! "
+                      "syms 300 floor . .  syms 300 ceiling . . "
+                      ": sym. swap . . ; "
+                      "syms 0 1000 ' sym. range-each");
+    forth_test_string("ptable constant regs "
+                      "1 regs str\" r0\" ] !  2 regs str\" r1\" ] ! "
+                      "regs snapshot constant step1 "
+                      "99 regs str\" r0\" ] ! "
+                      "regs str\" r0\" ] @ .  step1 str\" r0\" ] @ .  step1 @ .");
+    forth_test_string("64 bytes constant ram "
+                      "305419896 ram 0 l!  ram 0 c@ .  ram 1 w@ .  ram 4 8 view big-endian "
+                      "dup 258 swap 0 w! ram 4 c@ . ram 5 c@ .");
+    forth_test_string("100 bytes constant buf  buf 7 fill  3 buf 40 c!  5 buf 41 c!  buf 7 count-byte . "
+                      "2 bytes constant pat  3 pat 0 c!  5 pat 1 c!  buf pat search . "
+                      "9 pat 1 c!  buf pat search .  2 bytes constant mask  255 mask 0 c! "
+                      "buf pat mask search-masked . "
+                      "buf 0 40 view buf 0 42 view compare .  buf 0 40 view buf 0 42 view mismatch . "
+                      "buf pat mismatch .");
+    forth_test_string(": odd? 1 and ; : sq dup * ; "
+                      ": countdown dup if dup 1 - swap -1 else drop 0 then ; "
+                      "0 10 range ' odd? filter ' sq map each . next "
+                      "0 1000000 range sum . "
+                      "3 ' countdown generator each . next");
+    forth_test_string(": decode dup 4 >> swap 15 and ; "
+                      "' decode 1 16 memoize "
+                      ": run 64 0 do i 7 and decode 2drop loop ; run "
+                      "' decode memo-stats . .");
+    forth_test_string("str\" [  12] pc=0x8000 insn=ldr  \" trim constant line "
+                      "line str\" pc=\" find . "
+                      "line str\"  \" split 3 ] @ 3 6 substr . "
+                      "line str\" [\" starts-with? . "
+                      "line str\" ldr\" str\" str\" replace .");
+    forth_test_string("str\" r[0-9]+\" regex constant reg "
+                      "str\" ldr r1, [r12, #4]\" constant insn "
+                      "insn reg re-search . .  insn reg re-count . "
+                      "insn reg re-all 1 ] @ . "
+                      "str\" 0x8000\" str\" ^0x[0-9a-f]{4,8}$\" regex re-match? .");
+    forth_test_string("32768 str\" ldr\" 12 3.14159 "
+                      "str\" pc=%08x insn=%-5s| r%-2d pi=%.3f\" format. "
+                      "255 str\" done\" str\"  [%4X] %s\" format dup . . ");
+    forth_test_string("hash constant annots "
+                      "str\" reset\" annots 0 ] !  str\" irq\" annots 24 ] !  str\" kernel\" annots 3221225472 ] ! "
+                      "1 annots ' dup ] ! "
+                      "annots 24 ] @ .  annots 3221225472 ] @ .  annots ' dup ] @ .  annots 28 ] @ .");
+    forth_test_string("64 {}n constant regs  : init 16 0 do 0 regs i ] ! loop ; init "
+                      "regs 48 reserve  regs shrink-to-fit  regs 15 ] @ .");
+    forth_test_string("{} constant mem  7 mem 1000000 ] !  -1 mem -4 ] !  3 mem 0.5 ] ! "
+                      ": fl 8 0 do i mem i ] ! loop ; fl "
+                      "mem @ .  mem 1000000 ] @ .  mem -4 ] @ .  mem 0.5 ] @ .  mem 7 ] @ .");
+    forth_test_string("{} constant regs  16 regs 0 ] !  17 regs 1 ] !  -1 regs str\" pc\" ] ! "
+                      ": dump regs each-kv swap . . next ; dump "
+                      ": names regs keys . next ; names  : total 0 regs values + next ; total .");
+    forth_test_string("{} constant pcs  32772 pcs 0 ] !  32768 pcs 1 ] !  32776 pcs 2 ] ! "
+                      "pcs sort each . next  pcs ' < sort-by drop "
+                      ": rel 32768 - ; pcs ' rel map each . next "
+                      ": word? 3 and if 0 else -1 then ; pcs ' word? filter 0 ' + reduce .");
+    forth_test_string("{} constant run  str\" boot\" run str\" name\" ] !  {} constant pcs "
+                      "32768 pcs 0 ] !  32772 pcs 1 ] !  pcs run str\" pcs\" ] !  pcs run str\" hot\" ] ! "
+                      "run >json .  run >binary binary> constant run2 "
+                      "1 run2 str\" pcs\" ] @ 0 ] !  run2 str\" hot\" ] @ 0 ] @ .");
+    forth_test_string("{} constant nums  18446744071562073653 nums 0 ] !  18446744073709551615 nums 1 ] ! "
+                      "0.1 nums 2 ] !  -2.5e-300 nums 3 ] !  -9223372036854775808 nums 4 ] ! "
+                      ": same 5 0 do nums i ] @ over i ] @ - . loop drop ; "
+                      "nums >binary binary> same  nums >json dup . json> same");
+    forth_test_string("str\" pc,insn,cycles\n0x8000,ldr,3\n0x8004,b,1\n\" csv-string constant tr "
+                      "tr csv-row drop 1 ] @ .  tr csv-columns drop constant cols "
+                      "cols 0 ] @ 1 ] @ .  cols 1 ] @ each . next  cols 2 ] @ 0 ' + reduce .");
+    forth_test_string("{} weak-values constant cache  {} constant live "
+                      "{} 42 over 0 ] ! dup live 0 ] !  cache str\" hot\" ] !  {} cache str\" cold\" ] ! "
+                      ": entries 0 cache keys drop 1 + next ;  gc entries .  cache str\" hot\" ] @ 0 ] @ .");
     return 0;
 }
@@ -34,7 +34,17 @@
 #define FOBJ_CALL		9
 #define FOBJ_STATE		10
 #define FOBJ_LOOP		11
-#define FOBJ_NUM_TYPES	12
+#define FOBJ_BTREE		12
+#define FOBJ_PTABLE		13
+#define FOBJ_PNODE		14
+#define FOBJ_SHAPE		15
+#define FOBJ_BYTES		16
+#define FOBJ_SEQ		17
+#define FOBJ_ITER		18
+#define FOBJ_MEMO		19
+#define FOBJ_REGEX		20
+#define FOBJ_CSV		21
+#define FOBJ_NUM_TYPES	22
 
 typedef long double fnumber_t;
 typedef int32_t fint_t;
@@ -46,6 +56,8 @@ typedef struct fobj_mem_s fobj_mem_t;
 typedef struct fenv_s fenv_t;
 typedef struct fword_s fword_t;
 typedef struct floop_s floop_t;
+typedef struct fintern_s fintern_t;
+typedef struct fout_s fout_t;
 
 typedef void (*fcode_t)(fenv_t *f, fobj_t *w);
 typedef struct fbody_s fbody_t;
@@ -58,6 +70,9 @@ struct fenv_s {
     fobj_t			*imm_words;
 
     fobj_t			*new_words;
+    fobj_t			*empty_shape;
+    fintern_t		*intern;
+    fout_t			*out;
 
     fobj_t			*input_str;
     int				 input_offset;
@@ -94,6 +109,9 @@ void forth_runtime_assert(fenv_t *f, const char *fmt, ...);
  */
 
 void fobj_garbage_collection(fenv_t *f);
+int  fobj_marked(fenv_t *f, fobj_t *p);
+int  fobj_held_weakly(fobj_t *p);
+void fobj_weak_note(fenv_t *f, fobj_t *p);
 
 #define HOLD(p)				fobj_hold(f, p)
 #define HOLD1(p)			fobj_hold(f, p)
@@ -113,22 +131,43 @@ fobj_t *fobj_sub(fenv_t *f, fobj_t *op1, fobj_t *op2);
 fobj_t *fobj_fetch(fenv_t *f, fobj_t *addr, fobj_t *index);
 void    fobj_store(fenv_t *f, fobj_t *addr, fobj_t *index, fobj_t *data);
 int     fobj_cmp(fenv_t *f, fobj_t *a, fobj_t *b);
+uint64_t fobj_hash(fenv_t *f, fobj_t *a);
+uint64_t fobj_hash_mix(uint64_t x);
+int     fobj_equal(fenv_t *f, fobj_t *a, fobj_t *b);
 int     fobj_is_index(fenv_t *f, fobj_t *obj);
 
 fobj_t *fobj_hold(fenv_t *f, fobj_t *p);
 void    fobj_hold_n(fenv_t *f, int n, ...);
 void    fobj_hold_clear(fenv_t *f);
+int     fobj_hold_mark(fenv_t *f);
+void    fobj_hold_release(fenv_t *f, int mark);
 
 fobj_t *fnum_new(fenv_t *f, fnumber_t n);
 void    fnum_print(fenv_t *f, fobj_t *p);
 int     fnum_cmp(fenv_t *f, fobj_t *a, fobj_t *b);
 fobj_t *fnum_add(fenv_t *f, fobj_t *op1, fobj_t *op2);
 fobj_t *fnum_sub(fenv_t *f, fobj_t *op1, fobj_t *op2);
+uint64_t fnum_to_u64(fenv_t *f, fnumber_t n);
+uint64_t fnum_hash(fenv_t *f, fobj_t *p);
+int     fnum_equal(fenv_t *f, fobj_t *a, fobj_t *b);
 
 fobj_t *fstr_new(fenv_t *f, const char *str);
+fobj_t *fstr_alloc(fenv_t *f, int len);
 fobj_t *fstr_new_buf(fenv_t *f, const char *buf, int len);
+fobj_t *fstr_intern(fenv_t *f, const char *str);
+fobj_t *fstr_intern_buf(fenv_t *f, const char *buf, int len);
+fobj_t *fstr_intern_str(fenv_t *f, fobj_t *p);
+fobj_t *fstr_intern_find(fenv_t *f, const char *buf, int len);
+fobj_t *fstr_slice(fenv_t *f, fobj_t *parent, int offset, int len);
+void    fstr_intern_init(fenv_t *f);
+void    fstr_intern_free(fenv_t *f);
+int     fstr_equal(fenv_t *f, fobj_t *a, fobj_t *b);
+uint64_t fstr_hash(fenv_t *f, fobj_t *p);
+void    fstr_visit(fenv_t *f, fobj_t *p);
 void    fstr_free(fenv_t *f, fobj_t *p);
 void    fstr_print(fenv_t *f, fobj_t *p);
+char   *fstr_cstr(fenv_t *f, fobj_t *p);
+fobj_t *fstr_buf_owner(fenv_t *f, fobj_t *p);
 int     fstr_cmp(fenv_t *f, fobj_t *a, fobj_t *b);
 fobj_t *fstr_add(fenv_t *f, fobj_t *op1, fobj_t *op2);
 fobj_t *fstr_sub(fenv_t *f, fobj_t *op1, fobj_t *op2);
@@ -136,6 +175,13 @@ fobj_t *fstr_fetch(fenv_t *f, fobj_t *addr, fobj_t *index);
 int     fstr_len(fenv_t *f, fobj_t *str);
 int     fstr_getchar(fenv_t *f, fobj_t *str, int offset);
 fnumber_t fstr_to_number(fenv_t *f, fobj_t *str);
+fobj_t *fstr_substr(fenv_t *f, fobj_t *p, int start, int len);
+int     fstr_find(fenv_t *f, fobj_t *p, fobj_t *needle);
+int     fstr_rfind(fenv_t *f, fobj_t *p, fobj_t *needle);
+int     fstr_starts_with(fenv_t *f, fobj_t *p, fobj_t *prefix);
+fobj_t *fstr_split(fenv_t *f, fobj_t *p, fobj_t *sep);
+fobj_t *fstr_trim(fenv_t *f, fobj_t *p);
+fobj_t *fstr_replace(fenv_t *f, fobj_t *p, fobj_t *old, fobj_t *new);
 
 fobj_t *ftable_new(fenv_t *f);
 void    ftable_visit(fenv_t *f, fobj_t *p);
@@ -145,6 +191,8 @@ fobj_t *ftable_add(fenv_t *f, fobj_t *op1, fobj_t *op2);
 fobj_t *ftable_sub(fenv_t *f, fobj_t *op1, fobj_t *op2);
 fobj_t *ftable_fetch(fenv_t *f, fobj_t *addr, fobj_t *index);
 void    ftable_store(fenv_t *f, fobj_t *addr, fobj_t *index, fobj_t *data);
+int     ftable_next(fenv_t *f, fobj_t *p, int *cursor, fobj_t **key, fobj_t **val);
+void    ftable_set_weak(fenv_t *f, fobj_t *p, int weak);
 void    ftable_push(fenv_t *f, fobj_t *stack, fobj_t *data);
 fobj_t *ftable_pop(fenv_t *f, fobj_t *stack);
 
@@ -154,6 +202,10 @@ void    farray_free(fenv_t *f, fobj_t *a);
 void    farray_print(fenv_t *f, fobj_t *a);
 void    farray_store(fenv_t *f, fobj_t *addr, fobj_t *index, fobj_t *data);
 fobj_t *farray_fetch(fenv_t *f, fobj_t *addr, fobj_t *index);
+void    farray_reserve(fenv_t *f, fobj_t *p, int n);
+void    farray_resize(fenv_t *f, fobj_t *p, int n);
+int     farray_next(fenv_t *f, fobj_t *p, int *cursor, fobj_t **val);
+void    farray_shrink(fenv_t *f, fobj_t *p);
 
 fobj_t *fstack_new(fenv_t *f);
 void    fstack_visit(fenv_t *f, fobj_t *a);
@@ -168,9 +220,136 @@ void    fhash_free(fenv_t *f, fobj_t *a);
 void    fhash_print(fenv_t *f, fobj_t *a);
 void    fhash_store(fenv_t *f, fobj_t *addr, fobj_t *index, fobj_t *data);
 fobj_t *fhash_fetch(fenv_t *f, fobj_t *addr, fobj_t *index);
+int     fhash_count(fenv_t *f, fobj_t *p);
+fobj_t *fhash_key_at(fenv_t *f, fobj_t *p, int i);
+fobj_t *fhash_val_at(fenv_t *f, fobj_t *p, int i);
+int     fhash_has(fenv_t *f, fobj_t *p, fobj_t *key);
+int     fhash_next(fenv_t *f, fobj_t *p, int *cursor, fobj_t **key, fobj_t **val);
+int     fhash_remove_if(fenv_t *f, fobj_t *p,
+                        int (*drop)(fenv_t *f, fobj_t *key, fobj_t *val, void *arg), void *arg);
+void    fhash_reserve(fenv_t *f, fobj_t *p, int n);
+void    fhash_shrink(fenv_t *f, fobj_t *p);
+void    fhash_set_weak(fenv_t *f, fobj_t *p, int weak);
+int     fhash_weak_trace(fenv_t *f, fobj_t *p);
+void    fhash_weak_clear(fenv_t *f, fobj_t *p);
+
+fobj_t *fshape_new(fenv_t *f, fobj_t *parent, fobj_t *key);
+void    fshape_visit(fenv_t *f, fobj_t *p);
+void    fshape_free(fenv_t *f, fobj_t *p);
+fobj_t *fshape_add_key(fenv_t *f, fobj_t *shape, fobj_t *key);
+int     fshape_slot(fenv_t *f, fobj_t *shape, fobj_t *key);
+void    fshape_weak_clear(fenv_t *f, fobj_t *p);
+
+#define FBTREE_FLOOR		1
+#define FBTREE_CEILING		2
+#define FBTREE_HIGHER		3
+
+fobj_t *fbtree_new(fenv_t *f);
+void    fbtree_visit(fenv_t *f, fobj_t *p);
+void    fbtree_free(fenv_t *f, fobj_t *p);
+void    fbtree_print(fenv_t *f, fobj_t *p);
+void    fbtree_store(fenv_t *f, fobj_t *addr, fobj_t *index, fobj_t *data);
+fobj_t *fbtree_fetch(fenv_t *f, fobj_t *addr, fobj_t *index);
+void    fbtree_remove(fenv_t *f, fobj_t *addr, fobj_t *key);
+int     fbtree_key_cmp(fenv_t *f, fobj_t *a, fobj_t *b);
+int     fbtree_seek(fenv_t *f, fobj_t *p, fobj_t *key, int mode, fobj_t **kp, fobj_t **vp);
+
+fobj_t *fptable_new(fenv_t *f);
+fobj_t *fptable_snapshot(fenv_t *f, fobj_t *p);
+void    fptable_visit(fenv_t *f, fobj_t *p);
+void    fptable_print(fenv_t *f, fobj_t *p);
+void    fptable_store(fenv_t *f, fobj_t *addr, fobj_t *index, fobj_t *data);
+fobj_t *fptable_fetch(fenv_t *f, fobj_t *addr, fobj_t *index);
+void    fptable_remove(fenv_t *f, fobj_t *addr, fobj_t *key);
+void    fpnode_visit(fenv_t *f, fobj_t *p);
+void    fpnode_free(fenv_t *f, fobj_t *p);
+
+fobj_t *fbytes_new(fenv_t *f, void *base, size_t len, int owned);
+fobj_t *fbytes_alloc(fenv_t *f, size_t len);
+fobj_t *fbytes_view(fenv_t *f, fobj_t *p, size_t offset, size_t len);
+void    fbytes_register(fenv_t *f, const char *name, void *base, size_t len);
+void    fbytes_visit(fenv_t *f, fobj_t *p);
+void    fbytes_free(fenv_t *f, fobj_t *p);
+void    fbytes_print(fenv_t *f, fobj_t *p);
+fobj_t *fbytes_fetch(fenv_t *f, fobj_t *addr, fobj_t *index);
+void    fbytes_store(fenv_t *f, fobj_t *addr, fobj_t *index, fobj_t *data);
+uint64_t fbytes_get(fenv_t *f, fobj_t *p, fnumber_t offset, int size);
+void    fbytes_put(fenv_t *f, fobj_t *p, fnumber_t offset, int size, uint64_t value);
+
+#define FSEQ_RANGE		1
+#define FSEQ_MAP		2
+#define FSEQ_FILTER		3
+#define FSEQ_GEN		4
+
+fobj_t *fseq_new(fenv_t *f, int kind, fobj_t *src, fobj_t *xt);
+fobj_t *fseq_range(fenv_t *f, fnumber_t start, fnumber_t limit, fnumber_t step);
+void    fseq_visit(fenv_t *f, fobj_t *p);
+void    fseq_free(fenv_t *f, fobj_t *p);
+void    fseq_print(fenv_t *f, fobj_t *p);
+fobj_t *fiter_new(fenv_t *f, fobj_t *seq);
+void    fiter_visit(fenv_t *f, fobj_t *p);
+int     fiter_next(fenv_t *f, fobj_t *iter, fobj_t **value);
+
+void    fsort_array(fenv_t *f, fobj_t *p, fobj_t *xt);
+
+fobj_t *fcsv_open(fenv_t *f, fobj_t *path);
+fobj_t *fcsv_string(fenv_t *f, fobj_t *str);
+void    fcsv_visit(fenv_t *f, fobj_t *p);
+void    fcsv_free(fenv_t *f, fobj_t *p);
+void    fcsv_print(fenv_t *f, fobj_t *p);
+void    fcsv_set_delim(fenv_t *f, fobj_t *p, int delim);
+void    fcsv_set_batch(fenv_t *f, fobj_t *p, int batch);
+fobj_t *fcsv_row(fenv_t *f, fobj_t *p);
+fobj_t *fcsv_rows(fenv_t *f, fobj_t *p);
+fobj_t *fcsv_columns(fenv_t *f, fobj_t *p);
+void    fcsv_close(fenv_t *f, fobj_t *p);
+
+fobj_t *fser_encode(fenv_t *f, fobj_t *p, int json);
+fobj_t *fser_decode(fenv_t *f, const void *buf, size_t len, int json);
+void    fser_save(fenv_t *f, fobj_t *p, const char *path, int json);
+fobj_t *fser_load(fenv_t *f, const char *path, int json);
+
+fobj_t *fmemo_new(fenv_t *f, fobj_t *xt, int nargs, int size);
+void    fmemo_visit(fenv_t *f, fobj_t *p);
+void    fmemo_free(fenv_t *f, fobj_t *p);
+void    fmemo_print(fenv_t *f, fobj_t *p);
+void    fmemo_stats(fenv_t *f, fobj_t *p, long *hits, long *misses);
+void    fmemo_call(fenv_t *f, fobj_t *memo);
+
+fobj_t *fregex_new(fenv_t *f, fobj_t *pattern);
+void    fregex_visit(fenv_t *f, fobj_t *p);
+void    fregex_free(fenv_t *f, fobj_t *p);
+void    fregex_print(fenv_t *f, fobj_t *p);
+int     fregex_search(fenv_t *f, fobj_t *regex, const void *buf, long len,
+                      long from, long *start, long *end);
+int     fregex_match(fenv_t *f, fobj_t *regex, const void *buf, long len);
+
+void    fout_init(fenv_t *f);
+void    fout_free(fenv_t *f);
+void    fout_write(fenv_t *f, const void *p, size_t n);
+void    fout_vprintf(fenv_t *f, const char *fmt, va_list ap);
+void    fout_printf(fenv_t *f, const char *fmt, ...);
+size_t  fout_begin(fenv_t *f);
+const char *fout_end(fenv_t *f, size_t start, size_t *len);
+void    fout_pad(fenv_t *f, size_t start, int width, int max, int left, char c);
+void    fout_format(fenv_t *f, fobj_t *fmt, fobj_t **args, int nargs);
+int     fout_format_count(fenv_t *f, fobj_t *fmt);
+
+#define FSCAN_NONE		((size_t) -1)
+
+size_t  fscan_search(const void *hay, size_t hlen, const void *needle, size_t nlen);
+size_t  fscan_rsearch(const void *hay, size_t hlen, const void *needle, size_t nlen);
+size_t  fscan_search_masked(const void *hay, size_t hlen, const void *pat,
+                            const void *mask, size_t len);
+size_t  fscan_mismatch(const void *a, const void *b, size_t len);
+int     fscan_compare(const void *a, size_t alen, const void *b, size_t blen);
+size_t  fscan_count_byte(const void *buf, size_t len, int c);
+size_t  fscan_find3(const void *buf, size_t len, int a, int b, int c);
+void    fscan_fill(void *buf, size_t len, int c);
 
 void    fcode_init(fenv_t *f);
 void    fcode_new_word(fenv_t *f, fobj_t *name, fbody_t *body);
+void    fcode_new_constant(fenv_t *f, fobj_t *name, fobj_t *value);
 void fcode_handle_token(fenv_t *f, fobj_t *token);
 void fcode_compile_string(fenv_t *f, const char *string);
 
@@ -179,6 +358,7 @@ void fword_free(fenv_t *f, fobj_t *w);
 void fword_print(fenv_t *f, fobj_t *w);
 
 fobj_t *fstate_new(fenv_t *f, int state, int offset);
+void    floop_visit(fenv_t *f, fobj_t *p);
 
 /**********************************************************
  *
@@ -188,6 +368,8 @@ fobj_t *fstate_new(fenv_t *f, int state, int offset);
 
 int fparse_token_to_number(fenv_t *f, fobj_t *token, fnumber_t *n);
 int  fparse_token(fenv_t *f, fobj_t **token_str);
+int  fparse_name(fenv_t *f, fobj_t **name);
+int  fparse_delimited(fenv_t *f, char delim, fobj_t **str);
 void fparse_do_token(fenv_t *f, fobj_t *token);
 
 
@@ -0,0 +1,306 @@
+/*
+ * This file is part of arm-sim: http://madscientistroom.org/arm-sim
+ *
+ * Copyright (c) 2010 Randy Thelen. All rights reserved, and all wrongs
+ * reversed. (See the file COPYRIGHT for details.)
+ */
+
+#include "forth.h"
+#include "fobj.h"
+
+/*
+ * Output
+ *
+ * Everything the interpreter prints, including the objects' print hooks,
+ * goes through fout_write() and fout_printf().  Normally that's straight
+ * to stdout, but between fout_begin() and fout_end() it's appended to
+ * the environment's buffer instead, which is how format renders a line
+ * (%s of any object included) without making objects along the way.
+ * The buffer is kept from one use to the next, so once it has grown to
+ * the longest line it isn't allocated again.
+ */
+
+struct fout_s {
+    char		*buf;
+    size_t		 len;
+    size_t		 cap;
+    int			 capture;		// Nesting depth of fout_begin()
+};
+
+void fout_init(fenv_t *f)
+{
+    f->out = calloc(1, sizeof(fout_t));
+}
+
+void fout_free(fenv_t *f)
+{
+    free(f->out->buf);
+    free(f->out);
+    f->out = NULL;
+}
+
+/*
+ * fout_reserve()
+ *
+ * Room for n more bytes (and a NUL) in the buffer.
+ */
+static char *fout_reserve(fenv_t *f, size_t n)
+{
+    fout_t *o = f->out;
+
+    if (o->len + n + 1 > o->cap) {
+        size_t cap = o->cap ? o->cap : 256;
+        while (o->len + n + 1 > cap) cap *= 2;
+        o->buf = realloc(o->buf, cap);
+        o->cap = cap;
+    }
+    return o->buf + o->len;
+}
+
+void fout_write(fenv_t *f, const void *p, size_t n)
+{
+    fout_t *o = f->out;
+
+    if (!o->capture) {
+        fwrite(p, 1, n, stdout);
+        return;
+    }
+    memcpy(fout_reserve(f, n), p, n);
+    o->len += n;
+}
+
+void fout_vprintf(fenv_t *f, const char *fmt, va_list ap)
+{
+    fout_t *o = f->out;
+    va_list ap2;
+
+    if (!o->capture) {
+        vprintf(fmt, ap);
+        return;
+    }
+
+    va_copy(ap2, ap);
+    int n = vsnprintf(o->buf + o->len, o->cap - o->len, fmt, ap);
+    if (n >= 0 && o->len + n + 1 > o->cap) {
+        vsnprintf(fout_reserve(f, n), n + 1, fmt, ap2);
+    }
+    va_end(ap2);
+
+    if (n > 0) o->len += n;
+}
+
+void fout_printf(fenv_t *f, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    fout_vprintf(f, fmt, ap);
+    va_end(ap);
+}
+
+/*
+ * fout_begin()
+ *
+ * Start capturing output.  Returns where in the buffer it begins, to be
+ * handed to fout_end().
+ */
+size_t fout_begin(fenv_t *f)
+{
+    fout_reserve(f, 0);
+    f->out->capture++;
+    return f->out->len;
+}
+
+/*
+ * fout_end()
+ *
+ * Stop capturing.  *len is set to how much was captured since start and
+ * a pointer to it returned; it's valid until the buffer is next used.
+ */
+const char *fout_end(fenv_t *f, size_t start, size_t *len)
+{
+    fout_t *o = f->out;
+
+    ASSERT(o->capture > 0 && start <= o->len);
+
+    o->capture--;
+    *len = o->len - start;
+    o->len = start;
+    return o->buf + start;
+}
+
+/*
+ * fout_pad()
+ *
+ * Pad what's been captured since start out to width with c, on the left
+ * unless left is set.  Anything beyond max bytes (if max >= 0) is
+ * dropped first.
+ */
+void fout_pad(fenv_t *f, size_t start, int width, int max, int left, char c)
+{
+    fout_t *o = f->out;
+    size_t n = o->len - start;
+
+    if (max >= 0 && n > (size_t) max) {
+        o->len = start + max;
+        n = max;
+    }
+    if (width < 0 || n >= (size_t) width) {
+        return;
+    }
+
+    size_t pad = width - n;
+    char *end = fout_reserve(f, pad);
+    if (left) {
+        memset(end, c, pad);
+    } else {
+        memmove(o->buf + start + pad, o->buf + start, n);
+        memset(o->buf + start, c, pad);
+    }
+    o->len += pad;
+}
+
+/*
+ * fout_end_padded()
+ *
+ * End a capture begun at start for the sake of padding it, leaving the
+ * padded text wherever output was going before.
+ */
+static void fout_end_padded(fenv_t *f, size_t start, int width, int max, int left, char c)
+{
+    size_t len;
+
+    fout_pad(f, start, width, max, left, c);
+    const char *text = fout_end(f, start, &len);
+    if (f->out->capture) {
+        f->out->len += len;  // It's already where it belongs
+    } else {
+        fwrite(text, 1, len, stdout);
+    }
+}
+
+/*
+ * fout_format()
+ *
+ * Render fmt with the nargs objects in args, printf style:
+ *
+ *	%[-0+ ][width][.precision]conversion
+ *
+ * d is a decimal integer, x and X hex, o octal, c a character code, f e
+ * and g floating point, s any object (a string's bytes, a number as %g,
+ * and anything else as its print hook has it) and %% a %.
+ */
+void fout_format(fenv_t *f, fobj_t *fmt, fobj_t **args, int nargs)
+{
+    const char *p = fmt->u.str.buf, *end = p + fmt->u.str.len;
+    int arg = 0;
+
+    while (p < end) {
+        const char *q = memchr(p, '%', end - p);
+        if (!q) q = end;
+        fout_write(f, p, q - p);
+        if (q == end) break;
+
+        /*
+         * Pull apart the directive, building its C equivalent as we go.
+         */
+        char spec[32], *s = spec;
+        int left = 0, zero = 0, width = -1, prec = -1;
+
+        *s++ = '%';
+        for (p = q + 1; p < end && *p && strchr("-0+ ", *p); p++) {
+            if (*p == '-') left = 1;
+            if (*p == '0') zero = 1;
+            if (s < spec + 8) *s++ = *p;
+        }
+        for (; p < end && isdigit((unsigned char) *p); p++) {
+            width = (width < 0 ? 0 : width * 10) + (*p - '0');
+            FASSERT(width < 100000, "format width is too large");
+        }
+        if (p < end && *p == '.') {
+            for (prec = 0, p++; p < end && isdigit((unsigned char) *p); p++) {
+                prec = prec * 10 + (*p - '0');
+                FASSERT(prec < 100000, "format precision is too large");
+            }
+        }
+        FASSERT(p < end, "format string ends in the middle of a directive");
+
+        int conv = *p++;
+        if (conv == '%') {
+            fout_write(f, "%", 1);
+            continue;
+        }
+
+        FASSERT(arg < nargs, "format has more directives than arguments");
+        fobj_t *a = args[arg++];
+
+        if (conv == 's') {
+            size_t start = fout_begin(f);
+            if (a && a->type == FOBJ_STR) {
+                fout_write(f, a->u.str.buf, a->u.str.len);
+            } else if (a && a->type == FOBJ_NUM) {
+                fout_printf(f, "%Lg", a->u.num.n);
+            } else {
+                fobj_print(f, a);
+            }
+            fout_end_padded(f, start, width, prec, left, ' ');
+            continue;
+        }
+
+        FASSERT(a && a->type == FOBJ_NUM, "format %%%c requires a number", conv);
+        fnumber_t n = a->u.num.n;
+
+        if (width >= 0) s += sprintf(s, "%d", width);
+        if (prec >= 0)  s += sprintf(s, ".%d", prec);
+
+        switch (conv) {
+        case 'd':
+            strcpy(s, "lld");
+            fout_printf(f, spec, (long long) n);
+            break;
+
+        case 'x': case 'X': case 'o':
+            s[0] = 'l'; s[1] = 'l'; s[2] = conv; s[3] = 0;
+            fout_printf(f, spec, (unsigned long long) (long long) n);
+            break;
+
+        case 'c': {
+            char c = (char) n;
+            size_t start = fout_begin(f);
+            fout_write(f, &c, 1);
+            fout_end_padded(f, start, width, -1, left, zero ? '0' : ' ');
+            break;
+        }
+
+        case 'f': case 'e': case 'g': case 'E': case 'G':
+            s[0] = 'L'; s[1] = conv; s[2] = 0;
+            fout_printf(f, spec, n);
+            break;
+
+        default:
+            FASSERT(0, "format doesn't know %%%c", conv);
+        }
+    }
+
+    FASSERT(arg == nargs, "format has more arguments than directives");
+}
+
+/*
+ * fout_format_count()
+ *
+ * How many arguments fmt takes.
+ */
+int fout_format_count(fenv_t *f, fobj_t *fmt)
+{
+    const char *p = fmt->u.str.buf, *end = p + fmt->u.str.len;
+    int n = 0;
+
+    while ((p = memchr(p, '%', end - p)) != NULL) {
+        for (p++; p < end && *p && strchr("-0+ .0123456789", *p); p++) {
+            ;
+        }
+        if (p == end) break;
+        if (*p++ != '%') n++;
+    }
+    return n;
+}
@@ -30,7 +30,15 @@ static int fparse_int(fenv_t *f, char delim, fobj_t **token) // delim --
                 return 0;
             }
 
-            *token = fstr_new_buf(f, buf, len);
+            /*
+             * A token which is a known name comes back as the interned
+             * string; anything else is a slice of the input.  Either way
+             * no bytes are copied.
+             */
+            *token = fstr_intern_find(f, buf, len);
+            if (!*token) {
+                *token = fstr_slice(f, f->input_str, start, len);
+            }
             if (c == EOF) {
                 return 0; // Didn't find the delimiter
             } else {
@@ -61,6 +69,45 @@ int fparse_token(fenv_t *f, fobj_t **token_str)
     }
 }
 
+/*
+ * fparse_name()
+ *
+ * Parse the next token as the name of a new word.  Names are kept, so
+ * this is where a token is copied out of the input (by interning it).
+ */
+
+int fparse_name(fenv_t *f, fobj_t **name)
+{
+    int r = fparse_token(f, name);
+
+    if (*name) {
+        *name = fstr_intern_str(f, *name);
+    }
+
+    return r;
+}
+
+/*
+ * fparse_delimited()
+ *
+ * Parse the input up to (and consuming) delim.  Used by words like str"
+ * which take the rest of a string from the input.  An empty string is
+ * returned as "" rather than NULL.
+ */
+
+int fparse_delimited(fenv_t *f, char delim, fobj_t **str)
+{
+    int r = fparse_int(f, delim, str);
+
+    if (*str == NULL) {
+        *str = fstr_new(f, "");
+    } else {
+        *str = fstr_intern_str(f, *str);
+    }
+
+    return r;
+}
+
 int fparse_token_to_number(fenv_t *f, fobj_t *token, fnumber_t *n)
 {
     int i, len;
@@ -70,7 +117,7 @@ int fparse_token_to_number(fenv_t *f, fobj_t *token, fnumber_t *n)
         return 0;
     }
 
-    buf = token->u.str.buf;
+    buf = fstr_cstr(f, token);
     len = token->u.str.len;
 
     if (len == 8) {
@@ -120,7 +167,7 @@ void fparse_do_token(fenv_t *f, fobj_t *token)
     } else {
         fnumber_t n = 0;
         int r = fparse_token_to_number(f, token, &n);
-        FASSERT(r, "Word %s not found in the dictionary", token->u.str.buf);
+        FASSERT(r, "Word %s not found in the dictionary", fstr_cstr(f, token));
         fobj_t *num = fnum_new(f, n);
         extern void fcode_push(void *, void *);
         fcode_push(f, num);
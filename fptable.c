@@ -0,0 +1,463 @@
+/*
+ * This file is part of arm-sim: http://madscientistroom.org/arm-sim
+ *
+ * Copyright (c) 2010 Randy Thelen. All rights reserved, and all wrongs
+ * reversed. (See the file COPYRIGHT for details.)
+ */
+
+#include "forth.h"
+#include "fobj.h"
+
+/*
+ * Persistent tables
+ *
+ * A ptable is a handle on the root of a hash array mapped trie.  The trie
+ * nodes are never modified once built: a store copies the nodes on the
+ * path from the root to the changed entry (at most seven of them) and
+ * points the handle at the new root.  Everything else is shared with the
+ * previous version.  That makes snapshot (a second handle on the same
+ * root) O(1).
+ *
+ * The nodes are fobjs themselves, so a version which is no longer
+ * referenced by any handle is reclaimed by the garbage collector like
+ * anything else.
+ *
+ * Each node holds a bitmap of the 32 hash fragments which are stored
+ * inline as key/value pairs and a bitmap of those which lead to a child
+ * node.  The slots array holds the pairs first and then the children,
+ * each in bit order.  Once the 32 bits of hash are used up the remaining
+ * keys (which all have the same hash) go into a collision node which is
+ * just a list of pairs.
+ */
+
+#define PT_BITS			5
+#define PT_MASK			((1 << PT_BITS) - 1)
+#define PT_HASH_BITS	32
+
+#define PKEY(_n, _i)	(_n)->slots[2 * (_i) + 0]
+#define PVAL(_n, _i)	(_n)->slots[2 * (_i) + 1]
+#define PCHILD(_n, _i)	(_n)->slots[2 * popcount((_n)->datamap) + (_i)]
+
+static int popcount(uint32_t x)
+{
+    return __builtin_popcount(x);
+}
+
+static int pt_index(uint32_t map, uint32_t bit)
+{
+    return popcount(map & (bit - 1));
+}
+
+/***********************************
+ *
+ * Trie nodes
+ *
+ ***********************************/
+
+static fobj_t *fpnode_new(fenv_t *f, uint32_t datamap, uint32_t nodemap, int len)
+{
+    fobj_t *p = fobj_new(f, FOBJ_PNODE);
+    fpnode_t *n = &p->u.pnode;
+
+    n->datamap = datamap;
+    n->nodemap = nodemap;
+    n->collision = 0;
+    n->len = len;
+    n->slots = len ? calloc(len, sizeof(fobj_t *)) : NULL;
+
+    return p;
+}
+
+static fobj_t *fpnode_copy(fenv_t *f, fpnode_t *n)
+{
+    fobj_t *p = fpnode_new(f, n->datamap, n->nodemap, n->len);
+    p->u.pnode.collision = n->collision;
+    memcpy(p->u.pnode.slots, n->slots, n->len * sizeof(fobj_t *));
+    return p;
+}
+
+void fpnode_visit(fenv_t *f, fobj_t *p)
+{
+    fpnode_t *n = &p->u.pnode;
+
+    for (int i = 0; i < n->len; i++) {
+        fobj_visit(f, n->slots[i]);
+    }
+}
+
+void fpnode_free(fenv_t *f, fobj_t *p)
+{
+    fpnode_t *n = &p->u.pnode;
+
+    if (n->slots) {
+        free(n->slots);
+        n->slots = NULL;
+    }
+}
+
+/*
+ * Build the node (or chain of nodes) which holds two pairs whose hashes
+ * agree below shift.
+ */
+static fobj_t *fpnode_merge(fenv_t *f, int shift,
+                            fobj_t *k1, fobj_t *v1, uint32_t h1,
+                            fobj_t *k2, fobj_t *v2, uint32_t h2)
+{
+    if (shift >= PT_HASH_BITS) {
+        fobj_t *c = fpnode_new(f, 0, 0, 4);
+        fpnode_t *n = &c->u.pnode;
+        n->collision = 1;
+        PKEY(n, 0) = k1; PVAL(n, 0) = v1;
+        PKEY(n, 1) = k2; PVAL(n, 1) = v2;
+        return c;
+    }
+
+    uint32_t b1 = 1u << ((h1 >> shift) & PT_MASK);
+    uint32_t b2 = 1u << ((h2 >> shift) & PT_MASK);
+
+    if (b1 == b2) {
+        fobj_t *child = fpnode_merge(f, shift + PT_BITS, k1, v1, h1, k2, v2, h2);
+        fobj_t *p = fpnode_new(f, 0, b1, 1);
+        p->u.pnode.slots[0] = child;
+        return p;
+    }
+
+    fobj_t *p = fpnode_new(f, b1 | b2, 0, 4);
+    fpnode_t *n = &p->u.pnode;
+    int i1 = b1 < b2 ? 0 : 1;
+    PKEY(n, i1) = k1;     PVAL(n, i1) = v1;
+    PKEY(n, 1 - i1) = k2; PVAL(n, 1 - i1) = v2;
+    return p;
+}
+
+static fobj_t *fpnode_lookup(fenv_t *f, fobj_t *p, uint32_t hash, fobj_t *key)
+{
+    int shift = 0;
+
+    while (p) {
+        fpnode_t *n = &p->u.pnode;
+
+        if (n->collision) {
+            for (int i = 0; i < n->len / 2; i++) {
+                if (fobj_equal(f, PKEY(n, i), key)) return PVAL(n, i);
+            }
+            return NULL;
+        }
+
+        uint32_t bit = 1u << ((hash >> shift) & PT_MASK);
+
+        if (n->datamap & bit) {
+            int i = pt_index(n->datamap, bit);
+            return fobj_equal(f, PKEY(n, i), key) ? PVAL(n, i) : NULL;
+        }
+
+        if (!(n->nodemap & bit)) {
+            return NULL;
+        }
+
+        p = PCHILD(n, pt_index(n->nodemap, bit));
+        shift += PT_BITS;
+    }
+
+    return NULL;
+}
+
+/*
+ * Return a new node which is p with key set to val.  *added is set if
+ * the key wasn't there before.
+ */
+static fobj_t *fpnode_insert(fenv_t *f, fobj_t *p, int shift, uint32_t hash,
+                             fobj_t *key, fobj_t *val, int *added)
+{
+    fpnode_t *n = &p->u.pnode;
+
+    if (n->collision) {
+        for (int i = 0; i < n->len / 2; i++) {
+            if (fobj_equal(f, PKEY(n, i), key)) {
+                fobj_t *c = fpnode_copy(f, n);
+                PVAL(&c->u.pnode, i) = val;
+                return c;
+            }
+        }
+
+        fobj_t *c = fpnode_new(f, 0, 0, n->len + 2);
+        fpnode_t *cn = &c->u.pnode;
+        cn->collision = 1;
+        memcpy(cn->slots, n->slots, n->len * sizeof(fobj_t *));
+        cn->slots[n->len] = key;
+        cn->slots[n->len + 1] = val;
+        *added = 1;
+        return c;
+    }
+
+    uint32_t bit = 1u << ((hash >> shift) & PT_MASK);
+    int ndata = popcount(n->datamap);
+
+    if (n->datamap & bit) {
+        int i = pt_index(n->datamap, bit);
+        fobj_t *k = PKEY(n, i);
+
+        if (fobj_equal(f, k, key)) {
+            fobj_t *c = fpnode_copy(f, n);
+            PVAL(&c->u.pnode, i) = val;
+            return c;
+        }
+
+        /*
+         * Two different keys share this fragment: push both down into a
+         * new child node.
+         */
+        fobj_t *child = fpnode_merge(f, shift + PT_BITS,
+                                     k, PVAL(n, i), fobj_hash(f, k),
+                                     key, val, hash);
+        fobj_t *c = fpnode_new(f, n->datamap & ~bit, n->nodemap | bit, n->len - 1);
+        fpnode_t *cn = &c->u.pnode;
+        int j = pt_index(n->nodemap, bit);
+        int nchild = popcount(n->nodemap);
+
+        memcpy(cn->slots, n->slots, 2 * i * sizeof(fobj_t *));
+        memcpy(&cn->slots[2 * i], &n->slots[2 * i + 2], 2 * (ndata - i - 1) * sizeof(fobj_t *));
+        memcpy(&PCHILD(cn, 0), &PCHILD(n, 0), j * sizeof(fobj_t *));
+        PCHILD(cn, j) = child;
+        memcpy(&PCHILD(cn, j + 1), &PCHILD(n, j), (nchild - j) * sizeof(fobj_t *));
+        *added = 1;
+        return c;
+    }
+
+    if (n->nodemap & bit) {
+        int j = pt_index(n->nodemap, bit);
+        fobj_t *child = fpnode_insert(f, PCHILD(n, j), shift + PT_BITS, hash, key, val, added);
+        fobj_t *c = fpnode_copy(f, n);
+        PCHILD(&c->u.pnode, j) = child;
+        return c;
+    }
+
+    /*
+     * A new pair in this node.
+     */
+    int i = pt_index(n->datamap, bit);
+    fobj_t *c = fpnode_new(f, n->datamap | bit, n->nodemap, n->len + 2);
+    fpnode_t *cn = &c->u.pnode;
+
+    if (i) {
+        memcpy(cn->slots, n->slots, 2 * i * sizeof(fobj_t *));
+    }
+    PKEY(cn, i) = key;
+    PVAL(cn, i) = val;
+    if (n->len > 2 * i) {
+        memcpy(&cn->slots[2 * i + 2], &n->slots[2 * i], (n->len - 2 * i) * sizeof(fobj_t *));
+    }
+    *added = 1;
+    return c;
+}
+
+/*
+ * A node with a single pair and no children can be folded into its
+ * parent; this keeps the trie canonical after a remove.
+ */
+static int fpnode_is_single(fpnode_t *n)
+{
+    return n->len == 2 && (n->collision || n->nodemap == 0);
+}
+
+/*
+ * Return a new node which is p without key, NULL if that leaves p empty,
+ * or p itself if key isn't there.
+ */
+static fobj_t *fpnode_remove(fenv_t *f, fobj_t *p, int shift, uint32_t hash,
+                             fobj_t *key, int *removed)
+{
+    fpnode_t *n = &p->u.pnode;
+
+    if (n->collision) {
+        for (int i = 0; i < n->len / 2; i++) {
+            if (fobj_equal(f, PKEY(n, i), key)) {
+                *removed = 1;
+                if (n->len == 2) return NULL;
+
+                fobj_t *c = fpnode_new(f, 0, 0, n->len - 2);
+                c->u.pnode.collision = 1;
+                memcpy(c->u.pnode.slots, n->slots, 2 * i * sizeof(fobj_t *));
+                memcpy(&c->u.pnode.slots[2 * i], &n->slots[2 * i + 2],
+                       (n->len - 2 * i - 2) * sizeof(fobj_t *));
+                return c;
+            }
+        }
+        return p;
+    }
+
+    uint32_t bit = 1u << ((hash >> shift) & PT_MASK);
+
+    if (n->datamap & bit) {
+        int i = pt_index(n->datamap, bit);
+        if (!fobj_equal(f, PKEY(n, i), key)) return p;
+
+        *removed = 1;
+        if (n->len == 2) return NULL;
+
+        fobj_t *c = fpnode_new(f, n->datamap & ~bit, n->nodemap, n->len - 2);
+        memcpy(c->u.pnode.slots, n->slots, 2 * i * sizeof(fobj_t *));
+        memcpy(&c->u.pnode.slots[2 * i], &n->slots[2 * i + 2],
+               (n->len - 2 * i - 2) * sizeof(fobj_t *));
+        return c;
+    }
+
+    if (!(n->nodemap & bit)) {
+        return p;
+    }
+
+    int j = pt_index(n->nodemap, bit);
+    fobj_t *old = PCHILD(n, j);
+    fobj_t *child = fpnode_remove(f, old, shift + PT_BITS, hash, key, removed);
+
+    if (child == old) {
+        return p;
+    }
+
+    if (child && !fpnode_is_single(&child->u.pnode)) {
+        fobj_t *c = fpnode_copy(f, n);
+        PCHILD(&c->u.pnode, j) = child;
+        return c;
+    }
+
+    /*
+     * The child is gone, or down to one pair which moves up into this
+     * node.
+     */
+    int ndata = popcount(n->datamap);
+    int nchild = popcount(n->nodemap);
+    uint32_t datamap = child ? n->datamap | bit : n->datamap;
+    int len = n->len - 1 + (child ? 2 : 0);
+
+    if (len == 0) {
+        return NULL;
+    }
+
+    fobj_t *c = fpnode_new(f, datamap, n->nodemap & ~bit, len);
+    fpnode_t *cn = &c->u.pnode;
+
+    if (child) {
+        int i = pt_index(n->datamap, bit);
+        memcpy(cn->slots, n->slots, 2 * i * sizeof(fobj_t *));
+        PKEY(cn, i) = PKEY(&child->u.pnode, 0);
+        PVAL(cn, i) = PVAL(&child->u.pnode, 0);
+        memcpy(&cn->slots[2 * i + 2], &n->slots[2 * i], 2 * (ndata - i) * sizeof(fobj_t *));
+    } else {
+        memcpy(cn->slots, n->slots, 2 * ndata * sizeof(fobj_t *));
+    }
+    memcpy(&PCHILD(cn, 0), &PCHILD(n, 0), j * sizeof(fobj_t *));
+    memcpy(&PCHILD(cn, j), &PCHILD(n, j + 1), (nchild - j - 1) * sizeof(fobj_t *));
+
+    return c;
+}
+
+static void fpnode_print(fenv_t *f, fobj_t *p)
+{
+    fpnode_t *n = &p->u.pnode;
+    int ndata = n->collision ? n->len / 2 : popcount(n->datamap);
+
+    for (int i = 0; i < ndata; i++) {
+        fobj_print(f, PKEY(n, i));
+        fout_printf(f, " = ");
+        fobj_print(f, PVAL(n, i));
+        fout_printf(f, "\n");
+    }
+
+    if (!n->collision) {
+        for (int j = 0; j < popcount(n->nodemap); j++) {
+            fpnode_print(f, PCHILD(n, j));
+        }
+    }
+}
+
+/***********************************
+ *
+ * Persistent table handles
+ *
+ ***********************************/
+
+fobj_t *fptable_new(fenv_t *f)
+{
+    fobj_t *p = fobj_new(f, FOBJ_PTABLE);
+    fptable_t *t = &p->u.ptable;
+
+    t->root = NULL;
+    t->num = 0;
+
+    return p;
+}
+
+/*
+ * fptable_snapshot()
+ *
+ * Return a new handle on the current version of the table.  Later stores
+ * through either handle don't affect the other.
+ */
+fobj_t *fptable_snapshot(fenv_t *f, fobj_t *p)
+{
+    fobj_t *s = fptable_new(f);
+    s->u.ptable = p->u.ptable;
+    return s;
+}
+
+void fptable_visit(fenv_t *f, fobj_t *p)
+{
+    fobj_visit(f, p->u.ptable.root);
+}
+
+void fptable_print(fenv_t *f, fobj_t *p)
+{
+    ASSERT(p->type == FOBJ_PTABLE);
+
+    if (p->u.ptable.root) {
+        fpnode_print(f, p->u.ptable.root);
+    }
+}
+
+static void fptable_check_key(fenv_t *f, fobj_t *key)
+{
+    FASSERT(key, "ptable must be indexed");
+    FASSERT(key->type == FOBJ_NUM || key->type == FOBJ_STR,
+            "ptable must be indexed by NUM or STRING");
+}
+
+fobj_t *fptable_fetch(fenv_t *f, fobj_t *addr, fobj_t *index)
+{
+    fptable_t *t = &addr->u.ptable;
+
+    if (!index) {
+        return fnum_new(f, t->num);
+    }
+
+    fptable_check_key(f, index);
+    return fpnode_lookup(f, t->root, fobj_hash(f, index), index);
+}
+
+void fptable_store(fenv_t *f, fobj_t *addr, fobj_t *index, fobj_t *data)
+{
+    fptable_check_key(f, index);
+    fptable_t *t = &addr->u.ptable;
+    uint32_t hash = fobj_hash(f, index);
+    int added = 0;
+
+    if (!t->root) {
+        t->root = fpnode_new(f, 0, 0, 0);
+    }
+
+    t->root = fpnode_insert(f, t->root, 0, hash, index, data, &added);
+    t->num += added;
+}
+
+void fptable_remove(fenv_t *f, fobj_t *addr, fobj_t *key)
+{
+    fptable_check_key(f, key);
+    fptable_t *t = &addr->u.ptable;
+    int removed = 0;
+
+    if (!t->root) {
+        return;
+    }
+
+    t->root = fpnode_remove(f, t->root, 0, fobj_hash(f, key), key, &removed);
+    t->num -= removed;
+}
@@ -0,0 +1,997 @@
+/*
+ * This file is part of arm-sim: http://madscientistroom.org/arm-sim
+ *
+ * Copyright (c) 2010 Randy Thelen. All rights reserved, and all wrongs
+ * reversed. (See the file COPYRIGHT for details.)
+ */
+
+#include "forth.h"
+#include "fobj.h"
+
+/*
+ * Regular expressions
+ *
+ * A pattern is parsed once, when the regex is made, into a small syntax
+ * tree.  The tree is compiled to Thompson NFA programs (a forward one and
+ * a reversed one) and the programs are run as DFAs which are built
+ * lazily: a DFA state is the ordered list of NFA instructions the
+ * simulation could be at, and its transitions are filled in the first
+ * time each is taken.  Matching is therefore linear in the text, with a
+ * table lookup per byte once the states in use have been built.
+ *
+ * Supported syntax: literals, ., [...] and [^...] classes with ranges,
+ * \d \w \s (and \D \W \S), \n \t \r \xHH, escaped metacharacters, (...)
+ * groups, |, and the quantifiers * + ? {m} {m,} {m,n}, each optionally
+ * followed by ? to make it lazy.  ^ and $ anchor the whole pattern and
+ * are only allowed at its very start and end, and not with a | outside
+ * any group (^(a|b) says what ^a|b might mean).  . doesn't match \n.
+ *
+ * Searching finds the leftmost match, preferring alternatives and
+ * repetitions as Perl does.  The forward DFA gives the end of that match
+ * (threads of lower priority than a match are dropped, so it stops once
+ * nothing better is possible), and the reversed program run backwards
+ * from there gives its start.
+ */
+
+#define RE_MAX_STATES		4096		// Cached DFA states before a flush
+#define RE_MAX_REPEAT		1000
+
+/*
+ * Syntax tree
+ */
+
+#define N_EMPTY		1
+#define N_SET		2
+#define N_CAT		3
+#define N_ALT		4
+#define N_REP		5
+
+typedef struct re_set_s {
+    uint8_t		bits[32];
+} re_set_t;
+
+typedef struct re_node_s {
+    int			 type;
+    int			 a, b;				// Children
+    int			 min, max;			// N_REP; max < 0 is unbounded
+    int			 greedy;
+    int			 set;				// N_SET
+} re_node_t;
+
+/*
+ * NFA programs
+ */
+
+#define I_SET		1
+#define I_SPLIT		2				// Try x, then y
+#define I_JMP		3
+#define I_MATCH		4
+
+typedef struct re_inst_s {
+    int			 op;
+    int			 x, y;
+    int			 set;
+} re_inst_t;
+
+typedef struct re_prog_s {
+    int			 n, cap;
+    re_inst_t	*insts;
+} re_prog_t;
+
+/*
+ * Lazy DFAs
+ */
+
+typedef struct re_state_s {
+    int			 n;
+    int			*insts;				// In priority order
+    int			 match;
+    uint32_t	 hash;
+} re_state_t;
+
+typedef struct re_dfa_s {
+    re_prog_t	 prog;
+    int			 longest;			// Don't drop threads after a match
+    int			 start;				// Start state, or -1
+    int			 nstates;
+    re_state_t	*states;			// states[0] is the dead state
+    int			*trans;				// [state][class], -1 if not built yet
+    int			 nindex;
+    int			*index;				// Hash of states, -1 for empty
+    int			*mark;				// Closure bookkeeping
+    int			 gen;
+    int			*stack;
+    int			*list;
+    int			 accel;				// The start state loops on the bytes in stay
+    uint8_t		 stay[256];
+} re_dfa_t;
+
+struct fre_s {
+    int			 nnodes, capnodes;
+    re_node_t	*nodes;
+    int			 nsets, capsets;
+    re_set_t	*sets;
+    int			 root;
+    int			 any;				// The set of all bytes
+    int			 bol, eol;			// ^ and $
+    int			 nclasses;
+    uint8_t		 cls[256];			// Byte to equivalence class
+    uint8_t		 rep[256];			// A byte in each class
+    re_dfa_t	*fwd, *rev, *full;
+};
+
+/***********************************
+ *
+ * Parsing
+ *
+ ***********************************/
+
+typedef struct re_parse_s {
+    fenv_t		*f;
+    fre_t		*re;
+    const char	*p, *end;
+    int			 depth;			// Groups we're in
+    int			 top_alt;		// Saw a | outside any group
+} re_parse_t;
+
+static int re_node(fre_t *re, int type, int a, int b)
+{
+    if (re->nnodes == re->capnodes) {
+        re->capnodes = re->capnodes ? 2 * re->capnodes : 16;
+        re->nodes = realloc(re->nodes, re->capnodes * sizeof(re_node_t));
+    }
+
+    re_node_t *n = &re->nodes[re->nnodes];
+    memset(n, 0, sizeof(*n));
+    n->type = type;
+    n->a = a;
+    n->b = b;
+    n->greedy = 1;
+    return re->nnodes++;
+}
+
+static int re_new_set(fre_t *re)
+{
+    if (re->nsets == re->capsets) {
+        re->capsets = re->capsets ? 2 * re->capsets : 8;
+        re->sets = realloc(re->sets, re->capsets * sizeof(re_set_t));
+    }
+    memset(&re->sets[re->nsets], 0, sizeof(re_set_t));
+    return re->nsets++;
+}
+
+static void re_set_add(re_set_t *s, int c)
+{
+    s->bits[c >> 3] |= 1 << (c & 7);
+}
+
+static int re_set_has(re_set_t *s, int c)
+{
+    return (s->bits[c >> 3] >> (c & 7)) & 1;
+}
+
+static void re_set_add_range(re_set_t *s, int lo, int hi)
+{
+    for (int c = lo; c <= hi; c++) re_set_add(s, c);
+}
+
+static void re_set_invert(re_set_t *s)
+{
+    for (int i = 0; i < 32; i++) s->bits[i] = ~s->bits[i];
+}
+
+static int re_set_node(re_parse_t *ps, re_set_t *s)
+{
+    int set = re_new_set(ps->re);
+    ps->re->sets[set] = *s;
+
+    int n = re_node(ps->re, N_SET, -1, -1);
+    ps->re->nodes[n].set = set;
+    return n;
+}
+
+static int re_hex(int c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/*
+ * re_parse_escape()
+ *
+ * Add the bytes \c stands for to s.  Returns the byte if it stands for a
+ * single one (so it can start a range), else -1.
+ */
+static int re_parse_escape(re_parse_t *ps, re_set_t *s)
+{
+    fenv_t *f = ps->f;
+    re_set_t t;
+    int neg = 0, c;
+
+    FASSERT(ps->p < ps->end, "regex ends with a \\");
+    c = (unsigned char) *ps->p++;
+    memset(&t, 0, sizeof(t));
+
+    switch (c) {
+    case 'D': neg = 1;  // Fall through
+    case 'd':
+        re_set_add_range(&t, '0', '9');
+        break;
+
+    case 'W': neg = 1;  // Fall through
+    case 'w':
+        re_set_add_range(&t, 'a', 'z');
+        re_set_add_range(&t, 'A', 'Z');
+        re_set_add_range(&t, '0', '9');
+        re_set_add(&t, '_');
+        break;
+
+    case 'S': neg = 1;  // Fall through
+    case 's':
+        re_set_add(&t, ' ');
+        re_set_add_range(&t, '\t', '\r');
+        break;
+
+    case 'n': re_set_add(s, '\n'); return '\n';
+    case 't': re_set_add(s, '\t'); return '\t';
+    case 'r': re_set_add(s, '\r'); return '\r';
+
+    case 'x': {
+        FASSERT(ps->end - ps->p >= 2 && re_hex(ps->p[0]) >= 0 && re_hex(ps->p[1]) >= 0,
+                "regex \\x must be followed by two hex digits");
+        c = re_hex(ps->p[0]) * 16 + re_hex(ps->p[1]);
+        ps->p += 2;
+        re_set_add(s, c);
+        return c;
+    }
+
+    default:
+        FASSERT(!isalnum(c), "unknown regex escape \\%c", c);
+        re_set_add(s, c);
+        return c;
+    }
+
+    if (neg) re_set_invert(&t);
+    for (int i = 0; i < 32; i++) s->bits[i] |= t.bits[i];
+    return -1;
+}
+
+static int re_parse_class(re_parse_t *ps)
+{
+    fenv_t *f = ps->f;
+    re_set_t s;
+    int neg = 0;
+
+    memset(&s, 0, sizeof(s));
+    if (ps->p < ps->end && *ps->p == '^') {
+        neg = 1;
+        ps->p++;
+    }
+
+    int first = 1;
+    while (1) {
+        FASSERT(ps->p < ps->end, "regex [ without a ]");
+        int c = (unsigned char) *ps->p;
+        if (c == ']' && !first) {
+            ps->p++;
+            break;
+        }
+        first = 0;
+
+        int lo;
+        ps->p++;
+        if (c == '\\') {
+            lo = re_parse_escape(ps, &s);
+            if (lo < 0) continue;  // A class like \d can't start a range
+        } else {
+            lo = c;
+            re_set_add(&s, c);
+        }
+
+        if (ps->end - ps->p >= 2 && ps->p[0] == '-' && ps->p[1] != ']') {
+            ps->p++;
+            int hi = (unsigned char) *ps->p++;
+            if (hi == '\\') {
+                re_set_t t;
+                memset(&t, 0, sizeof(t));
+                hi = re_parse_escape(ps, &t);
+                FASSERT(hi >= 0, "regex class range must end with a single character");
+            }
+            FASSERT(lo <= hi, "regex class range %c-%c is backwards", lo, hi);
+            re_set_add_range(&s, lo, hi);
+        }
+    }
+
+    if (neg) re_set_invert(&s);
+    return re_set_node(ps, &s);
+}
+
+static int re_parse_alt(re_parse_t *ps);
+
+static int re_parse_atom(re_parse_t *ps)
+{
+    fenv_t *f = ps->f;
+    re_set_t s;
+    int c = (unsigned char) *ps->p++;
+
+    memset(&s, 0, sizeof(s));
+
+    switch (c) {
+    case '(': {
+        ps->depth++;
+        int n = re_parse_alt(ps);
+        FASSERT(ps->p < ps->end && *ps->p == ')', "regex ( without a )");
+        ps->p++;
+        ps->depth--;
+        return n;
+    }
+
+    case '[':
+        return re_parse_class(ps);
+
+    case '.':
+        re_set_add(&s, '\n');
+        re_set_invert(&s);
+        return re_set_node(ps, &s);
+
+    case '\\':
+        re_parse_escape(ps, &s);
+        return re_set_node(ps, &s);
+
+    case '^':
+    case '$':
+        FASSERT(0, "regex %c is only supported at the start (^) or end ($) of a pattern", c);
+        return -1;
+
+    case '*': case '+': case '?': case '{':
+        FASSERT(0, "regex %c must follow something to repeat", c);
+        return -1;
+
+    default:
+        re_set_add(&s, c);
+        return re_set_node(ps, &s);
+    }
+}
+
+static int re_parse_number(re_parse_t *ps)
+{
+    int n = -1;
+
+    while (ps->p < ps->end && isdigit((unsigned char) *ps->p)) {
+        n = (n < 0 ? 0 : n * 10) + (*ps->p++ - '0');
+        if (n > RE_MAX_REPEAT) n = RE_MAX_REPEAT + 1;
+    }
+    return n;
+}
+
+static int re_parse_repeat(re_parse_t *ps)
+{
+    fenv_t *f = ps->f;
+    int n = re_parse_atom(ps);
+
+    while (ps->p < ps->end) {
+        int min, max;
+
+        switch (*ps->p) {
+        case '*': min = 0; max = -1; ps->p++; break;
+        case '+': min = 1; max = -1; ps->p++; break;
+        case '?': min = 0; max = 1;  ps->p++; break;
+
+        case '{':
+            ps->p++;
+            min = re_parse_number(ps);
+            max = min;
+            if (ps->p < ps->end && *ps->p == ',') {
+                ps->p++;
+                max = re_parse_number(ps);
+            }
+            FASSERT(ps->p < ps->end && *ps->p == '}' && min >= 0,
+                    "regex {m,n} is malformed");
+            FASSERT(min <= RE_MAX_REPEAT && max <= RE_MAX_REPEAT,
+                    "regex repeat counts are limited to %d", RE_MAX_REPEAT);
+            FASSERT(max < 0 || min <= max, "regex {m,n} has m > n");
+            ps->p++;
+            break;
+
+        default:
+            return n;
+        }
+
+        n = re_node(ps->re, N_REP, n, -1);
+        ps->re->nodes[n].min = min;
+        ps->re->nodes[n].max = max;
+        if (ps->p < ps->end && *ps->p == '?') {
+            ps->re->nodes[n].greedy = 0;
+            ps->p++;
+        }
+    }
+
+    return n;
+}
+
+static int re_parse_cat(re_parse_t *ps)
+{
+    int n = re_node(ps->re, N_EMPTY, -1, -1);
+
+    while (ps->p < ps->end && *ps->p != '|' && *ps->p != ')') {
+        n = re_node(ps->re, N_CAT, n, re_parse_repeat(ps));
+    }
+    return n;
+}
+
+static int re_parse_alt(re_parse_t *ps)
+{
+    int n = re_parse_cat(ps);
+
+    while (ps->p < ps->end && *ps->p == '|') {
+        ps->top_alt |= ps->depth == 0;
+        ps->p++;
+        n = re_node(ps->re, N_ALT, n, re_parse_cat(ps));
+    }
+    return n;
+}
+
+/***********************************
+ *
+ * Compiling to NFA programs
+ *
+ ***********************************/
+
+static int re_emit(re_prog_t *prog, int op, int x, int y, int set)
+{
+    if (prog->n == prog->cap) {
+        prog->cap = prog->cap ? 2 * prog->cap : 32;
+        prog->insts = realloc(prog->insts, prog->cap * sizeof(re_inst_t));
+    }
+
+    re_inst_t *i = &prog->insts[prog->n];
+    i->op = op;
+    i->x = x;
+    i->y = y;
+    i->set = set;
+    return prog->n++;
+}
+
+static void re_compile(fre_t *re, re_prog_t *prog, int node, int reverse)
+{
+    re_node_t *n = &re->nodes[node];
+    int split, loop;
+
+    switch (n->type) {
+    case N_EMPTY:
+        break;
+
+    case N_SET:
+        re_emit(prog, I_SET, 0, 0, n->set);
+        break;
+
+    case N_CAT:
+        re_compile(re, prog, reverse ? n->b : n->a, reverse);
+        re_compile(re, prog, reverse ? n->a : n->b, reverse);
+        break;
+
+    case N_ALT: {
+        split = re_emit(prog, I_SPLIT, 0, 0, 0);
+        prog->insts[split].x = prog->n;
+        re_compile(re, prog, n->a, reverse);
+        int jmp = re_emit(prog, I_JMP, 0, 0, 0);
+        prog->insts[split].y = prog->n;
+        re_compile(re, prog, n->b, reverse);
+        prog->insts[jmp].x = prog->n;
+        break;
+    }
+
+    case N_REP: {
+        int min = n->min, max = n->max, greedy = n->greedy;
+
+        for (int i = 0; i < min; i++) {
+            re_compile(re, prog, n->a, reverse);
+        }
+
+        if (max < 0) {
+            /*
+             * loop: split body, out;  body;  jmp loop;  out:
+             */
+            loop = re_emit(prog, I_SPLIT, 0, 0, 0);
+            int body = prog->n;
+            re_compile(re, prog, n->a, reverse);
+            re_emit(prog, I_JMP, loop, 0, 0);
+            prog->insts[loop].x = greedy ? body : prog->n;
+            prog->insts[loop].y = greedy ? prog->n : body;
+            break;
+        }
+
+        /*
+         * Each optional copy is  split body, out;  body;  with all the
+         * outs going to the end.
+         */
+        int nopt = max - min;
+        int splits[nopt + 1];
+        for (int i = 0; i < nopt; i++) {
+            splits[i] = re_emit(prog, I_SPLIT, 0, 0, 0);
+            prog->insts[splits[i]].x = prog->n;  // Fixed up below
+            re_compile(re, prog, n->a, reverse);
+        }
+        for (int i = 0; i < nopt; i++) {
+            re_inst_t *s = &prog->insts[splits[i]];
+            int body = splits[i] + 1;
+            s->x = greedy ? body : prog->n;
+            s->y = greedy ? prog->n : body;
+        }
+        break;
+    }
+    }
+}
+
+/*
+ * re_dfa_new()
+ *
+ * A DFA for the pattern, forward or reversed, and with or without a
+ * leading .*? so it can start anywhere.
+ */
+static void re_dfa_reset(fre_t *re, re_dfa_t *d)
+{
+    for (int i = 1; i < d->nstates; i++) {
+        free(d->states[i].insts);
+    }
+    for (int i = 0; i < d->nindex; i++) {
+        d->index[i] = -1;
+    }
+
+    memset(&d->states[0], 0, sizeof(re_state_t));  // The dead state
+    for (int c = 0; c < re->nclasses; c++) {
+        d->trans[c] = 0;
+    }
+    d->nstates = 1;
+    d->start = -1;
+}
+
+static re_dfa_t *re_dfa_new(fre_t *re, int reverse, int unanchored, int longest)
+{
+    re_dfa_t *d = calloc(1, sizeof(*d));
+    re_prog_t *prog = &d->prog;
+
+    if (unanchored) {
+        /*
+         * 0: split 3, 1;  1: set any;  2: jmp 0;  3: the pattern
+         *
+         * The pattern is preferred, so threads are in order of where
+         * they started.
+         */
+        re_emit(prog, I_SPLIT, 3, 1, 0);
+        re_emit(prog, I_SET, 0, 0, re->any);
+        re_emit(prog, I_JMP, 0, 0, 0);
+    }
+    re_compile(re, prog, re->root, reverse);
+    re_emit(prog, I_MATCH, 0, 0, 0);
+
+    d->longest = longest;
+    d->mark = calloc(prog->n, sizeof(int));
+    d->stack = malloc(prog->n * sizeof(int));
+    d->list = malloc(prog->n * sizeof(int));
+    d->states = malloc(RE_MAX_STATES * sizeof(re_state_t));
+    d->trans = malloc((size_t) RE_MAX_STATES * re->nclasses * sizeof(int));
+    d->nindex = 2 * RE_MAX_STATES;
+    d->index = malloc(d->nindex * sizeof(int));
+    re_dfa_reset(re, d);
+
+    return d;
+}
+
+static void re_dfa_free(fre_t *re, re_dfa_t *d)
+{
+    if (!d) return;
+
+    re_dfa_reset(re, d);
+    free(d->prog.insts);
+    free(d->mark);
+    free(d->stack);
+    free(d->list);
+    free(d->states);
+    free(d->trans);
+    free(d->index);
+    free(d);
+}
+
+/*
+ * re_closure()
+ *
+ * Append to d->list the instructions reachable from pc without
+ * consuming a byte, in priority order.
+ */
+static void re_closure(re_dfa_t *d, int pc, int *n)
+{
+    int sp = 0;
+
+    d->stack[sp++] = pc;
+    while (sp) {
+        pc = d->stack[--sp];
+        if (d->mark[pc] == d->gen) continue;
+        d->mark[pc] = d->gen;
+
+        re_inst_t *i = &d->prog.insts[pc];
+        switch (i->op) {
+        case I_JMP:
+            d->stack[sp++] = i->x;
+            break;
+
+        case I_SPLIT:
+            d->stack[sp++] = i->y;
+            d->stack[sp++] = i->x;
+            break;
+
+        default:
+            d->list[(*n)++] = pc;
+            break;
+        }
+    }
+}
+
+/*
+ * re_dfa_state()
+ *
+ * The state for the n instructions in d->list, adding it if need be.
+ * *flushed is set if the cache had to be emptied to make room.
+ */
+static int re_dfa_state(fre_t *re, re_dfa_t *d, int n, int *flushed)
+{
+    uint32_t h = 2166136261u;
+
+    for (int i = 0; i < n; i++) {
+        h = (h ^ d->list[i]) * 16777619u;
+    }
+
+    if (n == 0) {
+        return 0;
+    }
+
+    int slot = h & (d->nindex - 1);
+    for (; d->index[slot] >= 0; slot = (slot + 1) & (d->nindex - 1)) {
+        re_state_t *s = &d->states[d->index[slot]];
+        if (s->hash == h && s->n == n && memcmp(s->insts, d->list, n * sizeof(int)) == 0) {
+            return d->index[slot];
+        }
+    }
+
+    if (d->nstates == RE_MAX_STATES) {
+        re_dfa_reset(re, d);
+        *flushed = 1;
+        return re_dfa_state(re, d, n, flushed);
+    }
+
+    int id = d->nstates++;
+    re_state_t *s = &d->states[id];
+    s->n = n;
+    s->insts = malloc(n * sizeof(int));
+    memcpy(s->insts, d->list, n * sizeof(int));
+    s->hash = h;
+    s->match = 0;
+    for (int i = 0; i < n; i++) {
+        if (d->prog.insts[s->insts[i]].op == I_MATCH) s->match = 1;
+    }
+    for (int c = 0; c < re->nclasses; c++) {
+        d->trans[id * re->nclasses + c] = -1;
+    }
+    d->index[slot] = id;
+
+    return id;
+}
+
+static int re_dfa_step(fre_t *re, re_dfa_t *d, int state, int c);
+
+/*
+ * re_dfa_accel()
+ *
+ * An unanchored search spends most of its time in the start state,
+ * waiting for a byte which could begin a match.  Note the bytes which
+ * leave it where they are, so the scan can skip over them in a tight
+ * loop.
+ */
+static void re_dfa_accel(fre_t *re, re_dfa_t *d)
+{
+    int start = d->start;
+
+    d->accel = 0;
+    if (d->states[start].match) {
+        return;
+    }
+
+    for (int c = 0; c < re->nclasses; c++) {
+        int next = d->trans[start * re->nclasses + c];
+        if (next < 0) {
+            next = re_dfa_step(re, d, start, c);
+        }
+        if (d->start != start) {
+            return;  // Flushed
+        }
+        for (int b = 0; b < 256; b++) {
+            if (re->cls[b] == c) d->stay[b] = (next == start);
+        }
+        d->accel |= (next == start);
+    }
+}
+
+static int re_dfa_start(fre_t *re, re_dfa_t *d)
+{
+    while (d->start < 0) {  // Again if re_dfa_accel() flushed the cache
+        int n = 0, flushed = 0;
+        d->gen++;
+        re_closure(d, 0, &n);
+        d->start = re_dfa_state(re, d, n, &flushed);
+        re_dfa_accel(re, d);
+    }
+    return d->start;
+}
+
+/*
+ * re_dfa_step()
+ *
+ * Build the transition from state on byte class c.
+ */
+static int re_dfa_step(fre_t *re, re_dfa_t *d, int state, int c)
+{
+    re_state_t *s = &d->states[state];
+    int byte = re->rep[c];
+    int n = 0, flushed = 0;
+
+    d->gen++;
+    for (int i = 0; i < s->n; i++) {
+        re_inst_t *inst = &d->prog.insts[s->insts[i]];
+
+        if (inst->op == I_MATCH) {
+            if (!d->longest) break;  // Lower priority threads lose to this match
+            continue;
+        }
+
+        if (re_set_has(&re->sets[inst->set], byte)) {
+            re_closure(d, s->insts[i] + 1, &n);
+        }
+    }
+
+    int next = re_dfa_state(re, d, n, &flushed);
+    if (!flushed) {
+        d->trans[state * re->nclasses + c] = next;
+    }
+    return next;
+}
+
+/***********************************
+ *
+ * Byte classes
+ *
+ * Bytes which every set in the pattern treats alike share a class, and
+ * DFA transitions are per class rather than per byte.
+ *
+ ***********************************/
+
+static void re_byte_classes(fre_t *re)
+{
+    int cls[256], map[512], n = 1;
+
+    for (int b = 0; b < 256; b++) cls[b] = 0;
+
+    for (int s = 0; s < re->nsets; s++) {
+        for (int i = 0; i < 512; i++) map[i] = -1;
+        n = 0;
+        for (int b = 0; b < 256; b++) {
+            int key = cls[b] * 2 + re_set_has(&re->sets[s], b);
+            if (map[key] < 0) map[key] = n++;
+            cls[b] = map[key];
+        }
+    }
+
+    re->nclasses = n;
+    for (int b = 255; b >= 0; b--) {
+        re->cls[b] = cls[b];
+        re->rep[cls[b]] = b;
+    }
+}
+
+/***********************************
+ *
+ * The regex object
+ *
+ ***********************************/
+
+fobj_t *fregex_new(fenv_t *f, fobj_t *pattern)
+{
+    fre_t *re = calloc(1, sizeof(*re));
+    re_parse_t ps;
+
+    ps.f = f;
+    ps.re = re;
+    ps.p = pattern->u.str.buf;
+    ps.end = ps.p + pattern->u.str.len;
+    ps.depth = 0;
+    ps.top_alt = 0;
+
+    if (ps.p < ps.end && *ps.p == '^') {
+        re->bol = 1;
+        ps.p++;
+    }
+    if (ps.end > ps.p && ps.end[-1] == '$') {
+        int escapes = 0;
+        for (const char *q = ps.end - 2; q >= ps.p && *q == '\\'; q--) escapes++;
+        if (escapes % 2 == 0) {
+            re->eol = 1;
+            ps.end--;
+        }
+    }
+
+    re->root = re_parse_alt(&ps);
+    FASSERT(ps.p == ps.end, "regex has an unmatched )");
+    FASSERT(!ps.top_alt || (!re->bol && !re->eol),
+            "regex ^ and $ can't go with a | outside a group: write ^(a|b) or (a|b)$");
+
+    fobj_t *p = fobj_new(f, FOBJ_REGEX);
+    p->u.regex.pattern = pattern;
+    p->u.regex.re = re;
+    return p;
+}
+
+void fregex_visit(fenv_t *f, fobj_t *p)
+{
+    fobj_visit(f, p->u.regex.pattern);
+}
+
+void fregex_free(fenv_t *f, fobj_t *p)
+{
+    fre_t *re = p->u.regex.re;
+
+    if (!re) return;
+
+    re_dfa_free(re, re->fwd);
+    re_dfa_free(re, re->rev);
+    re_dfa_free(re, re->full);
+    free(re->nodes);
+    free(re->sets);
+    free(re);
+    p->u.regex.re = NULL;
+}
+
+void fregex_print(fenv_t *f, fobj_t *p)
+{
+    fout_printf(f, "regex(");
+    fstr_print(f, p->u.regex.pattern);
+    fout_printf(f, ")");
+}
+
+/*
+ * The DFAs are made the first time they're needed.  Every set the
+ * programs use, including the .*? prefix's, must exist before the byte
+ * classes are worked out.
+ */
+static void re_prepare(fre_t *re)
+{
+    if (re->fwd) return;
+
+    re->any = re_new_set(re);
+    memset(&re->sets[re->any], 0xff, sizeof(re_set_t));
+    re_byte_classes(re);
+
+    re->fwd  = re_dfa_new(re, 0, !re->bol, re->eol);
+    re->rev  = re_dfa_new(re, 1, 0, 1);
+    re->full = re_dfa_new(re, 0, 0, 1);
+}
+
+/*
+ * re_scan_forward()
+ *
+ * Run d over p[from, len) and return the end of the match (the last
+ * point at which the DFA was in a matching state), or -1.  If at_end, a
+ * match only counts if it reaches len.
+ */
+static long re_scan_forward(fre_t *re, re_dfa_t *d, const uint8_t *p,
+                            long from, long len, int at_end)
+{
+    int nc = re->nclasses;
+    int s = re_dfa_start(re, d);
+    long last = -1, i;
+
+    for (i = from; ; i++) {
+        if (s == d->start && d->accel) {
+            while (i < len && d->stay[p[i]]) i++;
+        }
+        if (d->states[s].match) {
+            last = i;
+        }
+        if (i == len) {
+            break;
+        }
+
+        int c = re->cls[p[i]];
+        int next = d->trans[s * nc + c];
+        if (next < 0) {
+            next = re_dfa_step(re, d, s, c);
+        }
+        if (next == 0) {
+            break;
+        }
+        s = next;
+    }
+
+    if (at_end) {
+        return (i == len && d->states[s].match) ? len : -1;
+    }
+    return last;
+}
+
+/*
+ * re_scan_backward()
+ *
+ * Run the reversed program back from end (no further than from) and
+ * return the earliest start of a match ending at end.
+ */
+static long re_scan_backward(fre_t *re, re_dfa_t *d, const uint8_t *p, long from, long end)
+{
+    int nc = re->nclasses;
+    int s = re_dfa_start(re, d);
+    long first = -1;
+
+    for (long i = end; ; i--) {
+        if (d->states[s].match) {
+            first = i;
+        }
+        if (i == from) {
+            break;
+        }
+
+        int c = re->cls[p[i - 1]];
+        int next = d->trans[s * nc + c];
+        if (next < 0) {
+            next = re_dfa_step(re, d, s, c);
+        }
+        if (next == 0) {
+            break;
+        }
+        s = next;
+    }
+
+    return first;
+}
+
+/*
+ * fregex_search()
+ *
+ * Find the leftmost match in buf[from, len).  Returns 1 and sets *start
+ * and *end if there is one.
+ */
+int fregex_search(fenv_t *f, fobj_t *regex, const void *buf, long len,
+                  long from, long *start, long *end)
+{
+    fre_t *re = regex->u.regex.re;
+    const uint8_t *p = buf;
+
+    if (re->bol && from > 0) {
+        return 0;
+    }
+
+    re_prepare(re);
+
+    long e = re_scan_forward(re, re->fwd, p, from, len, re->eol);
+    if (e < 0) {
+        return 0;
+    }
+
+    long s = re->bol ? from : re_scan_backward(re, re->rev, p, from, e);
+    ASSERT(s >= 0);
+
+    *start = s;
+    *end = e;
+    return 1;
+}
+
+/*
+ * fregex_match()
+ *
+ * Whether all of buf matches.
+ */
+int fregex_match(fenv_t *f, fobj_t *regex, const void *buf, long len)
+{
+    fre_t *re = regex->u.regex.re;
+
+    re_prepare(re);
+    return re_scan_forward(re, re->full, buf, 0, len, 1) == len;
+}
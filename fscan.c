@@ -0,0 +1,441 @@
+/*
+ * This file is part of arm-sim: http://madscientistroom.org/arm-sim
+ *
+ * Copyright (c) 2010 Randy Thelen. All rights reserved, and all wrongs
+ * reversed. (See the file COPYRIGHT for details.)
+ */
+
+#include "forth.h"
+#include "fobj.h"
+
+/*
+ * Memory scanning kernels
+ *
+ * These are the inner loops behind search, compare, count-byte and
+ * friends.  Each has a portable scalar version and, on x86, SSE2 (which
+ * every x86-64 has) and AVX2 (picked at run time) versions.  They work on
+ * plain pointers so they serve both strings and bytes buffers.
+ *
+ * Searches return the offset of the match or FSCAN_NONE.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define FSCAN_X86	1
+#include <immintrin.h>
+#else
+#define FSCAN_X86	0
+#endif
+
+#define AVX2		__attribute__((target("avx2")))
+
+static int fscan_have_avx2(void)
+{
+#if FSCAN_X86
+    static int have = -1;
+
+    if (have < 0) {
+        __builtin_cpu_init();
+        have = __builtin_cpu_supports("avx2") ? 1 : 0;
+    }
+    return have;
+#else
+    return 0;
+#endif
+}
+
+static int ctz(uint32_t x)
+{
+    return __builtin_ctz(x);
+}
+
+/***********************************
+ *
+ * Byte search (memmem)
+ *
+ * The vector versions compare the first and last bytes of the needle
+ * against 16 (or 32) positions at once and only memcmp() the positions
+ * where both match.
+ *
+ ***********************************/
+
+static size_t fscan_search_scalar(const uint8_t *h, size_t hlen,
+                                  const uint8_t *n, size_t nlen, size_t i)
+{
+    for (; i + nlen <= hlen; i++) {
+        if (h[i] == n[0] && memcmp(h + i, n, nlen) == 0) {
+            return i;
+        }
+    }
+
+    return FSCAN_NONE;
+}
+
+#if FSCAN_X86
+static size_t fscan_search_sse2(const uint8_t *h, size_t hlen,
+                                const uint8_t *n, size_t nlen)
+{
+    const __m128i first = _mm_set1_epi8(n[0]);
+    const __m128i last  = _mm_set1_epi8(n[nlen - 1]);
+    size_t i = 0;
+
+    for (; i + nlen - 1 + 16 <= hlen; i += 16) {
+        __m128i bf = _mm_loadu_si128((const __m128i *) (h + i));
+        __m128i bl = _mm_loadu_si128((const __m128i *) (h + i + nlen - 1));
+        uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(bf, first),
+                                                        _mm_cmpeq_epi8(bl, last)));
+        while (mask) {
+            int bit = ctz(mask);
+            if (nlen <= 2 || memcmp(h + i + bit + 1, n + 1, nlen - 2) == 0) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return fscan_search_scalar(h, hlen, n, nlen, i);
+}
+
+static AVX2 size_t fscan_search_avx2(const uint8_t *h, size_t hlen,
+                                     const uint8_t *n, size_t nlen)
+{
+    const __m256i first = _mm256_set1_epi8(n[0]);
+    const __m256i last  = _mm256_set1_epi8(n[nlen - 1]);
+    size_t i = 0;
+
+    for (; i + nlen - 1 + 32 <= hlen; i += 32) {
+        __m256i bf = _mm256_loadu_si256((const __m256i *) (h + i));
+        __m256i bl = _mm256_loadu_si256((const __m256i *) (h + i + nlen - 1));
+        uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(bf, first),
+                                                              _mm256_cmpeq_epi8(bl, last)));
+        while (mask) {
+            int bit = ctz(mask);
+            if (nlen <= 2 || memcmp(h + i + bit + 1, n + 1, nlen - 2) == 0) {
+                return i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    return fscan_search_scalar(h, hlen, n, nlen, i);
+}
+#endif
+
+size_t fscan_search(const void *hay, size_t hlen, const void *needle, size_t nlen)
+{
+    const uint8_t *h = hay, *n = needle;
+
+    if (nlen == 0)   return 0;
+    if (nlen > hlen) return FSCAN_NONE;
+
+#if FSCAN_X86
+    if (fscan_have_avx2()) {
+        return fscan_search_avx2(h, hlen, n, nlen);
+    }
+    return fscan_search_sse2(h, hlen, n, nlen);
+#else
+    return fscan_search_scalar(h, hlen, n, nlen, 0);
+#endif
+}
+
+/*
+ * fscan_rsearch()
+ *
+ * The last occurrence of needle in hay.
+ */
+size_t fscan_rsearch(const void *hay, size_t hlen, const void *needle, size_t nlen)
+{
+    const uint8_t *h = hay, *n = needle;
+
+    if (nlen > hlen) return FSCAN_NONE;
+    if (nlen == 0)   return hlen;
+
+    for (size_t i = hlen - nlen + 1; i-- > 0; ) {
+        if (h[i] == n[0] && memcmp(h + i, n, nlen) == 0) {
+            return i;
+        }
+    }
+
+    return FSCAN_NONE;
+}
+
+/***********************************
+ *
+ * Masked search
+ *
+ * Find the first i where (hay[i + j] & mask[j]) == (pat[j] & mask[j])
+ * for every j.  The vector versions filter on the first byte of the
+ * pattern which has a non-zero mask.
+ *
+ ***********************************/
+
+static int fscan_masked_match(const uint8_t *h, const uint8_t *p,
+                              const uint8_t *m, size_t len)
+{
+    for (size_t j = 0; j < len; j++) {
+        if ((h[j] ^ p[j]) & m[j]) return 0;
+    }
+    return 1;
+}
+
+size_t fscan_search_masked(const void *hay, size_t hlen, const void *pat,
+                           const void *mask, size_t len)
+{
+    const uint8_t *h = hay, *p = pat, *m = mask;
+    size_t i = 0, k = 0;
+
+    if (len > hlen) return FSCAN_NONE;
+
+    while (k < len && m[k] == 0) k++;
+    if (k == len) return 0;  // Everything is masked off
+
+#if FSCAN_X86
+    const __m128i vm = _mm_set1_epi8(m[k]);
+    const __m128i vp = _mm_set1_epi8(p[k] & m[k]);
+
+    for (; i + k + 16 <= hlen; i += 16) {
+        __m128i b = _mm_and_si128(_mm_loadu_si128((const __m128i *) (h + i + k)), vm);
+        uint32_t bits = _mm_movemask_epi8(_mm_cmpeq_epi8(b, vp));
+        while (bits) {
+            int bit = ctz(bits);
+            if (i + bit + len <= hlen && fscan_masked_match(h + i + bit, p, m, len)) {
+                return i + bit;
+            }
+            bits &= bits - 1;
+        }
+    }
+#endif
+
+    for (; i + len <= hlen; i++) {
+        if (fscan_masked_match(h + i, p, m, len)) {
+            return i;
+        }
+    }
+
+    return FSCAN_NONE;
+}
+
+/***********************************
+ *
+ * Mismatch (first difference)
+ *
+ ***********************************/
+
+#if FSCAN_X86
+static AVX2 size_t fscan_mismatch_avx2(const uint8_t *a, const uint8_t *b, size_t len)
+{
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i va = _mm256_loadu_si256((const __m256i *) (a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i *) (b + i));
+        uint32_t eq = _mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+        if (eq != 0xffffffffu) {
+            return i + ctz(~eq);
+        }
+    }
+
+    for (; i < len; i++) {
+        if (a[i] != b[i]) return i;
+    }
+    return len;
+}
+#endif
+
+/*
+ * fscan_mismatch()
+ *
+ * Return the offset of the first byte which differs between a and b, or
+ * len if they're the same.
+ */
+size_t fscan_mismatch(const void *va, const void *vb, size_t len)
+{
+    const uint8_t *a = va, *b = vb;
+    size_t i = 0;
+
+#if FSCAN_X86
+    if (fscan_have_avx2()) {
+        return fscan_mismatch_avx2(a, b, len);
+    }
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i xa = _mm_loadu_si128((const __m128i *) (a + i));
+        __m128i xb = _mm_loadu_si128((const __m128i *) (b + i));
+        uint32_t eq = _mm_movemask_epi8(_mm_cmpeq_epi8(xa, xb));
+        if (eq != 0xffff) {
+            return i + ctz(~eq & 0xffff);
+        }
+    }
+#endif
+
+    for (; i < len; i++) {
+        if (a[i] != b[i]) return i;
+    }
+    return len;
+}
+
+/*
+ * fscan_compare()
+ *
+ * memcmp() style ordering of two byte strings of possibly different
+ * lengths: -1, 0 or 1.
+ */
+int fscan_compare(const void *a, size_t alen, const void *b, size_t blen)
+{
+    size_t n = alen < blen ? alen : blen;
+    size_t i = fscan_mismatch(a, b, n);
+
+    if (i < n) {
+        return ((const uint8_t *) a)[i] < ((const uint8_t *) b)[i] ? -1 : 1;
+    }
+
+    if (alen == blen) return 0;
+    return alen < blen ? -1 : 1;
+}
+
+/***********************************
+ *
+ * Finding any of three bytes
+ *
+ * Used to find the next delimiter or end of line in delimited text.
+ *
+ ***********************************/
+
+#if FSCAN_X86
+static AVX2 size_t fscan_find3_avx2(const uint8_t *p, size_t len, uint8_t a, uint8_t b, uint8_t c)
+{
+    const __m256i va = _mm256_set1_epi8(a);
+    const __m256i vb = _mm256_set1_epi8(b);
+    const __m256i vc = _mm256_set1_epi8(c);
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (p + i));
+        __m256i eq = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, va),
+                                                     _mm256_cmpeq_epi8(v, vb)),
+                                     _mm256_cmpeq_epi8(v, vc));
+        uint32_t mask = _mm256_movemask_epi8(eq);
+        if (mask) {
+            return i + ctz(mask);
+        }
+    }
+    for (; i < len; i++) {
+        if (p[i] == a || p[i] == b || p[i] == c) return i;
+    }
+    return FSCAN_NONE;
+}
+#endif
+
+size_t fscan_find3(const void *buf, size_t len, int a, int b, int c)
+{
+    const uint8_t *p = buf;
+    size_t i = 0;
+
+#if FSCAN_X86
+    if (len >= 32 && fscan_have_avx2()) {
+        return fscan_find3_avx2(p, len, a, b, c);
+    }
+
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    const __m128i vc = _mm_set1_epi8(c);
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+        __m128i eq = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, va),
+                                               _mm_cmpeq_epi8(v, vb)),
+                                  _mm_cmpeq_epi8(v, vc));
+        uint32_t mask = _mm_movemask_epi8(eq);
+        if (mask) {
+            return i + ctz(mask);
+        }
+    }
+#endif
+
+    for (; i < len; i++) {
+        if (p[i] == (uint8_t) a || p[i] == (uint8_t) b || p[i] == (uint8_t) c) return i;
+    }
+    return FSCAN_NONE;
+}
+
+/***********************************
+ *
+ * Counting and filling
+ *
+ ***********************************/
+
+#if FSCAN_X86
+static AVX2 size_t fscan_count_avx2(const uint8_t *p, size_t len, uint8_t c)
+{
+    const __m256i vc = _mm256_set1_epi8(c);
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i total = _mm256_setzero_si256();
+    size_t i = 0, count = 0;
+
+    /*
+     * The per-byte counters are subtracted (a match is -1) for up to 255
+     * rounds and then folded into 64-bit lanes with sad.
+     */
+    while (i + 32 <= len) {
+        __m256i acc = _mm256_setzero_si256();
+        for (int r = 0; r < 255 && i + 32 <= len; r++, i += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i *) (p + i));
+            acc = _mm256_sub_epi8(acc, _mm256_cmpeq_epi8(v, vc));
+        }
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(acc, zero));
+    }
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *) lanes, total);
+    count = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+    for (; i < len; i++) {
+        count += p[i] == c;
+    }
+    return count;
+}
+#endif
+
+size_t fscan_count_byte(const void *buf, size_t len, int c)
+{
+    const uint8_t *p = buf;
+    size_t i = 0, count = 0;
+
+#if FSCAN_X86
+    if (fscan_have_avx2()) {
+        return fscan_count_avx2(p, len, c);
+    }
+
+    const __m128i vc = _mm_set1_epi8(c);
+    const __m128i zero = _mm_setzero_si128();
+    __m128i total = _mm_setzero_si128();
+
+    while (i + 16 <= len) {
+        __m128i acc = _mm_setzero_si128();
+        for (int r = 0; r < 255 && i + 16 <= len; r++, i += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+            acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(v, vc));
+        }
+        total = _mm_add_epi64(total, _mm_sad_epu8(acc, zero));
+    }
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *) lanes, total);
+    count = lanes[0] + lanes[1];
+#endif
+
+    for (; i < len; i++) {
+        count += p[i] == (uint8_t) c;
+    }
+    return count;
+}
+
+/*
+ * fscan_fill()
+ *
+ * The C library's memset() is already vectorized on every platform we
+ * care about, so it is the fill kernel.
+ */
+void fscan_fill(void *buf, size_t len, int c)
+{
+    memset(buf, c, len);
+}
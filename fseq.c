@@ -0,0 +1,240 @@
+/*
+ * This file is part of arm-sim: http://madscientistroom.org/arm-sim
+ *
+ * Copyright (c) 2010 Randy Thelen. All rights reserved, and all wrongs
+ * reversed. (See the file COPYRIGHT for details.)
+ */
+
+#include "forth.h"
+#include "fobj.h"
+
+/*
+ * Lazy sequences
+ *
+ * A seq describes a sequence of values without holding them: a numeric
+ * range, a mapped or filtered view of another seq, or a generator word.
+ * Values are made one at a time by an iter (a cursor on a seq) as the
+ * consumer asks for them, so walking a million element range takes no
+ * more memory than walking a ten element one.
+ *
+ * Mapping, filtering and generator words are called with the data stack
+ * as their interface:
+ *    map xt:        value -- value'
+ *    filter xt:     value -- flag
+ *    generator xt:  state -- state' value true  |  state -- false
+ *
+ * A range's bounds are long doubles, so they're kept out of the seq
+ * object to keep every object small.
+ */
+
+struct fseq_range_s {
+    fnumber_t		 start;
+    fnumber_t		 limit;
+    fnumber_t		 step;
+};
+
+fobj_t *fseq_new(fenv_t *f, int kind, fobj_t *src, fobj_t *xt)
+{
+    fobj_t *p = fobj_new(f, FOBJ_SEQ);
+    fseq_t *s = &p->u.seq;
+
+    s->kind = kind;
+    s->range = NULL;
+    s->src = src;
+    s->xt = xt;
+
+    return p;
+}
+
+fobj_t *fseq_range(fenv_t *f, fnumber_t start, fnumber_t limit, fnumber_t step)
+{
+    FASSERT(step != 0, "a range can't have a step of 0");
+
+    fobj_t *p = fseq_new(f, FSEQ_RANGE, NULL, NULL);
+    fseq_range_t *r = malloc(sizeof(*r));
+
+    FASSERT(r, "out of memory for a range");
+    r->start = start;
+    r->limit = limit;
+    r->step = step;
+    p->u.seq.range = r;
+    return p;
+}
+
+void fseq_visit(fenv_t *f, fobj_t *p)
+{
+    fobj_visit(f, p->u.seq.src);
+    fobj_visit(f, p->u.seq.xt);
+}
+
+void fseq_free(fenv_t *f, fobj_t *p)
+{
+    free(p->u.seq.range);
+    p->u.seq.range = NULL;
+}
+
+void fseq_print(fenv_t *f, fobj_t *p)
+{
+    fseq_t *s = &p->u.seq;
+
+    switch (s->kind) {
+    case FSEQ_RANGE:
+        fout_printf(f, "range(%Lg, %Lg, %Lg)", s->range->start, s->range->limit, s->range->step);
+        break;
+
+    case FSEQ_MAP:
+        fout_printf(f, "map(");
+        fobj_print(f, s->src);
+        fout_printf(f, ")");
+        break;
+
+    case FSEQ_FILTER:
+        fout_printf(f, "filter(");
+        fobj_print(f, s->src);
+        fout_printf(f, ")");
+        break;
+
+    case FSEQ_GEN:
+        fout_printf(f, "generator");
+        break;
+    }
+}
+
+/***********************************
+ *
+ * Iterators
+ *
+ ***********************************/
+
+fobj_t *fiter_new(fenv_t *f, fobj_t *seq)
+{
+    FASSERT(seq && seq->type == FOBJ_SEQ, "A sequence was expected here");
+
+    fobj_t *p = fobj_new(f, FOBJ_ITER);
+    fiter_t *it = &p->u.iter;
+    fseq_t *s = &seq->u.seq;
+
+    it->seq = seq;
+    it->pos = s->range ? s->range->start : 0;
+    it->src = NULL;
+    it->state = NULL;
+
+    switch (s->kind) {
+    case FSEQ_MAP:
+    case FSEQ_FILTER:
+        it->src = fiter_new(f, s->src);
+        break;
+
+    case FSEQ_GEN:
+        it->state = s->src;  // The initial state
+        break;
+    }
+
+    return p;
+}
+
+void fiter_visit(fenv_t *f, fobj_t *p)
+{
+    fiter_t *it = &p->u.iter;
+
+    fobj_visit(f, it->seq);
+    fobj_visit(f, it->src);
+    fobj_visit(f, it->state);
+}
+
+static void fiter_call(fenv_t *f, fobj_t *xt)
+{
+    xt->u.word.code(f, xt);
+}
+
+static fobj_t *fiter_pop(fenv_t *f)
+{
+    return fstack_fetch(f, f->dstack, NULL);
+}
+
+static void fiter_push(fenv_t *f, fobj_t *p)
+{
+    fstack_store(f, f->dstack, NULL, p);
+}
+
+static int fiter_pop_flag(fenv_t *f)
+{
+    fobj_t *flag = fiter_pop(f);
+    FASSERT(flag && flag->type == FOBJ_NUM, "A flag was expected here");
+    return flag->u.num.n != 0;
+}
+
+/*
+ * fiter_next()
+ *
+ * Produce the next value of the iterator's sequence in *value.  Returns
+ * 0 when the sequence is done.
+ */
+int fiter_next(fenv_t *f, fobj_t *iter, fobj_t **value)
+{
+    fiter_t *it = &iter->u.iter;
+    fseq_t *s = &it->seq->u.seq;
+    fobj_t *v;
+
+    switch (s->kind) {
+    case FSEQ_RANGE: {
+        fseq_range_t *r = s->range;
+
+        if (r->step > 0 ? it->pos >= r->limit : it->pos <= r->limit) {
+            return 0;
+        }
+        *value = fnum_new(f, it->pos);
+        it->pos += r->step;
+        return 1;
+    }
+
+    case FSEQ_MAP:
+        if (!fiter_next(f, it->src, &v)) {
+            return 0;
+        }
+        fiter_push(f, v);
+        fiter_call(f, s->xt);
+        *value = fiter_pop(f);
+        return 1;
+
+    case FSEQ_FILTER: {
+        /*
+         * Rejected values are let go as we pass them so a filter which
+         * skips a million values doesn't hold a million objects.
+         */
+        int mark = fobj_hold_mark(f);
+
+        while (fiter_next(f, it->src, &v)) {
+            /*
+             * Keep a copy of the value on the stack under the flag so it
+             * stays reachable while the filter word runs.
+             */
+            fiter_push(f, v);
+            fiter_push(f, v);
+            fiter_call(f, s->xt);
+            int keep = fiter_pop_flag(f);
+            v = fiter_pop(f);
+            if (keep) {
+                *value = v;
+                return 1;
+            }
+            fobj_hold_release(f, mark);
+        }
+        return 0;
+    }
+
+    case FSEQ_GEN:
+        fiter_push(f, it->state);
+        fiter_call(f, s->xt);
+        if (!fiter_pop_flag(f)) {
+            it->state = NULL;
+            return 0;
+        }
+        *value = fiter_pop(f);
+        it->state = fiter_pop(f);
+        return 1;
+    }
+
+    ASSERT(0);
+    return 0;
+}
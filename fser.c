@@ -0,0 +1,999 @@
+/*
+ * This file is part of arm-sim: http://madscientistroom.org/arm-sim
+ *
+ * Copyright (c) 2010 Randy Thelen. All rights reserved, and all wrongs
+ * reversed. (See the file COPYRIGHT for details.)
+ */
+
+#include <errno.h>
+#include <float.h>
+#include <math.h>
+
+#include "forth.h"
+#include "fobj.h"
+
+/*
+ * Serialization
+ *
+ * A graph of numbers, strings, bytes, tables and hashes can be written
+ * out and read back, either in a compact binary form or as JSON.
+ *
+ * The binary form is "FSER", a version byte and then one value: a tag
+ * byte and what follows it.
+ *
+ *	Z				an empty slot (a hole in an array part)
+ *	I varint			an integer in the int64_t range, zigzag encoded
+ *	U varint			an integer from 2^63 to 2^64 - 1 (an address, say)
+ *	F varint varint			any other finite number, exactly: its zigzag
+ *					binary exponent times 2 plus its sign, then
+ *					an odd mantissa
+ *	D 8 bytes			an infinity or NaN, as a little-endian double
+ *	S varint bytes			a string of that many bytes
+ *	Y varint bytes			a bytes object
+ *	T varint values varint pairs	a table: its array part, then its hash part
+ *	H varint pairs			a hash
+ *	R varint			the nth string, bytes, table or hash so far
+ *
+ * Strings, bytes, tables and hashes are numbered as they're first written
+ * and are an R after that, so what was shared is shared again when it's
+ * loaded, cycles included.  The counts come before the contents, so each
+ * table and hash is loaded at its final size.
+ *
+ * JSON has no references: a shared table is written out each time it's
+ * reached and a cycle is an error.  A table with nothing in its hash part
+ * is written as an array and anything else as an object, number keys
+ * becoming strings.  Loaded, each array and object is a table, true and
+ * false are -1 and 0, and null is an empty slot.
+ */
+
+#define FSER_MAGIC			"FSER"
+#define FSER_VERSION		2		// Version 1 had no U or F and is still read
+#define FSER_BUF_SIZE		(64 * 1024)	// Written to the file when full
+#define FSER_MAX_DEPTH		10000		// Nesting, to bound the recursion
+
+/***********************************
+ *
+ * Writing
+ *
+ ***********************************/
+
+typedef struct fser_writer_s {
+    fenv_t		*f;
+    int			 json;
+
+    FILE		*fp;			// Where the buffer's flushed, or NULL to keep it all
+    unsigned char	*buf;
+    size_t		 len;
+    size_t		 cap;
+
+    fobj_t		**ref_objs;		// Objects written so far (binary), open addressed
+    int			*ref_ids;
+    int			 num_refs;
+    int			 cap_refs;		// A power of two
+
+    fobj_t		**open;			// Containers being written (JSON), for cycles
+    int			 depth;
+} fser_writer_t;
+
+static void fser_flush(fser_writer_t *w)
+{
+    fenv_t *f = w->f;
+
+    if (w->fp && w->len) {
+        FASSERT(fwrite(w->buf, 1, w->len, w->fp) == w->len,
+                "write failed: %s", strerror(errno));
+        w->len = 0;
+    }
+}
+
+static void fser_put(fser_writer_t *w, const void *p, size_t n)
+{
+    fenv_t *f = w->f;
+
+    if (w->len + n > w->cap) {
+        if (w->fp) {
+            fser_flush(w);
+            if (n > w->cap) {
+                FASSERT(fwrite(p, 1, n, w->fp) == n, "write failed: %s", strerror(errno));
+                return;
+            }
+        } else {
+            size_t cap = 2 * w->cap;
+            if (cap < w->len + n) cap = w->len + n;
+            w->buf = realloc(w->buf, cap);
+            FASSERT(w->buf, "out of memory serializing");
+            w->cap = cap;
+        }
+    }
+    memcpy(w->buf + w->len, p, n);
+    w->len += n;
+}
+
+static inline void fser_put_byte(fser_writer_t *w, int c)
+{
+    if (w->len < w->cap) {
+        w->buf[w->len++] = c;
+    } else {
+        unsigned char b = c;
+        fser_put(w, &b, 1);
+    }
+}
+
+static void fser_put_varint(fser_writer_t *w, uint64_t v)
+{
+    unsigned char b[10];
+    int n = 0;
+
+    while (v >= 0x80) {
+        b[n++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    b[n++] = v;
+    fser_put(w, b, n);
+}
+
+/*
+ * fser_ref()
+ *
+ * The number of p if it's been written before, else -1 (and p is given
+ * the next number).
+ */
+static int fser_ref(fser_writer_t *w, fobj_t *p)
+{
+    if (2 * (w->num_refs + 1) > w->cap_refs) {
+        fobj_t **objs = w->ref_objs;
+        int *ids = w->ref_ids;
+        int cap = w->cap_refs;
+
+        w->cap_refs = cap ? 2 * cap : 256;
+        w->ref_objs = calloc(w->cap_refs, sizeof(fobj_t *));
+        w->ref_ids = malloc(w->cap_refs * sizeof(int));
+        for (int i = 0; i < cap; i++) {
+            if (objs[i]) {
+                int j = fobj_hash_mix((uintptr_t) objs[i]) & (w->cap_refs - 1);
+                while (w->ref_objs[j]) j = (j + 1) & (w->cap_refs - 1);
+                w->ref_objs[j] = objs[i];
+                w->ref_ids[j] = ids[i];
+            }
+        }
+        free(objs);
+        free(ids);
+    }
+
+    int j = fobj_hash_mix((uintptr_t) p) & (w->cap_refs - 1);
+    while (w->ref_objs[j]) {
+        if (w->ref_objs[j] == p) {
+            return w->ref_ids[j];
+        }
+        j = (j + 1) & (w->cap_refs - 1);
+    }
+    w->ref_objs[j] = p;
+    w->ref_ids[j] = w->num_refs++;
+    return -1;
+}
+
+static void fser_write_bin(fser_writer_t *w, fobj_t *p)
+{
+    fenv_t *f = w->f;
+
+    if (!p) {
+        fser_put_byte(w, 'Z');
+        return;
+    }
+
+    if (p->type == FOBJ_NUM) {
+        fnumber_t n = p->u.num.n;
+
+        if (n >= -9223372036854775808.0L && n < 9223372036854775808.0L &&
+            n == (fnumber_t) (int64_t) n) {
+            int64_t i = (int64_t) n;
+            fser_put_byte(w, 'I');
+            fser_put_varint(w, ((uint64_t) i << 1) ^ (uint64_t) (i >> 63));
+        } else if (n >= 9223372036854775808.0L && n < 18446744073709551616.0L &&
+                   n == (fnumber_t) (uint64_t) n) {
+            fser_put_byte(w, 'U');
+            fser_put_varint(w, (uint64_t) n);
+        } else if (LDBL_MANT_DIG <= 64 && n - n == 0) {
+            /*
+             * Finite and not 0: |n| is m * 2^e with m in [0.5, 1), and m
+             * scaled by 2^64 is a whole number as long as fnumber_t has
+             * no more than 64 bits of mantissa (x87 has exactly 64).
+             * Its trailing zeros are dropped.
+             */
+            int e;
+            uint64_t m = (uint64_t) ldexpl(frexpl(n < 0 ? -n : n, &e), 64);
+            int tz = __builtin_ctzll(m);
+            int64_t x = (int64_t) e - 64 + tz;
+
+            fser_put_byte(w, 'F');
+            fser_put_varint(w, ((((uint64_t) x << 1) ^ (uint64_t) (x >> 63)) << 1) | (n < 0));
+            fser_put_varint(w, m >> tz);
+        } else {
+            double d = (double) n;
+            uint64_t bits;
+            unsigned char b[8];
+
+            memcpy(&bits, &d, sizeof(bits));
+            for (int i = 0; i < 8; i++) {
+                b[i] = bits >> (8 * i);
+            }
+            fser_put_byte(w, 'D');
+            fser_put(w, b, 8);
+        }
+        return;
+    }
+
+    FASSERT(p->type == FOBJ_STR || p->type == FOBJ_BYTES ||
+            p->type == FOBJ_TABLE || p->type == FOBJ_HASH,
+            "can't serialize a %s", op_table[p->type].type_name);
+
+    int id = fser_ref(w, p);
+    if (id >= 0) {
+        fser_put_byte(w, 'R');
+        fser_put_varint(w, id);
+        return;
+    }
+
+    FASSERT(++w->depth <= FSER_MAX_DEPTH, "too deeply nested to serialize");
+
+    switch (p->type) {
+    case FOBJ_STR:
+        fser_put_byte(w, 'S');
+        fser_put_varint(w, p->u.str.len);
+        fser_put(w, p->u.str.buf, p->u.str.len);
+        break;
+
+    case FOBJ_BYTES:
+        fser_put_byte(w, 'Y');
+        fser_put_varint(w, p->u.bytes.len);
+        fser_put(w, p->u.bytes.base, p->u.bytes.len);
+        break;
+
+    case FOBJ_TABLE: {
+        farray_t *a = &p->u.table.array->u.array;
+        fobj_t *h = p->u.table.hash;
+
+        fser_put_byte(w, 'T');
+        fser_put_varint(w, a->num);
+        for (int i = 0; i < a->num; i++) {
+            fser_write_bin(w, a->elems[i]);
+        }
+        fser_put_varint(w, fhash_count(f, h));
+        for (int i = 0; i < fhash_count(f, h); i++) {
+            fser_write_bin(w, fhash_key_at(f, h, i));
+            fser_write_bin(w, fhash_val_at(f, h, i));
+        }
+        break;
+    }
+
+    case FOBJ_HASH:
+        fser_put_byte(w, 'H');
+        fser_put_varint(w, fhash_count(f, p));
+        for (int i = 0; i < fhash_count(f, p); i++) {
+            fser_write_bin(w, fhash_key_at(f, p, i));
+            fser_write_bin(w, fhash_val_at(f, p, i));
+        }
+        break;
+    }
+
+    w->depth--;
+}
+
+static void fser_put_json_num(fser_writer_t *w, fnumber_t n)
+{
+    char buf[64];
+    int len;
+
+    if (n != n || n - n != 0) {
+        len = sprintf(buf, "null");  // NaN and infinities
+    } else if (n >= -9223372036854775808.0L && n < 9223372036854775808.0L &&
+               n == (fnumber_t) (long long) n) {
+        len = sprintf(buf, "%lld", (long long) n);
+    } else if (n >= 0 && n < 18446744073709551616.0L &&
+               n == (fnumber_t) (unsigned long long) n) {
+        len = sprintf(buf, "%llu", (unsigned long long) n);
+    } else {
+        /*
+         * The fewest digits that read back as n.  LDBL_DIG + 3 always
+         * do.
+         */
+        for (int digits = LDBL_DIG; ; digits++) {
+            len = sprintf(buf, "%.*Lg", digits, n);
+            if (digits == LDBL_DIG + 3 || strtold(buf, NULL) == n) break;
+        }
+    }
+    fser_put(w, buf, len);
+}
+
+static void fser_put_json_str(fser_writer_t *w, const char *s, size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t start = 0;
+
+    fser_put_byte(w, '"');
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = s[i];
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+
+        fser_put(w, s + start, i - start);
+        start = i + 1;
+
+        char esc[6] = { '\\', 0 };
+        switch (c) {
+        case '"':  esc[1] = '"';  break;
+        case '\\': esc[1] = '\\'; break;
+        case '\n': esc[1] = 'n';  break;
+        case '\t': esc[1] = 't';  break;
+        case '\r': esc[1] = 'r';  break;
+        case '\b': esc[1] = 'b';  break;
+        case '\f': esc[1] = 'f';  break;
+        default:
+            memcpy(esc + 1, "u00", 3);
+            esc[4] = hex[c >> 4];
+            esc[5] = hex[c & 15];
+            fser_put(w, esc, 6);
+            continue;
+        }
+        fser_put(w, esc, 2);
+    }
+    fser_put(w, s + start, len - start);
+    fser_put_byte(w, '"');
+}
+
+static void fser_write_json(fser_writer_t *w, fobj_t *p);
+
+static void fser_put_json_pair(fser_writer_t *w, fobj_t *key, fobj_t *val, int *first)
+{
+    fenv_t *f = w->f;
+
+    if (!*first) fser_put_byte(w, ',');
+    *first = 0;
+
+    if (key->type == FOBJ_STR) {
+        fser_put_json_str(w, key->u.str.buf, key->u.str.len);
+    } else {
+        FASSERT(key->type == FOBJ_NUM, "JSON keys are strings or numbers, not a %s",
+                op_table[key->type].type_name);
+        fser_put_byte(w, '"');
+        fser_put_json_num(w, key->u.num.n);
+        fser_put_byte(w, '"');
+    }
+    fser_put_byte(w, ':');
+    fser_write_json(w, val);
+}
+
+static void fser_write_json(fser_writer_t *w, fobj_t *p)
+{
+    fenv_t *f = w->f;
+
+    if (!p) {
+        fser_put(w, "null", 4);
+        return;
+    }
+
+    switch (p->type) {
+    case FOBJ_NUM:
+        fser_put_json_num(w, p->u.num.n);
+        return;
+    case FOBJ_STR:
+        fser_put_json_str(w, p->u.str.buf, p->u.str.len);
+        return;
+    case FOBJ_TABLE:
+    case FOBJ_HASH:
+        break;
+    default:
+        FASSERT(0, "JSON can't hold a %s", op_table[p->type].type_name);
+    }
+
+    for (int i = 0; i < w->depth; i++) {
+        FASSERT(w->open[i] != p, "a table contains itself, which JSON can't hold");
+    }
+    FASSERT(w->depth < FSER_MAX_DEPTH, "too deeply nested to serialize");
+    if (!w->open) {
+        w->open = malloc(FSER_MAX_DEPTH * sizeof(fobj_t *));
+    }
+    w->open[w->depth++] = p;
+
+    fobj_t *h = p->type == FOBJ_TABLE ? p->u.table.hash : p;
+    farray_t *a = p->type == FOBJ_TABLE ? &p->u.table.array->u.array : NULL;
+    int first = 1;
+
+    if (a && fhash_count(f, h) == 0) {
+        fser_put_byte(w, '[');
+        for (int i = 0; i < a->num; i++) {
+            if (i) fser_put_byte(w, ',');
+            fser_write_json(w, a->elems[i]);
+        }
+        fser_put_byte(w, ']');
+    } else {
+        fser_put_byte(w, '{');
+        for (int i = 0; a && i < a->num; i++) {
+            if (a->elems[i]) {
+                char key[16];
+                int len = sprintf(key, "%d", i);
+                if (!first) fser_put_byte(w, ',');
+                first = 0;
+                fser_put_json_str(w, key, len);
+                fser_put_byte(w, ':');
+                fser_write_json(w, a->elems[i]);
+            }
+        }
+        for (int i = 0; i < fhash_count(f, h); i++) {
+            fser_put_json_pair(w, fhash_key_at(f, h, i), fhash_val_at(f, h, i), &first);
+        }
+        fser_put_byte(w, '}');
+    }
+
+    w->depth--;
+}
+
+static void fser_write(fser_writer_t *w, fobj_t *p)
+{
+    if (w->json) {
+        fser_write_json(w, p);
+    } else {
+        fser_put(w, FSER_MAGIC, 4);
+        fser_put_byte(w, FSER_VERSION);
+        fser_write_bin(w, p);
+    }
+}
+
+static void fser_writer_init(fenv_t *f, fser_writer_t *w, FILE *fp, int json)
+{
+    memset(w, 0, sizeof(*w));
+    w->f = f;
+    w->json = json;
+    w->fp = fp;
+    w->cap = FSER_BUF_SIZE;
+    w->buf = malloc(w->cap);
+    FASSERT(w->buf, "out of memory serializing");
+}
+
+static void fser_writer_free(fser_writer_t *w)
+{
+    free(w->buf);
+    free(w->ref_objs);
+    free(w->ref_ids);
+    free(w->open);
+}
+
+/*
+ * fser_encode()
+ *
+ * p serialized: a bytes object in the binary form, or a JSON string.
+ */
+fobj_t *fser_encode(fenv_t *f, fobj_t *p, int json)
+{
+    fser_writer_t w;
+    fobj_t *r;
+
+    fser_writer_init(f, &w, NULL, json);
+    fser_write(&w, p);
+
+    if (json) {
+        r = fstr_new_buf(f, (char *) w.buf, w.len);
+    } else {
+        r = fbytes_new(f, w.buf, w.len, 1);
+        w.buf = NULL;  // The bytes object has it now
+    }
+    fser_writer_free(&w);
+    return r;
+}
+
+/*
+ * fser_save()
+ *
+ * Write p to the file at path.
+ */
+void fser_save(fenv_t *f, fobj_t *p, const char *path, int json)
+{
+    fser_writer_t w;
+    FILE *fp = fopen(path, "wb");
+
+    FASSERT(fp, "can't write %s: %s", path, strerror(errno));
+
+    fser_writer_init(f, &w, fp, json);
+    fser_write(&w, p);
+    if (json) {
+        fser_put_byte(&w, '\n');
+    }
+    fser_flush(&w);
+    fser_writer_free(&w);
+    FASSERT(fclose(fp) == 0, "can't write %s: %s", path, strerror(errno));
+}
+
+/***********************************
+ *
+ * Reading
+ *
+ ***********************************/
+
+typedef struct fser_reader_s {
+    fenv_t		*f;
+    const unsigned char	*start;
+    const unsigned char	*p;
+    const unsigned char	*end;
+    fobj_t		*refs;			// An array of what R can refer to (binary)
+    char		*scratch;		// Decoding JSON strings with escapes
+    size_t		 scratch_cap;
+    int			 depth;
+} fser_reader_t;
+
+#define FSER_OFFSET(r)	((long) ((r)->p - (r)->start))
+
+static const unsigned char *fser_get(fser_reader_t *r, size_t n)
+{
+    fenv_t *f = r->f;
+    const unsigned char *p = r->p;
+
+    FASSERT((size_t) (r->end - p) >= n, "serialized data ends early (at %ld)", FSER_OFFSET(r));
+    r->p += n;
+    return p;
+}
+
+static uint64_t fser_get_varint(fser_reader_t *r)
+{
+    fenv_t *f = r->f;
+    uint64_t v = 0;
+
+    for (int shift = 0; ; shift += 7) {
+        FASSERT(shift < 64, "bad serialized number at %ld", FSER_OFFSET(r));
+        unsigned char b = *fser_get(r, 1);
+        v |= (uint64_t) (b & 0x7f) << shift;
+        if (!(b & 0x80)) return v;
+    }
+}
+
+/*
+ * fser_get_count()
+ *
+ * A count of things each at least min bytes long, checked against
+ * what's left so a bad count can't make a huge table.
+ */
+static int fser_get_count(fser_reader_t *r, int min)
+{
+    fenv_t *f = r->f;
+    uint64_t n = fser_get_varint(r);
+
+    FASSERT(n <= (uint64_t) (r->end - r->p) / min,
+            "bad serialized count at %ld", FSER_OFFSET(r));
+    return (int) n;
+}
+
+static void fser_add_ref(fser_reader_t *r, fobj_t *p)
+{
+    farray_t *a = &r->refs->u.array;
+    int n = a->num;
+
+    farray_resize(r->f, r->refs, n + 1);
+    a->elems[n] = p;
+}
+
+/*
+ * fser_read_bin()
+ *
+ * Read a value.  Each container is reachable from refs as soon as it's
+ * made, so what's read into it is only held until it's stored.
+ */
+static fobj_t *fser_read_bin(fser_reader_t *r)
+{
+    fenv_t *f = r->f;
+    int tag = *fser_get(r, 1);
+    fobj_t *p, *k, *v;
+    int n, mark;
+
+    switch (tag) {
+    case 'Z':
+        return NULL;
+
+    case 'I': {
+        uint64_t u = fser_get_varint(r);
+        return fnum_new(f, (int64_t) (u >> 1) ^ -(int64_t) (u & 1));
+    }
+
+    case 'U':
+        return fnum_new(f, fser_get_varint(r));
+
+    case 'F': {
+        uint64_t u = fser_get_varint(r);
+        int64_t e = (int64_t) (u >> 2) ^ -(int64_t) ((u >> 1) & 1);
+        fnumber_t n;
+
+        FASSERT(e > -100000 && e < 100000, "bad serialized number at %ld", FSER_OFFSET(r));
+        n = ldexpl(fser_get_varint(r), (int) e);
+        return fnum_new(f, (u & 1) ? -n : n);
+    }
+
+    case 'D': {
+        const unsigned char *b = fser_get(r, 8);
+        uint64_t bits = 0;
+        double d;
+
+        for (int i = 0; i < 8; i++) {
+            bits |= (uint64_t) b[i] << (8 * i);
+        }
+        memcpy(&d, &bits, sizeof(d));
+        return fnum_new(f, d);
+    }
+
+    case 'S':
+        n = fser_get_count(r, 1);
+        p = fstr_new_buf(f, (const char *) fser_get(r, n), n);
+        fser_add_ref(r, p);
+        return p;
+
+    case 'Y':
+        n = fser_get_count(r, 1);
+        p = fbytes_alloc(f, n);
+        memcpy(p->u.bytes.base, fser_get(r, n), n);
+        fser_add_ref(r, p);
+        return p;
+
+    case 'R': {
+        uint64_t id = fser_get_varint(r);
+        FASSERT(id < (uint64_t) r->refs->u.array.num,
+                "bad serialized reference at %ld", FSER_OFFSET(r));
+        return r->refs->u.array.elems[id];
+    }
+
+    case 'T':
+    case 'H':
+        break;
+
+    default:
+        FASSERT(0, "bad serialized tag 0x%02x at %ld", tag, FSER_OFFSET(r) - 1);
+    }
+
+    FASSERT(++r->depth <= FSER_MAX_DEPTH, "serialized data is too deeply nested");
+
+    p = tag == 'T' ? ftable_new(f) : fhash_new(f);
+    fser_add_ref(r, p);
+    mark = fobj_hold_mark(f);
+
+    fobj_t *h = p;
+    if (tag == 'T') {
+        fobj_t *a = p->u.table.array;
+
+        n = fser_get_count(r, 1);
+        farray_resize(f, a, n);
+        for (int i = 0; i < n; i++) {
+            a->u.array.elems[i] = fser_read_bin(r);
+            fobj_hold_release(f, mark);
+        }
+        h = p->u.table.hash;
+    }
+
+    n = fser_get_count(r, 2);
+    fhash_reserve(f, h, n);
+    for (int i = 0; i < n; i++) {
+        k = fser_read_bin(r);
+        v = fser_read_bin(r);
+        FASSERT(k, "bad serialized key at %ld", FSER_OFFSET(r));
+        if (tag == 'T') {
+            ftable_store(f, p, k, v);
+        } else {
+            fhash_store(f, p, k, v);
+        }
+        fobj_hold_release(f, mark);
+    }
+
+    r->depth--;
+    return p;
+}
+
+static void fser_json_ws(fser_reader_t *r)
+{
+    while (r->p < r->end && (*r->p == ' ' || *r->p == '\n' || *r->p == '\t' || *r->p == '\r')) {
+        r->p++;
+    }
+}
+
+static int fser_json_peek(fser_reader_t *r)
+{
+    fser_json_ws(r);
+    return r->p < r->end ? *r->p : EOF;
+}
+
+static void fser_json_expect(fser_reader_t *r, int c)
+{
+    fenv_t *f = r->f;
+
+    FASSERT(fser_json_peek(r) == c, "bad JSON at %ld: '%c' expected", FSER_OFFSET(r), c);
+    r->p++;
+}
+
+static void fser_scratch(fser_reader_t *r, size_t len, size_t more)
+{
+    if (len + more > r->scratch_cap) {
+        r->scratch_cap = 2 * (len + more) + 64;
+        r->scratch = realloc(r->scratch, r->scratch_cap);
+    }
+}
+
+static unsigned fser_json_hex4(fser_reader_t *r)
+{
+    fenv_t *f = r->f;
+    const unsigned char *h = fser_get(r, 4);
+    unsigned u = 0;
+
+    for (int i = 0; i < 4; i++) {
+        FASSERT(isxdigit(h[i]), "bad JSON \\u escape at %ld", FSER_OFFSET(r) - 4);
+        u = u * 16 + (isdigit(h[i]) ? h[i] - '0' : (tolower(h[i]) - 'a' + 10));
+    }
+    return u;
+}
+
+/*
+ * fser_get_json_str()
+ *
+ * A string (its opening quote already seen).  Keys are interned, since
+ * the same few keys are usually in every object.  A string without
+ * escapes is made straight from the input.
+ */
+static fobj_t *fser_get_json_str(fser_reader_t *r, int key)
+{
+    fenv_t *f = r->f;
+    const unsigned char *s = r->p;
+
+    while (r->p < r->end && *r->p != '"' && *r->p != '\\') {
+        r->p++;
+    }
+    FASSERT(r->p < r->end, "bad JSON: a string at %ld isn't closed", (long) (s - r->start));
+
+    const char *buf = (const char *) s;
+    size_t len = r->p - s;
+
+    if (*r->p == '\\') {
+        fser_scratch(r, 0, len);
+        if (len) memcpy(r->scratch, s, len);  // scratch is NULL until it's needed
+
+        while (1) {
+            int c = *fser_get(r, 1);
+            if (c == '"') break;
+            fser_scratch(r, len, 4);
+            if (c != '\\') {
+                r->scratch[len++] = c;
+                continue;
+            }
+
+            c = *fser_get(r, 1);
+            switch (c) {
+            case '"': case '\\': case '/': r->scratch[len++] = c; break;
+            case 'n': r->scratch[len++] = '\n'; break;
+            case 't': r->scratch[len++] = '\t'; break;
+            case 'r': r->scratch[len++] = '\r'; break;
+            case 'b': r->scratch[len++] = '\b'; break;
+            case 'f': r->scratch[len++] = '\f'; break;
+            case 'u': {
+                unsigned u = fser_json_hex4(r);
+                if (u >= 0xd800 && u < 0xdc00 && r->end - r->p >= 6 &&
+                    r->p[0] == '\\' && r->p[1] == 'u') {
+                    r->p += 2;
+                    unsigned lo = fser_json_hex4(r);
+                    if (lo >= 0xdc00 && lo < 0xe000) {
+                        u = 0x10000 + ((u - 0xd800) << 10) + (lo - 0xdc00);
+                    } else {
+                        r->p -= 6;  // Not a pair: leave the second for next time
+                    }
+                }
+                if (u >= 0xd800 && u < 0xe000) {
+                    u = 0xfffd;  // A lone surrogate
+                }
+
+                char *o = r->scratch + len;
+                if (u < 0x80) {
+                    *o++ = u;
+                } else if (u < 0x800) {
+                    *o++ = 0xc0 | (u >> 6);
+                    *o++ = 0x80 | (u & 0x3f);
+                } else if (u < 0x10000) {
+                    *o++ = 0xe0 | (u >> 12);
+                    *o++ = 0x80 | ((u >> 6) & 0x3f);
+                    *o++ = 0x80 | (u & 0x3f);
+                } else {
+                    *o++ = 0xf0 | (u >> 18);
+                    *o++ = 0x80 | ((u >> 12) & 0x3f);
+                    *o++ = 0x80 | ((u >> 6) & 0x3f);
+                    *o++ = 0x80 | (u & 0x3f);
+                }
+                len = o - r->scratch;
+                break;
+            }
+            default:
+                FASSERT(0, "bad JSON escape \\%c at %ld", c, FSER_OFFSET(r) - 2);
+            }
+        }
+        buf = r->scratch;
+    } else {
+        r->p++;  // The closing quote
+    }
+
+    FASSERT(len <= 0x7fffffff, "JSON string at %ld is too long", (long) (s - r->start));
+    return key ? fstr_intern_buf(f, buf, len) : fstr_new_buf(f, buf, len);
+}
+
+static fobj_t *fser_get_json_num(fser_reader_t *r)
+{
+    fenv_t *f = r->f;
+    const unsigned char *s = r->p;
+    int neg = 0, digits = 0, simple = 1;
+    int64_t n = 0;
+
+    if (r->p < r->end && *r->p == '-') {
+        neg = 1;
+        r->p++;
+    }
+    while (r->p < r->end && isdigit(*r->p)) {
+        if (++digits > 18) simple = 0;  // Too long for n; strtold() reads it
+        if (simple) n = n * 10 + (*r->p - '0');
+        r->p++;
+    }
+    FASSERT(digits, "bad JSON number at %ld", (long) (s - r->start));
+
+    if (r->p < r->end && *r->p == '.') {
+        simple = 0;
+        for (r->p++, digits = 0; r->p < r->end && isdigit(*r->p); r->p++) digits++;
+        FASSERT(digits, "bad JSON number at %ld", (long) (s - r->start));
+    }
+    if (r->p < r->end && (*r->p == 'e' || *r->p == 'E')) {
+        simple = 0;
+        r->p++;
+        if (r->p < r->end && (*r->p == '+' || *r->p == '-')) r->p++;
+        for (digits = 0; r->p < r->end && isdigit(*r->p); r->p++) digits++;
+        FASSERT(digits, "bad JSON number at %ld", (long) (s - r->start));
+    }
+
+    if (simple) {
+        return fnum_new(f, neg ? -n : n);
+    }
+
+    size_t len = r->p - s;
+    fser_scratch(r, 0, len + 1);
+    memcpy(r->scratch, s, len);
+    r->scratch[len] = 0;
+    return fnum_new(f, strtold(r->scratch, NULL));
+}
+
+/*
+ * fser_read_json()
+ *
+ * Read a value.  The elements of an array (and the keys and values of an
+ * object) are kept on the data stack until its end is found, where
+ * they're safe from the collector, and then moved into a table made to
+ * hold exactly that many.
+ */
+static fobj_t *fser_read_json(fser_reader_t *r)
+{
+    fenv_t *f = r->f;
+    fstack_t *stack = &f->dstack->u.stack;
+    int c = fser_json_peek(r);
+    fobj_t *t;
+    int n = 0;
+
+    switch (c) {
+    case '"':
+        r->p++;
+        return fser_get_json_str(r, 0);
+
+    case 't':
+    case 'f':
+    case 'n': {
+        const char *word = c == 't' ? "true" : c == 'f' ? "false" : "null";
+        size_t len = strlen(word);
+        FASSERT((size_t) (r->end - r->p) >= len && !memcmp(r->p, word, len),
+                "bad JSON at %ld", FSER_OFFSET(r));
+        r->p += len;
+        return c == 'n' ? NULL : fnum_new(f, c == 't' ? -1 : 0);
+    }
+
+    case '[':
+    case '{':
+        break;
+
+    default:
+        FASSERT(c == '-' || isdigit(c), "bad JSON at %ld", FSER_OFFSET(r));
+        return fser_get_json_num(r);
+    }
+
+    FASSERT(++r->depth <= FSER_MAX_DEPTH, "JSON is too deeply nested");
+    r->p++;
+
+    int close = c == '[' ? ']' : '}';
+    if (fser_json_peek(r) == close) {
+        r->p++;
+    } else {
+        while (1) {
+            if (c == '{') {
+                fser_json_expect(r, '"');
+                fstack_store(f, f->dstack, NULL, fser_get_json_str(r, 1));
+                fser_json_expect(r, ':');
+            }
+            fstack_store(f, f->dstack, NULL, fser_read_json(r));
+            n++;
+            if (fser_json_peek(r) != ',') break;
+            r->p++;
+        }
+        fser_json_expect(r, close);
+    }
+
+    t = ftable_new(f);
+    if (c == '[') {
+        fobj_t *a = t->u.table.array;
+        if (n) {  // [] has no elems to copy into
+            farray_resize(f, a, n);
+            memcpy(a->u.array.elems, stack->elems + stack->sp - n, n * sizeof(fobj_t *));
+        }
+        stack->sp -= n;
+    } else {
+        fobj_t **kv = stack->elems + stack->sp - 2 * n;
+        fhash_reserve(f, t->u.table.hash, n);
+        for (int i = 0; i < n; i++) {
+            ftable_store(f, t, kv[2 * i], kv[2 * i + 1]);
+        }
+        stack->sp -= 2 * n;
+    }
+
+    r->depth--;
+    return t;
+}
+
+/*
+ * fser_decode()
+ *
+ * The object serialized in buf.
+ */
+fobj_t *fser_decode(fenv_t *f, const void *buf, size_t len, int json)
+{
+    fser_reader_t r;
+    fobj_t *p;
+
+    memset(&r, 0, sizeof(r));
+    r.f = f;
+    r.start = r.p = buf;
+    r.end = r.start + len;
+
+    if (json) {
+        p = fser_read_json(&r);
+        FASSERT(fser_json_peek(&r) == EOF, "bad JSON at %ld: more after the value",
+                FSER_OFFSET(&r));
+    } else {
+        FASSERT(len >= 5 && !memcmp(buf, FSER_MAGIC, 4),
+                "not serialized data (no " FSER_MAGIC " header)");
+        FASSERT(r.start[4] >= 1 && r.start[4] <= FSER_VERSION,
+                "serialized data is version %d, not 1 to %d", r.start[4], FSER_VERSION);
+        r.p += 5;
+        r.refs = farray_new(f);
+        p = fser_read_bin(&r);
+        FASSERT(r.p == r.end, "serialized data has more after the value");
+    }
+
+    free(r.scratch);
+    return p;
+}
+
+/*
+ * fser_load()
+ *
+ * The object saved in the file at path.
+ */
+fobj_t *fser_load(fenv_t *f, const char *path, int json)
+{
+    FILE *fp = fopen(path, "rb");
+    FASSERT(fp, "can't read %s: %s", path, strerror(errno));
+
+    fseek(fp, 0, SEEK_END);
+    long len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    FASSERT(len >= 0, "can't read %s: %s", path, strerror(errno));
+
+    char *buf = malloc(len ? len : 1);
+    FASSERT(buf, "out of memory reading %s", path);
+    FASSERT(fread(buf, 1, len, fp) == (size_t) len, "can't read %s: %s", path, strerror(errno));
+    fclose(fp);
+
+    fobj_t *p = fser_decode(f, buf, len, json);
+    free(buf);
+    return p;
+}
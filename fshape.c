@@ -0,0 +1,202 @@
+/*
+ * This file is part of arm-sim: http://madscientistroom.org/arm-sim
+ *
+ * Copyright (c) 2010 Randy Thelen. All rights reserved, and all wrongs
+ * reversed. (See the file COPYRIGHT for details.)
+ */
+
+#include "forth.h"
+#include "fobj.h"
+
+/*
+ * Shapes (hidden classes)
+ *
+ * Most hashes with string keys are really records: the same handful of
+ * field names stored in the same order.  Rather than keep a copy of the
+ * keys in every hash, such hashes point at a shared shape which lists the
+ * keys in slot order and keep only a dense array of values.
+ *
+ * Shapes form a tree rooted at f->empty_shape.  Adding a key to a hash
+ * moves it from its shape to the child reached by that key, creating the
+ * child the first time it's needed.  Two hashes which were built by
+ * storing the same keys in the same order therefore share one shape
+ * object, and "is this the same layout?" is a pointer compare.
+ *
+ * A shape's children are found by hashing their keys into trans, an
+ * open addressing table which doubles as it fills.  They're held
+ * weakly: a child lives only while some hash (or a key's lookup cache,
+ * or a child of its own) refers to it, and the collector drops the
+ * dead ones from trans (see fobj.c).  So records which are built with
+ * ever new keys don't pile up shapes.  A shape with FSHAPE_MAX_TRANS
+ * live children takes no more; the hash goes to dictionary mode.
+ *
+ * Lookups are cached in the key string object: the shape it was last
+ * found in and the slot.  String literals are interned (see fparse.c),
+ * so the cache is per key name, not per access site: every str" name
+ * in the program shares the one entry.  A loop reading a field from
+ * same-shaped records is a compare and a load; sites which read the
+ * same name from records of different shapes take turns missing, and a
+ * miss is a scan of at most FHASH_MAX_SHAPE_KEYS keys (see fhash.c).
+ */
+
+#define FSHAPE_MAX_TRANS	64
+
+fobj_t *fshape_new(fenv_t *f, fobj_t *parent, fobj_t *key)
+{
+    fobj_t *p = fobj_new(f, FOBJ_SHAPE);
+    fshape_t *s = &p->u.shape;
+
+    s->parent = parent;
+    s->key = key;
+    s->nkeys = parent ? parent->u.shape.nkeys + 1 : 0;
+    s->keys = NULL;
+    s->ntrans = 0;
+    s->cap_trans = 0;
+    s->trans = NULL;
+
+    if (s->nkeys) {
+        s->keys = malloc(s->nkeys * sizeof(fobj_t *));
+        if (s->nkeys > 1) {
+            memcpy(s->keys, parent->u.shape.keys, (s->nkeys - 1) * sizeof(fobj_t *));
+        }
+        s->keys[s->nkeys - 1] = key;
+    }
+
+    return p;
+}
+
+void fshape_visit(fenv_t *f, fobj_t *p)
+{
+    fshape_t *s = &p->u.shape;
+
+    fobj_visit(f, s->parent);
+    fobj_visit(f, s->key);
+    if (s->ntrans) {
+        fobj_weak_note(f, p);  // The children are weak
+    }
+}
+
+void fshape_free(fenv_t *f, fobj_t *p)
+{
+    fshape_t *s = &p->u.shape;
+
+    if (s->keys)  free(s->keys);
+    if (s->trans) free(s->trans);
+    s->keys = NULL;
+    s->trans = NULL;
+}
+
+/*
+ * The slot in trans for key: its child's, or the empty one where it
+ * would go.
+ */
+static int fshape_trans_slot(fenv_t *f, fshape_t *s, fobj_t *key)
+{
+    int mask = s->cap_trans - 1;
+    int i = fobj_hash(f, key) & mask;
+
+    while (s->trans[i] && !fstr_equal(f, s->trans[i]->u.shape.key, key)) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+/*
+ * Rebuild trans with room for cap, keeping only the children for which
+ * keep() says so.
+ */
+static void fshape_rehash(fenv_t *f, fshape_t *s, int cap,
+                          int (*keep)(fenv_t *f, fobj_t *child))
+{
+    fobj_t **old = s->trans;
+    int old_cap = s->cap_trans;
+
+    s->trans = calloc(cap, sizeof(fobj_t *));
+    FASSERT(s->trans, "out of memory for a shape's transitions");
+    s->cap_trans = cap;
+    s->ntrans = 0;
+
+    for (int i = 0; i < old_cap; i++) {
+        if (old[i] && (!keep || keep(f, old[i]))) {
+            s->trans[fshape_trans_slot(f, s, old[i]->u.shape.key)] = old[i];
+            s->ntrans++;
+        }
+    }
+    free(old);
+}
+
+/*
+ * fshape_weak_clear()
+ *
+ * While collecting: drop the children which weren't marked.
+ */
+static int fshape_marked(fenv_t *f, fobj_t *child)
+{
+    return fobj_marked(f, child);
+}
+
+void fshape_weak_clear(fenv_t *f, fobj_t *p)
+{
+    fshape_t *s = &p->u.shape;
+
+    fshape_rehash(f, s, s->cap_trans, fshape_marked);
+}
+
+/*
+ * fshape_add_key()
+ *
+ * Return the shape which is shape plus key in the next slot, or NULL if
+ * shape already has as many children as it may.
+ */
+fobj_t *fshape_add_key(fenv_t *f, fobj_t *shape, fobj_t *key)
+{
+    fshape_t *s = &shape->u.shape;
+
+    if (s->ntrans) {
+        fobj_t *child = s->trans[fshape_trans_slot(f, s, key)];
+        if (child) {
+            return child;
+        }
+    }
+    if (s->ntrans >= FSHAPE_MAX_TRANS) {
+        return NULL;
+    }
+
+    /*
+     * Making the child can collect garbage, and so change trans.
+     */
+    fobj_t *child = fshape_new(f, shape, key);
+
+    if (4 * (s->ntrans + 1) > 3 * s->cap_trans) {
+        fshape_rehash(f, s, s->cap_trans ? 2 * s->cap_trans : 8, NULL);
+    }
+    s->trans[fshape_trans_slot(f, s, key)] = child;
+    s->ntrans++;
+
+    return child;
+}
+
+/*
+ * fshape_slot()
+ *
+ * Return the slot key occupies in shape, or -1.
+ */
+int fshape_slot(fenv_t *f, fobj_t *shape, fobj_t *key)
+{
+    fstr_t *k = &key->u.str;
+
+    if (k->ic_shape == shape) {
+        return k->ic_slot;
+    }
+
+    fshape_t *s = &shape->u.shape;
+    for (int i = 0; i < s->nkeys; i++) {
+        if (fstr_equal(f, s->keys[i], key)) {
+            k->ic_shape = shape;
+            k->ic_slot = i;
+            return i;
+        }
+    }
+
+    return -1;
+}
@@ -0,0 +1,265 @@
+/*
+ * This file is part of arm-sim: http://madscientistroom.org/arm-sim
+ *
+ * Copyright (c) 2010 Randy Thelen. All rights reserved, and all wrongs
+ * reversed. (See the file COPYRIGHT for details.)
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "forth.h"
+#include "fobj.h"
+
+/*
+ * Sorting
+ *
+ * fsort_array() is a stable merge sort of an array's elements.  How two
+ * elements compare depends on what's in the array:
+ *
+ *	- all numbers:	by value
+ *	- all strings:	by their bytes, as fstr_cmp() has it
+ *	- otherwise:	by fobj_cmp()
+ *	- or, given a comparator word xt (a b -> n), a goes before b when n
+ *	  is negative.  Only that test is made, so < works as well as compare.
+ *
+ * The first two compare without calling back into the interpreter, so a
+ * big enough array of numbers or strings is split among threads: each
+ * sorts a run and then runs are merged pairwise, a thread per pair.
+ */
+
+#define FSORT_INSERTION		24		// Runs this short are insertion sorted
+#define FSORT_PARALLEL_MIN	65536	// Fewer elements than this aren't worth threads
+#define FSORT_MAX_THREADS	16
+
+#define FSORT_NUM			0
+#define FSORT_STR			1
+#define FSORT_OBJ			2
+#define FSORT_XT			3
+
+typedef struct fsort_s {
+    fenv_t		*f;
+    int			 kind;
+    fobj_t		*xt;
+} fsort_t;
+
+/*
+ * fsort_before()
+ *
+ * Does a go before b?  Only ever asked of a later element a and an
+ * earlier b, which is what keeps the sort stable.
+ */
+static inline int fsort_before(fsort_t *s, fobj_t *a, fobj_t *b)
+{
+    fenv_t *f = s->f;
+
+    switch (s->kind) {
+    case FSORT_NUM:
+        return a->u.num.n < b->u.num.n;
+
+    case FSORT_STR:
+        return fstr_cmp(f, a, b) < 0;
+
+    case FSORT_OBJ:
+        return fobj_cmp(f, a, b) < 0;
+
+    default: {
+        int mark = fobj_hold_mark(f);
+        fstack_store(f, f->dstack, NULL, a);
+        fstack_store(f, f->dstack, NULL, b);
+        s->xt->u.word.code(f, s->xt);
+        fobj_t *n = fstack_fetch(f, f->dstack, NULL);
+        FASSERT(n && n->type == FOBJ_NUM, "A sort comparator must leave a number");
+        fobj_hold_release(f, mark);
+        return n->u.num.n < 0;
+    }
+    }
+}
+
+/*
+ * fsort_merge()
+ *
+ * Merge the sorted runs a[0, mid) and a[mid, n) through tmp.
+ */
+static void fsort_merge(fsort_t *s, fobj_t **a, fobj_t **tmp, size_t mid, size_t n)
+{
+    if (!fsort_before(s, a[mid], a[mid - 1])) {
+        return;  // Already in order
+    }
+
+    memcpy(tmp, a, n * sizeof(fobj_t *));
+
+    size_t i = 0, j = mid, k = 0;
+    while (i < mid && j < n) {
+        if (fsort_before(s, tmp[j], tmp[i])) {
+            a[k++] = tmp[j++];
+        } else {
+            a[k++] = tmp[i++];
+        }
+    }
+    while (i < mid) a[k++] = tmp[i++];
+    while (j < n)   a[k++] = tmp[j++];
+}
+
+static void fsort_run(fsort_t *s, fobj_t **a, fobj_t **tmp, size_t n)
+{
+    if (n <= FSORT_INSERTION) {
+        for (size_t i = 1; i < n; i++) {
+            fobj_t *x = a[i];
+            size_t j = i;
+            while (j > 0 && fsort_before(s, x, a[j - 1])) {
+                a[j] = a[j - 1];
+                j--;
+            }
+            a[j] = x;
+        }
+        return;
+    }
+
+    size_t mid = n / 2;
+    fsort_run(s, a, tmp, mid);
+    fsort_run(s, a + mid, tmp + mid, n - mid);
+    fsort_merge(s, a, tmp, mid, n);
+}
+
+/*
+ * The parallel sort.  Runs are sorted (or pairs of them merged) on their
+ * own threads; each job only touches its own slice of a and tmp.
+ */
+typedef struct fsort_job_s {
+    fsort_t		*s;
+    fobj_t		**a;
+    fobj_t		**tmp;
+    size_t		 mid;			// 0 to sort the slice, else where to merge it
+    size_t		 n;
+} fsort_job_t;
+
+static void *fsort_job(void *arg)
+{
+    fsort_job_t *job = arg;
+
+    if (job->mid) {
+        fsort_merge(job->s, job->a, job->tmp, job->mid, job->n);
+    } else {
+        fsort_run(job->s, job->a, job->tmp, job->n);
+    }
+    return NULL;
+}
+
+static int fsort_threads(size_t n)
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int threads = 1;
+
+    while (threads * 2 <= cpus && threads * 2 <= FSORT_MAX_THREADS &&
+           n / (threads * 2) >= FSORT_PARALLEL_MIN / 2) {
+        threads *= 2;
+    }
+    return threads;
+}
+
+static void fsort_parallel(fsort_t *s, fobj_t **a, fobj_t **tmp, size_t n, int threads)
+{
+    pthread_t tid[FSORT_MAX_THREADS];
+    fsort_job_t job[FSORT_MAX_THREADS];
+    size_t bound[FSORT_MAX_THREADS + 1];
+
+    for (int t = 0; t <= threads; t++) {
+        bound[t] = n * t / threads;
+    }
+
+    /*
+     * Sort a run per thread, then merge runs pairwise until there's
+     * one.  The number of threads is a power of two, so the pairs come
+     * out even.
+     */
+    for (int width = 1; width <= threads; width *= 2) {
+        int jobs = 0;
+
+        for (int t = 0; t < threads; t += width) {
+            size_t lo = bound[t], hi = bound[t + width];
+            fsort_job_t *j = &job[jobs];
+
+            j->s = s;
+            j->a = a + lo;
+            j->tmp = tmp + lo;
+            j->mid = width == 1 ? 0 : bound[t + width / 2] - lo;
+            j->n = hi - lo;
+            if (width > 1 && (j->mid == 0 || j->mid == j->n)) {
+                continue;
+            }
+            if (pthread_create(&tid[jobs], NULL, fsort_job, j) != 0) {
+                fsort_job(j);  // No thread to be had: do it here
+                continue;
+            }
+            jobs++;
+        }
+        for (int t = 0; t < jobs; t++) {
+            pthread_join(tid[t], NULL);
+        }
+    }
+}
+
+/*
+ * fsort_array()
+ *
+ * Sort an array's elements in place by xt (a comparator word) or, when
+ * xt is NULL, by their natural order.
+ */
+void fsort_array(fenv_t *f, fobj_t *p, fobj_t *xt)
+{
+    farray_t *arr = &p->u.array;
+    size_t n = arr->num;
+    fsort_t s = { f, FSORT_XT, xt };
+
+    if (n < 2) {
+        return;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+        FASSERT(arr->elems[i], "sort requires a table without holes (%zu is empty)", i);
+    }
+
+    if (!xt) {
+        int type = arr->elems[0]->type;
+        size_t i;
+        for (i = 1; i < n && arr->elems[i]->type == type; i++) {
+            ;
+        }
+        s.kind = i < n                ? FSORT_OBJ :
+                 type == FOBJ_NUM     ? FSORT_NUM :
+                 type == FOBJ_STR     ? FSORT_STR : FSORT_OBJ;
+    }
+
+    /*
+     * A comparator word can allocate and so collect garbage, and it might
+     * even change the array.  It sorts a copy, leaving the array holding
+     * every element until the sorted order is copied back.
+     */
+    fobj_t **a = arr->elems;
+    fobj_t **tmp = malloc(n * sizeof(fobj_t *) * (s.kind == FSORT_XT ? 2 : 1));
+    FASSERT(tmp, "out of memory sorting %zu elements", n);
+    if (s.kind == FSORT_XT) {
+        a = tmp + n;
+        memcpy(a, arr->elems, n * sizeof(fobj_t *));
+    }
+
+    int threads = 1;
+    if (s.kind == FSORT_NUM || s.kind == FSORT_STR) {
+        threads = fsort_threads(n);
+    }
+
+    if (threads > 1) {
+        fsort_parallel(&s, a, tmp, n, threads);
+    } else {
+        fsort_run(&s, a, tmp, n);
+    }
+
+    if (s.kind == FSORT_XT) {
+        FASSERT(arr->num == (int) n, "sort's comparator changed the table being sorted");
+        memcpy(arr->elems, a, n * sizeof(fobj_t *));
+    }
+    free(tmp);
+}
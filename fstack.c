@@ -13,7 +13,7 @@ void fstack_print(fenv_t *f, fobj_t *p)
     ASSERT(p->type == FOBJ_STACK);
     fstack_t *s = &p->u.stack;
 
-    printf("Depth = %d\n", s->sp);
+    fout_printf(f, "Depth = %d\n", s->sp);
 }
 
 fobj_t *fstack_new(fenv_t *f)
@@ -47,7 +47,7 @@ void fstack_free(fenv_t *f, fobj_t *p)
 
 static void fstack_grow(fenv_t *f, fstack_t *s)
 {
-    s->max_sp += 32;
+    s->max_sp = s->max_sp ? 2 * s->max_sp : 32;
     s->elems = realloc(s->elems, s->max_sp * sizeof(fobj_t **));
     for (int i = s->sp; i < s->max_sp; i++) {
         s->elems[i] = NULL;
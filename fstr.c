@@ -5,70 +5,486 @@
  * reversed. (See the file COPYRIGHT for details.)
  */
 
+#include <stddef.h>
+
 #include "forth.h"
 #include "fobj.h"
 
 void fstr_print(fenv_t *f, fobj_t *p)
 {
-    char *s = p->u.str.buf ? p->u.str.buf : "(null)";
+    char *s = p->u.str.buf ? fstr_cstr(f, p) : "(null)";
 
 #ifdef DEBUG
-    printf("    String = %s\n", s);
+    fout_printf(f, "    String = %s\n", s);
 #else
-    printf("%s", s);
+    if (p->u.str.buf) {
+        fout_write(f, s, p->u.str.len);
+    } else {
+        fout_printf(f, "%s", s);
+    }
 #endif
 }
 
-fobj_t *fstr_new_buf(fenv_t *f, const char *buf, int len)
+/*
+ * fstr_alloc()
+ *
+ * A new string with room for len bytes (and a NUL) and nothing in it yet.
+ * Short strings, which are most of them, keep their bytes in the object
+ * itself rather than in a malloc'ed buffer.
+ */
+fobj_t *fstr_alloc(fenv_t *f, int len)
 {
     fobj_t *p = fobj_new(f, FOBJ_STR);
-    p->u.str.len = len;
-    p->u.str.buf = malloc(len + 1);
-    bcopy(buf, p->u.str.buf, len);
-    p->u.str.buf[len] = 0;
+    fstr_t *s = &p->u.str;
+
+    memset(s, 0, sizeof(*s));
+    s->len = len;
+    s->buf = len < FSTR_SMALL ? s->u.small : malloc(len + 1);
+    s->buf[len] = 0;
+
+    return p;
+}
+
+fobj_t *fstr_new_buf(fenv_t *f, const char *buf, int len)
+{
+    fobj_t *p = fstr_alloc(f, len);
+    memcpy(p->u.str.buf, buf, len);
     return p;
 }
 
 fobj_t *fstr_new(fenv_t *f, const char *str)
 {
-    fobj_t *p = fobj_new(f, FOBJ_STR);
-    p->u.str.len = strlen(str);
-    p->u.str.buf = malloc(p->u.str.len + 1);
-    p->u.str.buf[0] = 0;
-    strcat(p->u.str.buf, str);
+    return fstr_new_buf(f, str, strlen(str));
+}
+
+/*
+ * fstr_hash_bytes()
+ *
+ * A 64-bit hash of len bytes (MurmurHash64A).  It reads eight bytes at a
+ * time so it's cheap on long keys, and it mixes well enough that the low
+ * bits can be used directly as a table index.
+ */
+static uint64_t fstr_hash_bytes(const char *buf, int len)
+{
+    const uint64_t m = 0xc6a4a7935bd1e995ull;
+    const int r = 47;
+    const unsigned char *p = (const unsigned char *) buf;
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ (len * m);
+    uint64_t k;
+
+    for (; len >= 8; len -= 8, p += 8) {
+        memcpy(&k, p, sizeof(k));
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+    }
+
+    if (len) {
+        k = 0;
+        for (int i = len - 1; i >= 0; i--) {
+            k = (k << 8) | p[i];
+        }
+        h ^= k;
+        h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+
+    return h;
+}
+
+/*
+ * fstr_hash()
+ *
+ * The string's hash, computed the first time it's asked for and then
+ * kept in the string.
+ */
+uint64_t fstr_hash(fenv_t *f, fobj_t *p)
+{
+    fstr_t *s = &p->u.str;
+
+    if (!s->hashed) {
+        s->hash = fstr_hash_bytes(s->buf, s->len);
+        s->hashed = 1;
+    }
+    return s->hash;
+}
+
+/***********************************
+ *
+ * Interned strings
+ *
+ * f->intern is a set of strings, one object per distinct contents.
+ * Tokens, word names and string literals are interned so the same name
+ * is always the same object and two interned strings are equal only if
+ * they're the same object.  Interned strings are never modified.
+ *
+ * The set is an open addressing table of the strings themselves, kept
+ * at most half full.  It doesn't keep its strings alive: the garbage
+ * collector doesn't visit it and fstr_free() takes a string out of it.
+ *
+ ***********************************/
+
+struct fintern_s {
+    int			 num;
+    int			 cap;			// A power of 2
+    fobj_t		**slots;
+};
+
+void fstr_intern_init(fenv_t *f)
+{
+    fintern_t *t = malloc(sizeof(*t));
+
+    t->num = 0;
+    t->cap = 512;
+    t->slots = calloc(t->cap, sizeof(fobj_t *));
+    f->intern = t;
+}
+
+void fstr_intern_free(fenv_t *f)
+{
+    ASSERT(f->intern->num == 0);  // The strings are all collected first
+    free(f->intern->slots);
+    free(f->intern);
+    f->intern = NULL;
+}
+
+/*
+ * The slot of the interned string with the len bytes at buf, or of the
+ * empty slot where it would go.
+ */
+static int fstr_intern_slot(fintern_t *t, uint64_t hash, const char *buf, int len)
+{
+    int mask = t->cap - 1;
+    int i = hash & mask;
+
+    for (fobj_t *p; (p = t->slots[i]); i = (i + 1) & mask) {
+        if (p->u.str.hash == hash && p->u.str.len == len &&
+            memcmp(p->u.str.buf, buf, len) == 0) {
+            break;
+        }
+    }
+    return i;
+}
+
+static void fstr_intern_grow(fenv_t *f)
+{
+    fintern_t *t = f->intern;
+    fobj_t **old = t->slots;
+    int old_cap = t->cap;
+
+    t->cap *= 2;
+    t->slots = calloc(t->cap, sizeof(fobj_t *));
+
+    for (int i = 0; i < old_cap; i++) {
+        if (old[i]) {
+            int j = old[i]->u.str.hash & (t->cap - 1);
+            while (t->slots[j]) j = (j + 1) & (t->cap - 1);
+            t->slots[j] = old[i];
+        }
+    }
+
+    free(old);
+}
+
+/*
+ * fstr_intern_buf()
+ *
+ * Return the interned string with the len bytes at buf, making it if
+ * need be.
+ */
+fobj_t *fstr_intern_buf(fenv_t *f, const char *buf, int len)
+{
+    fintern_t *t = f->intern;
+    uint64_t hash = fstr_hash_bytes(buf, len);
+    fobj_t *found = t->slots[fstr_intern_slot(t, hash, buf, len)];
+
+    if (found) {
+        return HOLD(found);  // The set alone won't keep it alive
+    }
+
+    /*
+     * Allocating may collect garbage and take strings out of the set,
+     * so the slot is only found afterwards.
+     */
+    fobj_t *p = fstr_new_buf(f, buf, len);
+    p->u.str.interned = 1;
+    p->u.str.hashed = 1;
+    p->u.str.hash = hash;
+
+    if (2 * (t->num + 1) > t->cap) {
+        fstr_intern_grow(f);
+    }
+    t->slots[fstr_intern_slot(t, hash, buf, len)] = p;
+    t->num++;
+
     return p;
 }
 
+fobj_t *fstr_intern(fenv_t *f, const char *str)
+{
+    return fstr_intern_buf(f, str, strlen(str));
+}
+
+/*
+ * fstr_intern_str()
+ *
+ * The interned copy of p (p itself if it's interned).
+ */
+fobj_t *fstr_intern_str(fenv_t *f, fobj_t *p)
+{
+    if (p->u.str.interned) {
+        return p;
+    }
+    return fstr_intern_buf(f, p->u.str.buf, p->u.str.len);
+}
+
+/*
+ * fstr_intern_find()
+ *
+ * The interned string with the len bytes at buf, or NULL if there isn't
+ * one.  Nothing is allocated.
+ */
+fobj_t *fstr_intern_find(fenv_t *f, const char *buf, int len)
+{
+    fintern_t *t = f->intern;
+    fobj_t *p = t->slots[fstr_intern_slot(t, fstr_hash_bytes(buf, len), buf, len)];
+
+    return p ? HOLD(p) : NULL;
+}
+
+/*
+ * Take p out of the set.  The strings after it in its run are moved
+ * back into the gap if their home slot allows it, so lookups never
+ * stop early at an empty slot.
+ */
+static void fstr_unintern(fenv_t *f, fobj_t *p)
+{
+    fintern_t *t = f->intern;
+    int mask = t->cap - 1;
+    int i = p->u.str.hash & mask;
+
+    while (t->slots[i] != p) {
+        ASSERT(t->slots[i]);
+        i = (i + 1) & mask;
+    }
+
+    for (int j = (i + 1) & mask; t->slots[j]; j = (j + 1) & mask) {
+        int home = t->slots[j]->u.str.hash & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            t->slots[i] = t->slots[j];
+            i = j;
+        }
+    }
+    t->slots[i] = NULL;
+    t->num --;
+}
+
+/*
+ * fstr_equal()
+ *
+ * Whether two strings have the same contents.  The bytes are compared
+ * only when the lengths and hashes match.
+ */
+int fstr_equal(fenv_t *f, fobj_t *a, fobj_t *b)
+{
+    fstr_t *A = &a->u.str;
+    fstr_t *B = &b->u.str;
+
+    if (a == b) return 1;
+    if (A->interned && B->interned) return 0;
+    if (A->len != B->len) return 0;
+    if (fstr_hash(f, a) != fstr_hash(f, b)) return 0;
+    return memcmp(A->buf, B->buf, A->len) == 0;
+}
+
+/*
+ * A builder buffer (see String building below), which buf points into.
+ */
+typedef struct fstr_build_s {
+    int			 cap;
+    int			 used;			// The tip
+    char		 buf[];
+} fstr_build_t;
+
+#define FSTR_BUILD(s)	((fstr_build_t *) ((s)->buf - offsetof(fstr_build_t, buf)))
+
+/*
+ * The string whose buffer s's bytes are in, if it isn't s's own.
+ */
+static fobj_t *fstr_owner(fstr_t *s)
+{
+    return s->buf == s->u.small ? NULL : s->u.ref.owner;
+}
+
+void fstr_visit(fenv_t *f, fobj_t *p)
+{
+    fobj_visit(f, p->u.str.ic_shape);
+    fobj_visit(f, fstr_owner(&p->u.str));
+}
+
 void fstr_free(fenv_t *f, fobj_t *p)
 {
-    if (p->u.str.buf) {
-        free(p->u.str.buf);
-        p->u.str.buf = NULL;
+    fstr_t *s = &p->u.str;
+
+    if (s->interned) {
+        fstr_unintern(f, p);
     }
+
+    if (s->buf && s->buf != s->u.small) {
+        if (s->builder) {
+            free(FSTR_BUILD(s));
+        } else if (s->u.ref.owner) {
+            free(s->u.ref.cstr);
+        } else {
+            free(s->buf);
+        }
+    }
+    p->u.str.buf = NULL;
     p->u.str.len = 0;
 }
 
 /*
- * fstr_add()
+ * fstr_slice()
  *
- * Supported operand types (for op2):
- *    - String: concatenate the two strings
- *    - Number: index into string
+ * A string of the len bytes at offset in parent's buffer.  Nothing is
+ * copied; the slice keeps parent alive.
+ */
+fobj_t *fstr_slice(fenv_t *f, fobj_t *parent, int offset, int len)
+{
+    fobj_t *p = fobj_new(f, FOBJ_STR);
+    fstr_t *s = &p->u.str;
+
+    memset(s, 0, sizeof(*s));
+    s->len = len;
+    s->buf = parent->u.str.buf + offset;
+    s->u.ref.owner = fstr_owner(&parent->u.str);
+    if (!s->u.ref.owner) {
+        s->u.ref.owner = parent;
+    }
+    return p;
+}
+
+/*
+ * fstr_cstr()
+ *
+ * The string's bytes followed by a NUL, for C library routines.  A slice
+ * or a string built by appending (below) shares its buffer with other
+ * strings, so the byte after it isn't always a NUL; such a string gets a
+ * copy of its bytes on the side, made once.  buf itself is left alone:
+ * others (a csv reader, say) may be reading the buffer it's in.
+ */
+char *fstr_cstr(fenv_t *f, fobj_t *p)
+{
+    fstr_t *s = &p->u.str;
+
+    if (s->buf[s->len] == 0) {
+        return s->buf;
+    }
+
+    ASSERT(fstr_owner(s));
+    if (!s->u.ref.cstr) {
+        s->u.ref.cstr = malloc(s->len + 1);
+        memcpy(s->u.ref.cstr, s->buf, s->len);
+        s->u.ref.cstr[s->len] = 0;
+    }
+    return s->u.ref.cstr;
+}
+
+/*
+ * fstr_buf_owner()
+ *
+ * The string whose buffer p's bytes are in: p itself, or the string it
+ * was sliced from.  Whoever keeps a pointer to the bytes keeps this
+ * alive.
  */
+fobj_t *fstr_buf_owner(fenv_t *f, fobj_t *p)
+{
+    fobj_t *o = fstr_owner(&p->u.str);
+
+    return o ? o : p;
+}
+
+/*
+ * String building
+ *
+ * a b + copies both strings, so building a long string a piece at a time
+ * would be quadratic.  Instead, once a result is FSTR_BUILD_MIN bytes or
+ * more it goes into a builder buffer with room to grow.  If a is the
+ * longest string in such a buffer (it ends at the buffer's tip), a b +
+ * copies just b after it and returns a new string of the combined length
+ * in the same buffer.  a itself is unchanged: it is still its first len
+ * bytes.  The buffer doubles when it's full, so appending is amortized
+ * O(1) per byte.
+ *
+ * The buffer belongs to a hidden owner string; the strings in it point
+ * at the owner, which keeps it alive.  Its size and tip are kept in
+ * front of it (an fstr_build_t), out of the string object.
+ */
+
+#define FSTR_BUILD_MIN		256
+
+/*
+ * fstr_builder_new()
+ *
+ * A hidden string which owns a builder buffer of cap bytes.  Its len
+ * isn't used.
+ */
+static fobj_t *fstr_builder_new(fenv_t *f, int cap)
+{
+    fobj_t *o = fobj_new(f, FOBJ_STR);
+    fstr_t *os = &o->u.str;
+    fstr_build_t *b = malloc(sizeof(*b) + cap + 1);
+
+    memset(os, 0, sizeof(*os));
+    b->cap = cap;
+    b->used = 0;
+    b->buf[0] = 0;
+    os->buf = b->buf;
+    os->builder = 1;
+    return o;
+}
+
 
 static fobj_t *fstr_concatenate(fenv_t *f, fobj_t *op1, fobj_t *op2)
 {
-    fobj_t *dest = fstr_new(f, op1->u.str.buf);
-    dest->u.str.len += op2->u.str.len;
-    dest->u.str.buf = realloc(dest->u.str.buf, dest->u.str.len + 1);
-    strcat(dest->u.str.buf, op2->u.str.buf);
-    return dest;
+    fstr_t *a = &op1->u.str;
+    fstr_t *b = &op2->u.str;
+    int len = a->len + b->len;
+    fobj_t *o = fstr_owner(a);
+
+    if (len < FSTR_BUILD_MIN) {
+        fobj_t *dest = fstr_alloc(f, len);
+        memcpy(dest->u.str.buf, a->buf, a->len);
+        memcpy(dest->u.str.buf + a->len, b->buf, b->len);
+        return dest;
+    }
+
+    if (o && o->u.str.builder && a->buf == o->u.str.buf &&
+        a->len == FSTR_BUILD(&o->u.str)->used && len <= FSTR_BUILD(&o->u.str)->cap) {
+        /*
+         * Append at the tip.  b may be in the same buffer, but only
+         * before the tip, so the copy can't overlap.
+         */
+        memcpy(o->u.str.buf + a->len, b->buf, b->len);
+    } else {
+        o = fstr_builder_new(f, 2 * len);
+        memcpy(o->u.str.buf, a->buf, a->len);
+        memcpy(o->u.str.buf + a->len, b->buf, b->len);
+    }
+
+    o->u.str.buf[len] = 0;
+    FSTR_BUILD(&o->u.str)->used = len;
+    return fstr_slice(f, o, 0, len);
 }
 
 static fobj_t *fstr_compare(fenv_t *f, fobj_t *op1, fobj_t *op2)
 {
-    int r = strcmp(op1->u.str.buf, op2->u.str.buf);
-    return fnum_new(f, r);
+    return fnum_new(f, fstr_cmp(f, op1, op2));
 }
 
 fobj_t *fstr_add(fenv_t *f, fobj_t *op1, fobj_t *op2)
@@ -103,11 +519,11 @@ int fstr_cmp(fenv_t *f, fobj_t *a, fobj_t *b)
 
     if (A->len < B->len) {
         cmp = memcmp(A->buf, B->buf, A->len);
-        if (cmp == 0) return 1; // B is 'bigger'
+        if (cmp == 0) return -1; // B is 'bigger'
         else          return cmp;
     } else if (A->len > B->len) {
         cmp = memcmp(A->buf, B->buf, B->len);
-        if (cmp == 0) return -1; // A is 'bigger'
+        if (cmp == 0) return 1; // A is 'bigger'
         else          return cmp;
     } else {
         cmp = memcmp(A->buf, B->buf, B->len);
@@ -115,11 +531,23 @@ int fstr_cmp(fenv_t *f, fobj_t *a, fobj_t *b)
     }
 }
 
+/*
+ * fstr_fetch()
+ *
+ * str n ] @ is the character code at n; str @ is the length.
+ */
 fobj_t *fstr_fetch(fenv_t *f, fobj_t *addr, fobj_t *index)
 {
-    // fstr_t *addr = &op1->u.str;
+    fstr_t *s = &addr->u.str;
 
-    return 0;
+    if (!index) {
+        return fnum_new(f, s->len);
+    }
+
+    FASSERT(index->type == FOBJ_NUM, "a string must be indexed by NUM");
+    fnumber_t n = index->u.num.n;
+    FASSERT(n >= 0 && n < s->len, "index %Lg is outside a string of length %d", n, s->len);
+    return fnum_new(f, (unsigned char) s->buf[(int) n]);
 }
 
 int fstr_len(fenv_t *f, fobj_t *str)
@@ -139,5 +567,140 @@ int fstr_getchar(fenv_t *f, fobj_t *str, int offset)
 
 fnumber_t fstr_to_number(fenv_t *f, fobj_t *str)
 {
-    return strtold(str->u.str.buf, NULL);
+    return strtold(fstr_cstr(f, str), NULL);
+}
+
+/***********************************
+ *
+ * Slicing, searching and splitting
+ *
+ * Substrings are slices (see fstr_slice()), so none of these copy bytes
+ * except replace.  Searches use the fscan kernels.
+ *
+ ***********************************/
+
+fobj_t *fstr_substr(fenv_t *f, fobj_t *p, int start, int len)
+{
+    fstr_t *s = &p->u.str;
+
+    FASSERT(start >= 0 && len >= 0 && start <= s->len && len <= s->len - start,
+            "substr of %d at %d is outside a string of length %d", len, start, s->len);
+    return fstr_slice(f, p, start, len);
+}
+
+/*
+ * fstr_find() and fstr_rfind()
+ *
+ * The offset of the first (last) occurrence of needle in p, or -1.
+ */
+int fstr_find(fenv_t *f, fobj_t *p, fobj_t *needle)
+{
+    size_t i = fscan_search(p->u.str.buf, p->u.str.len,
+                            needle->u.str.buf, needle->u.str.len);
+    return i == FSCAN_NONE ? -1 : (int) i;
+}
+
+int fstr_rfind(fenv_t *f, fobj_t *p, fobj_t *needle)
+{
+    size_t i = fscan_rsearch(p->u.str.buf, p->u.str.len,
+                             needle->u.str.buf, needle->u.str.len);
+    return i == FSCAN_NONE ? -1 : (int) i;
+}
+
+int fstr_starts_with(fenv_t *f, fobj_t *p, fobj_t *prefix)
+{
+    int n = prefix->u.str.len;
+
+    return n <= p->u.str.len && memcmp(p->u.str.buf, prefix->u.str.buf, n) == 0;
+}
+
+/*
+ * fstr_split()
+ *
+ * A table of the pieces of p between occurrences of sep.
+ */
+fobj_t *fstr_split(fenv_t *f, fobj_t *p, fobj_t *sep)
+{
+    fstr_t *s = &p->u.str;
+    int seplen = sep->u.str.len;
+    int start = 0, n = 0;
+
+    FASSERT(seplen > 0, "split requires a non-empty separator");
+
+    fobj_t *table = ftable_new(f);
+    int mark = fobj_hold_mark(f);
+
+    do {
+        size_t i = fscan_search(s->buf + start, s->len - start, sep->u.str.buf, seplen);
+        int end = i == FSCAN_NONE ? s->len : start + (int) i;
+
+        ftable_store(f, table, fnum_new(f, n++), fstr_slice(f, p, start, end - start));
+        fobj_hold_release(f, mark);
+        start = end + seplen;
+    } while (start <= s->len);
+
+    return table;
+}
+
+/*
+ * fstr_trim()
+ *
+ * p without leading and trailing white space.
+ */
+fobj_t *fstr_trim(fenv_t *f, fobj_t *p)
+{
+    fstr_t *s = &p->u.str;
+    int start = 0, end = s->len;
+
+    while (start < end && isspace((unsigned char) s->buf[start]))  start++;
+    while (end > start && isspace((unsigned char) s->buf[end - 1])) end--;
+
+    if (start == 0 && end == s->len) {
+        return p;
+    }
+    return fstr_slice(f, p, start, end - start);
+}
+
+/*
+ * fstr_replace()
+ *
+ * p with every occurrence of old replaced by new.  The matches are found
+ * first so the result is allocated once at its final size.
+ */
+fobj_t *fstr_replace(fenv_t *f, fobj_t *p, fobj_t *old, fobj_t *new)
+{
+    fstr_t *s = &p->u.str;
+    int olen = old->u.str.len;
+    int nlen = new->u.str.len;
+    int count = 0;
+    size_t i;
+
+    FASSERT(olen > 0, "replace requires a non-empty string to replace");
+
+    for (int at = 0;
+         (i = fscan_search(s->buf + at, s->len - at, old->u.str.buf, olen)) != FSCAN_NONE;
+         at += i + olen) {
+        count++;
+    }
+
+    if (count == 0) {
+        return p;
+    }
+
+    fobj_t *r = fstr_alloc(f, s->len + count * (nlen - olen));
+    char *d = r->u.str.buf;
+
+    for (int at = 0; ; at += i + olen) {
+        i = fscan_search(s->buf + at, s->len - at, old->u.str.buf, olen);
+        if (i == FSCAN_NONE) {
+            memcpy(d, s->buf + at, s->len - at);
+            break;
+        }
+        memcpy(d, s->buf + at, i);
+        d += i;
+        memcpy(d, new->u.str.buf, nlen);
+        d += nlen;
+    }
+
+    return r;
 }
@@ -24,6 +24,7 @@ fobj_t *ftable_new(fenv_t *f)
 
     t->array = farray_new(f);
     t->hash = fhash_new(f);
+    t->hash_nums = 0;
 
     return p;
 }
@@ -36,6 +37,167 @@ void ftable_visit(fenv_t *f, fobj_t *p)
     fobj_visit(f, t->hash);
 }
 
+/***********************************
+ *
+ * Keys
+ *
+ * A table has an array part for the numbers from 0 up to some size and
+ * a hash part for every other key, as in Lua.  A number key goes in the
+ * array part if it's already covered by it, or extends it by one (so
+ * filling a table in order stays in the array); otherwise it goes in the
+ * hash part, so a few keys far apart, negative or fractional cost a
+ * hash entry each rather than a huge array.
+ *
+ * Every time the number of number keys in the hash part reaches a power
+ * of two, the table works out afresh how big its array part should be:
+ * the largest power of two n such that more than half of 0 to n-1 are
+ * keys.  Keys below the new size move out of the hash and into the
+ * array.  The array part never shrinks.
+ *
+ ***********************************/
+
+#define FTABLE_MAX_ARRAY	(1 << 30)
+
+/*
+ * If key is a number which could be an index into the array part, set
+ * *n to it.
+ */
+static int ftable_int_key(fobj_t *key, int *n)
+{
+    if (key->type != FOBJ_NUM) {
+        return 0;
+    }
+
+    fnumber_t k = key->u.num.n;
+    if (k < 0 || k >= FTABLE_MAX_ARRAY || k != (int) k) {
+        return 0;
+    }
+    *n = (int) k;
+    return 1;
+}
+
+/*
+ * The slice of counts a key k goes in: keys 0, 1, 2-3, 4-7, ... go in
+ * slices 0, 1, 2, 3, ..., so slice i ends at 2^i.
+ */
+static int ftable_slice(int k)
+{
+    int i = 0;
+
+    while ((1 << i) <= k) i++;
+    return i;
+}
+
+typedef struct {
+    fobj_t		*array;
+    int			 size;
+} ftable_move_t;
+
+static int ftable_move_hash_key(fenv_t *f, fobj_t *key, fobj_t *val, void *arg)
+{
+    ftable_move_t *m = arg;
+    int k;
+
+    if (ftable_int_key(key, &k) && k < m->size) {
+        m->array->u.array.elems[k] = val;
+        return 1;
+    }
+    return 0;
+}
+
+static void ftable_rehash(fenv_t *f, ftable_t *t)
+{
+    farray_t *a = &t->array->u.array;
+    int nums[32] = { 0 }, total = 0, k;
+
+    for (int i = 0; i < a->num; i++) {
+        if (a->elems[i]) nums[ftable_slice(i)]++;
+    }
+    for (int i = 0; i < fhash_count(f, t->hash); i++) {
+        if (ftable_int_key(fhash_key_at(f, t->hash, i), &k)) {
+            nums[ftable_slice(k)]++;
+        }
+    }
+
+    for (int i = 0; i < 32; i++) total += nums[i];
+
+    /*
+     * The largest power of two more than half full.
+     */
+    int size = 0, sofar = 0;
+    for (int i = 0; i < 31 && (1 << i) / 2 < total; i++) {
+        sofar += nums[i];
+        if (sofar > (1 << i) / 2) {
+            size = 1 << i;
+        }
+    }
+
+    if (size <= a->num) {
+        return;
+    }
+
+    farray_resize(f, t->array, size);
+
+    ftable_move_t m = { t->array, size };
+    t->hash_nums -= fhash_remove_if(f, t->hash, ftable_move_hash_key, &m);
+}
+
+/*
+ * ftable_set_weak()
+ *
+ * Make a table's keys, values or both weak (see fhash.c).  Only its
+ * hash part can be weak, so every key moves there and stays there; the
+ * array part is left empty.  The collector takes keys out of the hash
+ * without telling the table, so from then on hash_nums is only an upper
+ * bound, which is all ftable_fetch() needs.
+ */
+void ftable_set_weak(fenv_t *f, fobj_t *p, int weak)
+{
+    ftable_t *t = &p->u.table;
+    farray_t *a = &t->array->u.array;
+
+    fhash_set_weak(f, t->hash, weak);
+
+    for (int i = 0; i < a->num; i++) {
+        if (a->elems[i]) {
+            int mark = fobj_hold_mark(f);
+            fhash_store(f, t->hash, fnum_new(f, i), a->elems[i]);
+            t->hash_nums++;
+            fobj_hold_release(f, mark);
+        }
+    }
+    a->num = 0;
+}
+
+/*
+ * ftable_next()
+ *
+ * Walk a table: the array part in order, then the hash part.  *cursor
+ * starts at 0; each call sets *val and returns 1, or returns 0 at the
+ * end.  *key is set for the hash part; it's NULL for the array part,
+ * where the element's index is *cursor - 1, so walking the array part
+ * doesn't make a number for each key.
+ */
+int ftable_next(fenv_t *f, fobj_t *p, int *cursor, fobj_t **key, fobj_t **val)
+{
+    ftable_t *t = &p->u.table;
+    int n = t->array->u.array.num;
+
+    if (*cursor < n) {
+        *key = NULL;
+        if (farray_next(f, t->array, cursor, val)) {
+            return 1;
+        }
+    }
+
+    int h = *cursor - n;
+    if (fhash_next(f, t->hash, &h, key, val)) {
+        *cursor = n + h;
+        return 1;
+    }
+    return 0;
+}
+
 /***********************************
  *
  * ftable_fetch()
@@ -45,32 +207,22 @@ void ftable_visit(fenv_t *f, fobj_t *p)
 fobj_t *ftable_fetch(fenv_t *f, fobj_t *addr, fobj_t *index)
 {
     ftable_t *t = &addr->u.table;
+    int k;
 
     if (index) {
-        switch(index->type) {
-        case FOBJ_NUM:
-            FASSERT(t->array != NULL, "Can't index an empty array");
-            return farray_fetch(f, t->array, index);
-
-        case FOBJ_STR:
-            FASSERT(t->hash != NULL, "Can't index an empty hash");
-            return fhash_fetch(f, t->hash, index);
-
-        default:
-            FASSERT(0, "An indexed table store must be indexed by either a NUM or STRING");
+        if (ftable_int_key(index, &k) && k < t->array->u.array.num) {
+            return t->array->u.array.elems[k];
+        }
+        if (index->type == FOBJ_NUM && !t->hash_nums) {
             return NULL;
         }
+        return fhash_fetch(f, t->hash, index);
     } else {
         /*
          * Return the number of integer elements in the table.  I.e., it's
          * the array size if the table is used as an array.
          */
-
-        if (!t->array) {
-            return fnum_new(f, 0);
-        } else {
-            return fnum_new(f, farray_fetch(f, t->hash, NULL)->u.num.n);
-        }
+        return fnum_new(f, t->array->u.array.num);
     }
 }
 
@@ -84,19 +236,27 @@ void ftable_store(fenv_t *f, fobj_t *addr, fobj_t *index, fobj_t *data)
 {
     FASSERT(index, "table store must be indexed");
     ftable_t *t = &addr->u.table;
+    farray_t *a = &t->array->u.array;
+    int k;
 
-    switch(index->type) {
-    case FOBJ_NUM:
-        FASSERT(t->array != NULL, "Can't index an empty hash");
-        farray_store(f, t->array, index, data);
-        break;
+    if (!t->hash->u.hash.weak && ftable_int_key(index, &k)) {
+        if (k < a->num) {
+            a->elems[k] = data;
+            return;
+        }
+        if (k == a->num && !(t->hash_nums && fhash_has(f, t->hash, index))) {
+            farray_store(f, t->array, index, data);
+            return;
+        }
+    }
 
-    case FOBJ_STR:
-        FASSERT(t->hash != NULL, "Can't index an empty hash");
-        fhash_store(f, t->hash, index, data);
-        break;
+    int before = fhash_count(f, t->hash);
+    fhash_store(f, t->hash, index, data);
 
-    default:
-        FASSERT(0, "table store must be indexed by NUM or STRING");
+    if (index->type == FOBJ_NUM && fhash_count(f, t->hash) > before) {
+        t->hash_nums++;
+        if ((t->hash_nums & (t->hash_nums - 1)) == 0 && !t->hash->u.hash.weak) {
+            ftable_rehash(f, t);
+        }
     }
 }